@@ -0,0 +1,105 @@
+// Checks the parallel parsing of object records against the serial ReadPrimitive() loop on scene files, e.g.
+// g++ -O2 -pthread ParseCheck.cpp -o parsecheck && ./parsecheck test/*.test
+// The chunks are made a few bytes small, so that even the small scenes are split at many record boundaries.
+// It is compiled as one translation unit with the ray tracer, so it can call the renderer's own functions.
+#define RAYTRACER_NO_MAIN
+#include "main.cpp"
+
+const size_t PARSE_CHECK_CHUNK_BYTES[] = {16, 64, 256}; // Smallest chunks the parallel parsing is checked with
+const unsigned PARSE_CHECK_THREADS(4);										 // Threads the parallel parsing is checked with
+
+/**
+ * @brief Compares two records read from a .test file
+ * @param[in] a First record
+ * @param[in] b Second record
+ * @return Whether all their values are the same
+ */
+bool IsSamePrimitive(const PackedPrimitive& a, const PackedPrimitive& b)
+{
+	return a.type == b.type and std::equal(a.data, a.data + 9, b.data) and std::equal(a.uv, a.uv + 6, b.uv) and a.visibility == b.visibility
+		and a.material.ambient == b.material.ambient and a.material.diffuse == b.material.diffuse and a.material.specular == b.material.specular
+		and a.material.shininess == b.material.shininess and a.material.texture == b.material.texture;
+}
+
+/**
+ * @brief Parses the object records of a scene file serially and in parallel with every chunk size, and compares the results
+ * @param[in] scenePath .test file
+ * @return Number of chunk sizes whose result differs from the serial one (or 1 if the file could not be read)
+ */
+size_t CheckScene(const std::string& scenePath)
+{
+	std::ifstream sceneFile(scenePath);
+	Camera camera;
+	int maxDepth;
+	size_t numOfObjects;
+	sceneFile >> camera.imageWidth >> camera.imageHeight;
+	sceneFile >> camera.position.x >> camera.position.y >> camera.position.z;
+	sceneFile >> camera.lookTarget.x >> camera.lookTarget.y >> camera.lookTarget.z;
+	sceneFile >> camera.globalUp.x >> camera.globalUp.y >> camera.globalUp.z;
+	sceneFile >> camera.fovY >> camera.focalLength;
+	sceneFile >> maxDepth >> numOfObjects;
+
+	std::streampos start(sceneFile.tellg());
+	PackedPrimitive primitive;
+	std::vector<PackedPrimitive> expected;
+	std::vector<std::string> expectedTextureNames;
+	for (size_t i = 0; i < numOfObjects and sceneFile; ++i)
+	{
+		if (ReadPrimitive(sceneFile, primitive, expectedTextureNames))
+			expected.push_back(primitive);
+	}
+	if (!sceneFile or expected.size() != numOfObjects)
+	{
+		std::cerr << "Could not read " << scenePath << ".\n";
+		return 1;
+	}
+
+	// Both have to leave the stream where the light count can be read
+	std::string expectedNext, next;
+	sceneFile >> expectedNext;
+	sceneFile.clear();
+	sceneFile.seekg(0, std::ios::end);
+	std::streamoff size(sceneFile.tellg() - start);
+
+	size_t numOfErrors(0);
+	for (size_t chunkBytes : PARSE_CHECK_CHUNK_BYTES)
+	{
+		// Too little to parse falls back to the serial loop, which is not what is checked
+		if (size < static_cast<std::streamoff>(2 * chunkBytes))
+			continue;
+
+		sceneFile.clear();
+		sceneFile.seekg(start);
+		std::vector<PackedPrimitive> primitives;
+		std::vector<std::string> textureNames;
+		bool read(ReadPrimitivesInParallel(sceneFile, numOfObjects, PARSE_CHECK_THREADS, primitives, textureNames, chunkBytes));
+		next.clear();
+		sceneFile >> next;
+		bool same(read and next == expectedNext and textureNames == expectedTextureNames and primitives.size() == expected.size());
+		for (size_t i = 0; i < primitives.size() and same; ++i)
+			same = IsSamePrimitive(primitives[i], expected[i]);
+		if (!same)
+		{
+			std::cout << scenePath << ": parallel parsing with " << chunkBytes << "-byte chunks differs from the serial parsing" << std::endl;
+			++numOfErrors;
+		}
+	}
+	std::cout << scenePath << ": " << numOfObjects << " records, " << numOfErrors << " mismatches" << std::endl;
+	return numOfErrors;
+}
+
+/**
+ * Main function
+ */
+int main(int argc, char* argv[])
+{
+	if (argc < 2)
+	{
+		std::cerr << "Usage: " << argv[0] << " <scene.test>...\n";
+		return 1;
+	}
+	size_t numOfErrors(0);
+	for (int i = 1; i < argc; ++i)
+		numOfErrors += CheckScene(argv[i]);
+	return (numOfErrors == 0) ? 0 : 1;
+}
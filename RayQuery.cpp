@@ -0,0 +1,188 @@
+// Bulk ray queries for programs that link the ray tracer as a library, e.g. g++ -c RayQuery.cpp.
+// The renderer is compiled into this translation unit without its main().
+#define RAYTRACER_NO_MAIN
+#include "main.cpp"
+
+const size_t RAY_QUERY_GRAIN(4096); // Rays per work item of a bulk ray query (a multiple of 32 for the occlusion bits)
+
+struct RayQueryScene
+{
+	Scene scene;	 // Scene data
+	Camera camera; // Camera of the scene file
+
+	/**
+	 * @brief Destructor
+	 */
+	~RayQueryScene()
+	{
+		for (size_t i = 0; i < scene.objects.size(); ++i)
+		{
+			delete scene.objects[i];
+		}
+		for (size_t i = 0; i < scene.meshes.size(); ++i)
+		{
+			delete scene.meshes[i];
+		}
+	}
+};
+
+/**
+ * @brief Loads a scene file for bulk ray queries
+ * @param[in] scenePath .test file
+ * @param[in] settings  Load options (e.g. levels of detail, of which the queries test only the original triangles)
+ * @return Scene to query (nullptr if it could not be loaded; an error has been printed)
+ */
+RayQueryScene* LoadRayQueryScene(const std::string& scenePath, const RenderSettings& settings)
+{
+	std::ifstream sceneFile(scenePath);
+	if (!sceneFile)
+	{
+		std::cerr << "File not found: " << scenePath << "\n";
+		return nullptr;
+	}
+
+	SceneStatistics statistics;
+	int maxDepth;
+	std::unique_ptr<RayQueryScene> scene(new RayQueryScene());
+	if (!LoadScene(sceneFile, scenePath, settings, scene->scene, scene->camera, maxDepth, statistics))
+	{
+		std::cerr << "Could not read " << scenePath << ".\n";
+		return nullptr;
+	}
+	return scene.release();
+}
+
+RayQueryScene* LoadRayQueryScene(const std::string& scenePath)
+{
+	return LoadRayQueryScene(scenePath, RenderSettings());
+}
+
+void FreeRayQueryScene(RayQueryScene* scene)
+{
+	delete scene;
+}
+
+/**
+ * @brief Gets one ray of a bulk query with its direction normalized, as the objects' Intersect() expects
+ * @param[in]  batch   Rays
+ * @param[in]  i       Index of the ray
+ * @param[out] outRay  Ray
+ * @param[out] outTMax Farthest world-space distance a hit counts at
+ * @return Length of the ray's direction, which world-space distances are divided by (0 if the ray has no direction)
+ */
+float GetQueryRay(const RayQueryBatch& batch, const size_t& i, Ray& outRay, float& outTMax)
+{
+	glm::vec3 direction(batch.directionX[i], batch.directionY[i], batch.directionZ[i]);
+	float length(glm::length(direction));
+	outRay.origin = glm::vec3(batch.originX[i], batch.originY[i], batch.originZ[i]);
+	outRay.direction = (length > 0.0f) ? direction / length : direction;
+	outRay.pathLength = 0.0f;
+	outTMax = (batch.tMax != nullptr) ? batch.tMax[i] * length : FLT_MAX;
+	return length;
+}
+
+void IntersectRays(const RayQueryScene& scene, const RayQueryBatch& batch, const RayHitBuffers& outHits, const uint32_t& rayType, const unsigned& numOfThreads)
+{
+	const std::vector<SceneObject*>& objects(scene.scene.objects);
+	const std::vector<LodMesh*>& meshes(scene.scene.meshes);
+	ParallelFor(batch.count, RAY_QUERY_GRAIN, numOfThreads, [&](const size_t& begin, const size_t& end) {
+		Ray ray;
+		glm::vec3 point, normal, closestNormal;
+		float entry;
+		for (size_t i = begin; i < end; ++i)
+		{
+			float tMax;
+			float length(GetQueryRay(batch, i, ray, tMax));
+			float closestT(FLT_MAX);
+			int32_t closest(-1);
+			for (size_t j = 0; j < objects.size() and length > 0.0f; ++j)
+			{
+				if (!(objects[j]->visibility & rayType))
+					continue;
+				float t(objects[j]->Intersect(ray, point, normal));
+				if (t > 0.0f and t <= tMax and t < closestT)
+				{
+					closestT = t;
+					closest = static_cast<int32_t>(j);
+					closestNormal = normal;
+				}
+			}
+
+			// Meshes with levels of detail are tested at their original triangles, which are numbered after the objects
+			size_t firstTriangle(objects.size());
+			for (size_t m = 0; m < meshes.size() and length > 0.0f; ++m)
+			{
+				const std::vector<Triangle*>& triangles(meshes[m]->levels[0].triangles);
+				if ((meshes[m]->visibility & rayType) and meshes[m]->bounds.Intersect(ray, entry) and entry <= std::min(closestT, tMax))
+				{
+					for (size_t j = 0; j < triangles.size(); ++j)
+					{
+						float t(triangles[j]->Intersect(ray, point, normal));
+						if (t > 0.0f and t <= tMax and t < closestT)
+						{
+							closestT = t;
+							closest = static_cast<int32_t>(firstTriangle + j);
+							closestNormal = normal;
+						}
+					}
+				}
+				firstTriangle += triangles.size();
+			}
+
+			if (closest < 0)
+				closestNormal = glm::vec3();
+			if (outHits.t != nullptr)
+				outHits.t[i] = (closest >= 0) ? closestT / length : NO_INTERSECTION;
+			if (outHits.primitive != nullptr)
+				outHits.primitive[i] = closest;
+			if (outHits.normalX != nullptr)
+				outHits.normalX[i] = closestNormal.x;
+			if (outHits.normalY != nullptr)
+				outHits.normalY[i] = closestNormal.y;
+			if (outHits.normalZ != nullptr)
+				outHits.normalZ[i] = closestNormal.z;
+		}
+	});
+}
+
+void OccludedRays(const RayQueryScene& scene, const RayQueryBatch& batch, uint32_t* outOccluded, const uint32_t& rayType, const unsigned& numOfThreads)
+{
+	const std::vector<SceneObject*>& objects(scene.scene.objects);
+	const std::vector<LodMesh*>& meshes(scene.scene.meshes);
+	ParallelFor(batch.count, RAY_QUERY_GRAIN, numOfThreads, [&](const size_t& begin, const size_t& end) {
+		Ray ray;
+		glm::vec3 point, normal;
+		float entry;
+		for (size_t word = begin / 32; word < (end + 31) / 32; ++word)
+			outOccluded[word] = 0;
+		for (size_t i = begin; i < end; ++i)
+		{
+			float tMax;
+			float length(GetQueryRay(batch, i, ray, tMax));
+			bool occluded(false);
+			for (size_t j = 0; j < objects.size() and length > 0.0f and !occluded; ++j)
+			{
+				if (objects[j]->visibility & rayType)
+				{
+					float t(objects[j]->Intersect(ray, point, normal));
+					occluded = (t > 0.0f and t <= tMax);
+				}
+			}
+
+			// Meshes with levels of detail are tested at their original triangles
+			for (size_t m = 0; m < meshes.size() and length > 0.0f and !occluded; ++m)
+			{
+				const std::vector<Triangle*>& triangles(meshes[m]->levels[0].triangles);
+				if (!(meshes[m]->visibility & rayType) or !meshes[m]->bounds.Intersect(ray, entry) or entry > tMax)
+					continue;
+				for (size_t j = 0; j < triangles.size() and !occluded; ++j)
+				{
+					float t(triangles[j]->Intersect(ray, point, normal));
+					occluded = (t > 0.0f and t <= tMax);
+				}
+			}
+			if (occluded)
+				outOccluded[i / 32] |= 1u << (i % 32);
+		}
+	});
+}
@@ -0,0 +1,78 @@
+#ifndef RAY_QUERY_H
+#define RAY_QUERY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Ray types an object is visible to. Rays skip objects whose mask does not contain their type.
+enum VisibilityFlags
+{
+	CAMERA_VISIBLE = 1,
+	SHADOW_VISIBLE = 2,
+	REFLECTION_VISIBLE = 4,
+	ALL_VISIBLE = CAMERA_VISIBLE | SHADOW_VISIBLE | REFLECTION_VISIBLE
+};
+
+// Rays of a bulk query, as structure-of-arrays buffers owned by the caller.
+// Distances are in units of the direction's length, so with normalized directions they are world-space distances.
+struct RayQueryBatch
+{
+	size_t count;							// Number of rays
+	const float* originX;			// Origins
+	const float* originY;
+	const float* originZ;
+	const float* directionX;	// Directions (need not be normalized; rays without a direction hit nothing)
+	const float* directionY;
+	const float* directionZ;
+	const float* tMax;				// Hits farther than this are ignored (nullptr for no limit)
+};
+
+// Caller-owned outputs of a closest-hit query, one entry per ray. Any of the pointers can be nullptr to skip that output.
+struct RayHitBuffers
+{
+	float* t;					 // Distance to the closest hit (NO_INTERSECTION on a miss)
+	int32_t* primitive; // Index of the closest hit among the scene's objects, then the original triangles of its meshes with levels of detail (-1 on a miss)
+	float* normalX;		 // Surface normal at the closest hit (0 on a miss)
+	float* normalY;
+	float* normalZ;
+};
+
+// Scene loaded for bulk ray queries (defined by the ray tracer)
+struct RayQueryScene;
+
+/**
+ * @brief Loads a scene file for bulk ray queries, with the renderer's default load options
+ * @param[in] scenePath .test file
+ * @return Scene to query (nullptr if it could not be loaded; an error has been printed)
+ */
+RayQueryScene* LoadRayQueryScene(const std::string& scenePath);
+
+/**
+ * @brief Frees a scene returned by LoadRayQueryScene()
+ * @param[in] scene Scene (can be nullptr)
+ */
+void FreeRayQueryScene(RayQueryScene* scene);
+
+/**
+ * @brief Finds the closest hit in (0, tMax] of every ray of a batch, in parallel, for visibility and line-of-sight analysis.
+ * Unlike the renderer's Raycast(), only hits in front of the origin count.
+ * @param[in]  scene        Scene
+ * @param[in]  batch        Rays
+ * @param[out] outHits      Hit buffers with room for batch.count entries each
+ * @param[in]  rayType      Type of the rays (one of VisibilityFlags). Objects hidden from this type are skipped.
+ * @param[in]  numOfThreads Number of threads to use (0 for one per available core)
+ */
+void IntersectRays(const RayQueryScene& scene, const RayQueryBatch& batch, const RayHitBuffers& outHits, const uint32_t& rayType = CAMERA_VISIBLE, const unsigned& numOfThreads = 0);
+
+/**
+ * @brief Checks for every ray of a batch whether anything is hit in (0, tMax], in parallel. Stops at the first hit of each ray.
+ * @param[in]  scene        Scene
+ * @param[in]  batch        Rays
+ * @param[out] outOccluded  Bit i % 32 of word i / 32 is set if ray i is occluded; needs (batch.count + 31) / 32 words
+ * @param[in]  rayType      Type of the rays (one of VisibilityFlags). Objects hidden from this type are skipped.
+ * @param[in]  numOfThreads Number of threads to use (0 for one per available core)
+ */
+void OccludedRays(const RayQueryScene& scene, const RayQueryBatch& batch, uint32_t* outOccluded, const uint32_t& rayType = SHADOW_VISIBLE, const unsigned& numOfThreads = 0);
+
+#endif
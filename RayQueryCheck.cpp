@@ -0,0 +1,86 @@
+// Checks the bulk ray queries against the renderer's Raycast() on the camera rays of a scene, e.g.
+// g++ -O2 RayQueryCheck.cpp -o raycheck && ./raycheck test/scene3.test
+// With --lod the queried scene gets levels of detail, whose original triangles have to give the hits of the plain scene.
+// It is compiled as one translation unit with the library, so it can call the renderer's own functions.
+#include "RayQuery.cpp"
+
+const float RAY_QUERY_CHECK_TOLERANCE(1e-4f); // Largest relative difference between the distances of the two queries
+
+/**
+ * Main function
+ */
+int main(int argc, char* argv[])
+{
+	bool levelsOfDetail(argc == 3 and std::string(argv[2]) == "--lod");
+	if (argc != 2 and !levelsOfDetail)
+	{
+		std::cerr << "Usage: " << argv[0] << " <scene.test> [--lod]\n";
+		return 1;
+	}
+	RenderSettings querySettings;
+	querySettings.levelsOfDetail = levelsOfDetail;
+	std::unique_ptr<RayQueryScene, void (*)(RayQueryScene*)> query(LoadRayQueryScene(argv[1], querySettings), FreeRayQueryScene);
+	std::unique_ptr<RayQueryScene, void (*)(RayQueryScene*)> reference(levelsOfDetail ? LoadRayQueryScene(argv[1]) : nullptr, FreeRayQueryScene);
+	if (query == nullptr or (levelsOfDetail and reference == nullptr))
+		return 1;
+	const Scene& referenceScene(levelsOfDetail ? reference->scene : query->scene);
+
+	// One camera ray per pixel. Directions get lengths 1 to 3, so distances have to come back in units of the length.
+	const Camera& camera(query->camera);
+	size_t count(static_cast<size_t>(camera.imageWidth) * camera.imageHeight);
+	std::vector<float> originX(count), originY(count), originZ(count), directionX(count), directionY(count), directionZ(count), tMax(count);
+	std::vector<IntersectionInfo> expected(count);
+	for (size_t i = 0; i < count; ++i)
+	{
+		Ray ray(GetRayThruPixel(camera, static_cast<int>(i % camera.imageWidth), static_cast<int>(i / camera.imageWidth)));
+		glm::vec3 direction(ray.direction * (1.0f + i % 3));
+		originX[i] = ray.origin.x;
+		originY[i] = ray.origin.y;
+		originZ[i] = ray.origin.z;
+		directionX[i] = direction.x;
+		directionY[i] = direction.y;
+		directionZ[i] = direction.z;
+
+		// Raycast() gets the direction the queries normalize the scaled one to, so rays that graze an edge agree as well
+		ray.direction = direction / glm::length(direction);
+		expected[i] = Raycast(ray, referenceScene);
+	}
+	auto isHit = [&](const size_t& i) { return expected[i].obj != nullptr and expected[i].t > 0.0f; };
+
+	std::vector<float> t(count);
+	std::vector<int32_t> primitive(count);
+	RayQueryBatch batch = {count, originX.data(), originY.data(), originZ.data(), directionX.data(), directionY.data(), directionZ.data(), nullptr};
+	RayHitBuffers hits = {t.data(), primitive.data(), nullptr, nullptr, nullptr};
+	IntersectRays(*query, batch, hits);
+
+	size_t numOfHitErrors(0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		float scale(1.0f + i % 3);
+		// Where two objects are hit at the same distance (e.g. on the shared edge of two triangles) either one is the closest hit
+		if (isHit(i) ? (primitive[i] < 0 or std::abs(t[i] * scale - expected[i].t) > RAY_QUERY_CHECK_TOLERANCE * std::max(1.0f, expected[i].t))
+					 : primitive[i] >= 0)
+			++numOfHitErrors;
+	}
+
+	// Every hit is occluded just past its distance and not occluded halfway there
+	std::vector<uint32_t> occludedNear((count + 31) / 32), occludedFar((count + 31) / 32);
+	batch.tMax = tMax.data();
+	for (size_t i = 0; i < count; ++i)
+		tMax[i] = isHit(i) ? 0.5f * expected[i].t / (1.0f + i % 3) : FLT_MAX;
+	OccludedRays(*query, batch, occludedNear.data(), CAMERA_VISIBLE);
+	for (size_t i = 0; i < count; ++i)
+		tMax[i] = isHit(i) ? 1.01f * expected[i].t / (1.0f + i % 3) : FLT_MAX;
+	OccludedRays(*query, batch, occludedFar.data(), CAMERA_VISIBLE);
+
+	size_t numOfOcclusionErrors(0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		bool near((occludedNear[i / 32] >> (i % 32)) & 1), far((occludedFar[i / 32] >> (i % 32)) & 1);
+		if (near or far != isHit(i))
+			++numOfOcclusionErrors;
+	}
+
+	std::cout << count << " rays: " << numOfHitErrors << " closest-hit mismatches, " << numOfOcclusionErrors << " occlusion mismatches" << std::endl;
+	return (numOfHitErrors == 0 and numOfOcclusionErrors == 0) ? 0 : 1;
+}
@@ -1,14 +1,55 @@
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cctype>
+#include <cfloat>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
 #include <iomanip>
 #include <iostream>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sched.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+#endif
+
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
+#include "RayQuery.h"
+
 enum LightType
 {
 	DIRECTIONAL_LIGHT,
@@ -22,11 +63,114 @@ const float SHADOW_BIAS(0.001f);
 const float REFLECTION_BIAS(0.001f);
 const float REFLECTIVITY_CONSTANT(128.0f);
 const int SAMPLES_PER_PIXEL(5);
+const int OUT_OF_CORE_CHUNK_SIZE(4096); // Primitives per chunk of a packed geometry file
+const int OUT_OF_CORE_BATCH_ROWS(16);		// Image rows whose rays are traced together in out-of-core mode
+const float QUANTIZED_PLANE_TOLERANCE(0.001f);	// Largest 1 - cos(angle) between the normals of triangles that a quantized mesh treats as one plane
+const int TILE_SIZE(32);											// Width and height of the tiles that render workers pick up
+const int PROGRESS_INTERVAL_MS(250);							// Time between progress updates
+const int MAX_REFINEMENT_SAMPLES(256);						// Most samples per pixel a progressive render accumulates
+const int MIN_CONVERGENCE_SAMPLES(8);							// Samples per pixel before a tile's error estimate is trusted
+const int CHECKPOINT_INTERVAL_S(60);							// Default time between checkpoints of a render
+const float DEFAULT_MAX_COMPARISON_ERROR(0.02f);				// RMSE above which --compare fails a scene
+const int COMPARISON_RUNS(2);													// Timed renders of each configuration per scene in --compare (the fastest counts)
+const int CANCELLED_EXIT_STATUS(3);								// Exit status of a render stopped by SIGINT or SIGTERM
+const int PREVIEW_MAX_DEPTH(2);												// Maximum depth of the trace in preview mode
+const size_t PREVIEW_GRAIN(1024);												// Samples per work item of a preview render
+const float MIN_INTERACTIVE_SCALE(0.125f);									// Lowest internal resolution of interactive frames, relative to the output
+const double FRAME_COST_SMOOTHING(0.5);										// Weight of the latest frame in the running estimate of the time per sample
+const float MIRROR_MIN_REFLECTIVITY(0.5f);									// Share of reflected light (shininess / REFLECTIVITY_CONSTANT) from which a flat object is a mirror
+const float MIRROR_PLANE_TOLERANCE(1e-4f);									// Largest difference in normal (1 - cos) and plane distance between triangles of one mirror plane
+const float DEFAULT_SHADING_THRESHOLD(0.05f);					// Largest normal, depth, color and reflectivity difference that variable-rate shading interpolates across
+const float HUGE_PRIMITIVE_FRACTION(0.25f);					// Objects whose bounds diagonal exceeds this fraction of the scene's are reported as huge
+const int32_t NO_TEXTURE(-1);											// Texture index of materials without a texture
+const int TEXTURE_TILE_SIZE(32);										// Width and height of the texel tiles that textures are stored and cached in
+const size_t DEFAULT_TEXTURE_CACHE_MB(64);							// Default memory budget of the texture cache
+const float MIN_FOOTPRINT_COSINE(0.1f);								// Smallest cosine between a ray and a surface that stretches the ray's texture footprint
+const size_t LOD_MIN_TRIANGLES(64);										// Fewest triangles in a run of records for it to get levels of detail
+const int MAX_LOD_LEVELS(5);													// Most levels of detail per mesh, including the original
+const float LOD_MIN_REDUCTION(0.75f);									// Largest share of the previous level's triangles that a new level may keep
+const int LOD_CELL_BITS(21);														// Bits per axis of the vertex clustering cells of levels of detail (three fit in a 64-bit key)
+const float LOD_PRIMARY_ERROR_PIXELS(0.5f);							// Error of a mesh level, in pixels at the distance where a camera ray reaches it, that the ray accepts
+const float LOD_SECONDARY_ERROR_PIXELS(4.0f);						// Same for shadow and reflection rays, which only see the mesh indirectly
+const size_t PARSE_MIN_CHUNK_BYTES(1 << 20);						// Smallest part of a .test file's object section that is parsed on a thread of its own
+const unsigned PARSE_CHUNKS_PER_THREAD(4);							// Chunks per parsing thread, so that threads done early take over work from slower ones
 
 struct Ray
 {
 	glm::vec3 origin;		 // Ray origin
 	glm::vec3 direction; // Ray direction
+	float pathLength;		 // Distance travelled from the camera to the origin (widens the footprint used to filter textures)
+};
+
+// Axis-aligned bounding box
+struct Bounds
+{
+	glm::vec3 min; // Minimum corner
+	glm::vec3 max; // Maximum corner
+
+	/**
+	 * @brief Constructor. Creates an empty box that any point will grow.
+	 */
+	Bounds()
+		: min(FLT_MAX), max(-FLT_MAX)
+	{
+	}
+
+	/**
+	 * @brief Grows the box to contain the provided point
+	 * @param[in] p Point to contain
+	 */
+	void Grow(const glm::vec3& p)
+	{
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+
+	/**
+	 * @brief Grows the box to contain the provided box
+	 * @param[in] b Box to contain
+	 */
+	void Grow(const Bounds& b)
+	{
+		min = glm::min(min, b.min);
+		max = glm::max(max, b.max);
+	}
+
+	/**
+	 * @return Center of the box
+	 */
+	glm::vec3 Center() const
+	{
+		return (min + max) * 0.5f;
+	}
+
+	/**
+	 * @brief Ray-box intersection (slab test)
+	 * @param[in]  ray          Ray that will be checked for intersection with this box
+	 * @param[out] outEntry     Distance from the ray origin to where the ray enters the box (0 if the origin is inside)
+	 * @return Whether the ray hits the box in front of its origin
+	 */
+	bool Intersect(const Ray& ray, float& outEntry) const
+	{
+		float tMin(0.0f);
+		float tMax(FLT_MAX);
+		for (int axis = 0; axis < 3; ++axis)
+		{
+			float inverse(1.0f / ray.direction[axis]);
+			float t0((min[axis] - ray.origin[axis]) * inverse);
+			float t1((max[axis] - ray.origin[axis]) * inverse);
+			if (inverse < 0.0f)
+				std::swap(t0, t1);
+
+			// NaN-safe: comparisons against NaN leave the interval unchanged
+			tMin = t0 > tMin ? t0 : tMin;
+			tMax = t1 < tMax ? t1 : tMax;
+			if (tMax < tMin)
+				return false;
+		}
+		outEntry = tMin;
+		return true;
+	}
 };
 
 struct Material
@@ -35,11 +179,28 @@ struct Material
 	glm::vec3 diffuse;	// Diffuse
 	glm::vec3 specular; // Specular
 	float shininess;		// Shininess
+	int32_t texture;		// Texture that modulates the ambient and diffuse colors (index in Scene::textures, NO_TEXTURE for none)
 };
 
 struct SceneObject
 {
-	Material material; // Material
+	Material material;	 // Material
+	uint32_t visibility; // Ray types that see this object (VisibilityFlags)
+
+	/**
+	 * @brief Constructor
+	 */
+	SceneObject()
+		: visibility(ALL_VISIBLE)
+	{
+	}
+
+	/**
+	 * @brief Destructor
+	 */
+	virtual ~SceneObject()
+	{
+	}
 
 	/**
 	 * Template function for calculating the intersection of this object with the provided ray.
@@ -49,8 +210,163 @@ struct SceneObject
 	 * @return If there is an intersection, returns the distance from the ray origin to the intersection point. Otherwise, returns a negative number.
 	 */
 	virtual float Intersect(const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal) = 0;
+
+	/**
+	 * Template function for calculating the bounding box of this object.
+	 * @return Axis-aligned box that contains the whole object
+	 */
+	virtual Bounds GetBounds() const = 0;
+
+	/**
+	 * @brief Gets the plane of a flat object
+	 * @param[out] outNormal   Normal of the front face (the one rays can hit), as returned by Intersect()
+	 * @param[out] outDistance Signed distance of the plane from the origin along outNormal
+	 * @return Whether the object is flat
+	 */
+	virtual bool GetPlane(glm::vec3&, float&) const
+	{
+		return false;
+	}
+
+	/**
+	 * @brief Gets the texture coordinates of a point on the object (only called for textured objects)
+	 * @param[in] point Point on the surface
+	 * @return Texture coordinates (uv)
+	 */
+	virtual glm::vec2 GetTextureCoordinates(const glm::vec3&) const
+	{
+		return glm::vec2();
+	}
+
+	/**
+	 * @brief Gets how fast the texture coordinates change across the surface (only called for textured objects)
+	 * @return Texture coordinate units per world unit
+	 */
+	virtual float GetTextureDensity() const
+	{
+		return 0.0f;
+	}
+
+	/**
+	 * @brief Gets how many primitives (spheres, triangles) the object is made of, i.e. how many intersection tests one Intersect() does
+	 * @return Number of primitives
+	 */
+	virtual size_t GetNumOfPrimitives() const
+	{
+		return 1;
+	}
 };
 
+/**
+ * @brief Ray-sphere intersection, shared by Sphere and the packed geometry used in out-of-core mode
+ * @param[in]   center                  Center of the sphere
+ * @param[in]   radius                  Radius of the sphere
+ * @param[in]   incomingRay             Ray that will be checked for intersection with the sphere
+ * @param[out]  outIntersectionPoint    Point of intersection (in case there is an intersection)
+ * @param[out]  outIntersectionNormal   Normal vector at the point of intersection (in case there is an intersection)
+ * @return If there is an intersection, returns the distance from the ray origin to the intersection point. Otherwise, returns a negative number.
+ */
+float IntersectSphere(const glm::vec3& center, const float& radius, const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal)
+{
+	float s(NO_INTERSECTION);
+
+	// m = P - C
+	glm::vec3 m(incomingRay.origin - center);
+	float b(glm::dot(m, incomingRay.direction));
+	float c(glm::dot(m, m) - (radius * radius));
+	float discriminant((b * b) - c);
+	float t1, t2;
+
+	// The ray intersects with the sphere once.
+	if (discriminant == 0)
+		s = -b;
+
+	else if (discriminant > 0)
+	{
+		t1 = -b + glm::sqrt(discriminant);
+		t2 = -b - glm::sqrt(discriminant);
+
+		// The ray starts outside or inside the sphere and intersects it once or twice. Get the smaller and positive root.
+		if (t1 > 0 or t2 > 0)
+			s = (t1 > 0 and t1 < t2) ? t1 : t2;
+	}
+
+	if (s != NO_INTERSECTION)
+	{
+		outIntersectionPoint = incomingRay.origin + (s * incomingRay.direction);
+		outIntersectionNormal = glm::normalize(outIntersectionPoint - center);
+	}
+	return s;
+}
+
+/**
+ * @brief Ray-triangle intersection, shared by Triangle and the packed geometry used in out-of-core mode
+ * @param[in]   A                       First point
+ * @param[in]   B                       Second point
+ * @param[in]   C                       Third point
+ * @param[in]   incomingRay             Ray that will be checked for intersection with the triangle
+ * @param[out]  outIntersectionPoint    Point of intersection (in case there is an intersection)
+ * @param[out]  outIntersectionNormal   Normal vector at the point of intersection (in case there is an intersection)
+ * @return If there is an intersection, returns the distance from the ray origin to the intersection point. Otherwise, returns a negative number.
+ */
+float IntersectTriangle(const glm::vec3& A, const glm::vec3& B, const glm::vec3& C, const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal)
+{
+	float s(NO_INTERSECTION);
+
+	glm::vec3 n(glm::cross(B - A, C - A));
+	glm::vec3 e(glm::cross(-incomingRay.direction, incomingRay.origin - A));
+	float f(glm::dot(-incomingRay.direction, n));
+
+	float t(glm::dot((incomingRay.origin - A), n) / f);
+	float u(glm::dot(C - A, e) / f);
+	float v(-glm::dot(B - A, e) / f);
+
+	if (f > 0 and t > 0 and u >= 0 and v >= 0 and u + v <= 1)
+	{
+		s = t;
+	}
+
+	if (s != NO_INTERSECTION)
+	{
+		outIntersectionPoint = incomingRay.origin + (t * incomingRay.direction);
+		outIntersectionNormal = glm::normalize(n);
+	}
+	return s;
+}
+
+/**
+ * @brief Conservative ray-triangle intersection for triangles with quantized vertices. Every edge is pushed outwards by the largest
+ * quantization error, so rays that hit the original triangle still hit its quantized copy, and adjacent triangles leave no cracks.
+ * @param[in]   A                       First point
+ * @param[in]   B                       Second point
+ * @param[in]   C                       Third point
+ * @param[in]   slack                   Distance to push the edges outwards by (QuantizationGrid::MaxError())
+ * @param[in]   incomingRay             Ray that will be checked for intersection with the triangle
+ * @param[out]  outIntersectionPoint    Point of intersection (in case there is an intersection)
+ * @return If there is an intersection, returns the distance from the ray origin to the intersection point. Otherwise, returns a negative number.
+ */
+float IntersectTriangleConservative(const glm::vec3& A, const glm::vec3& B, const glm::vec3& C, const float& slack, const Ray& incomingRay, glm::vec3& outIntersectionPoint)
+{
+	glm::vec3 n(glm::cross(B - A, C - A));
+	glm::vec3 e(glm::cross(-incomingRay.direction, incomingRay.origin - A));
+	float f(glm::dot(-incomingRay.direction, n));
+	if (!(f > 0))
+		return NO_INTERSECTION;
+
+	float t(glm::dot((incomingRay.origin - A), n) / f);
+	float u(glm::dot(C - A, e) / f);	// Weight of B, 0 on edge AC
+	float v(-glm::dot(B - A, e) / f); // Weight of C, 0 on edge AB
+
+	// A weight of -x lies x times the opposite altitude (twice the area over the edge's length) outside the edge
+	float doubleArea(glm::length(n));
+	if (t > 0 and u * doubleArea >= -slack * glm::length(C - A) and v * doubleArea >= -slack * glm::length(B - A) and (1.0f - u - v) * doubleArea >= -slack * glm::length(C - B))
+	{
+		outIntersectionPoint = incomingRay.origin + (t * incomingRay.direction);
+		return t;
+	}
+	return NO_INTERSECTION;
+}
+
 // Subclass of SceneObject representing a Sphere scene object
 struct Sphere : public SceneObject
 {
@@ -66,35 +382,41 @@ struct Sphere : public SceneObject
 	 */
 	virtual float Intersect(const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal)
 	{
-		float s(NO_INTERSECTION);
-
-		// m = P - C
-		glm::vec3 m(incomingRay.origin - center);
-		float b(glm::dot(m, incomingRay.direction));
-		float c(glm::dot(m, m) - (radius * radius));
-		float discriminant((b * b) - c);
-		float t1, t2;
-
-		// The ray intersects with the sphere once.
-		if (discriminant == 0)
-			s = -b;
+		return IntersectSphere(center, radius, incomingRay, outIntersectionPoint, outIntersectionNormal);
+	}
 
-		else if (discriminant > 0)
-		{
-			t1 = -b + glm::sqrt(discriminant);
-			t2 = -b - glm::sqrt(discriminant);
+	/**
+	 * @brief Sphere bounding box
+	 * @return Axis-aligned box that contains the whole sphere
+	 */
+	virtual Bounds GetBounds() const
+	{
+		Bounds bounds;
+		bounds.Grow(center - glm::vec3(radius));
+		bounds.Grow(center + glm::vec3(radius));
+		return bounds;
+	}
 
-			// The ray starts outside or inside the sphere and intersects it once or twice. Get the smaller and positive root.
-			if (t1 > 0 or t2 > 0)
-				s = (t1 > 0 and t1 < t2) ? t1 : t2;
-		}
+	/**
+	 * @brief Spherical texture coordinates: u goes around the y axis, v from the top (0) to the bottom (1)
+	 * @param[in] point Point on the surface
+	 * @return Texture coordinates (uv)
+	 */
+	virtual glm::vec2 GetTextureCoordinates(const glm::vec3& point) const
+	{
+		const float PI(3.14159265358979f);
+		glm::vec3 d(glm::normalize(point - center));
+		return glm::vec2(0.5f + (std::atan2(d.z, d.x) / (2.0f * PI)), 0.5f - (std::asin(glm::clamp(d.y, -1.0f, 1.0f)) / PI));
+	}
 
-		if (s != NO_INTERSECTION)
-		{
-			outIntersectionPoint = incomingRay.origin + (s * incomingRay.direction);
-			outIntersectionNormal = glm::normalize(outIntersectionPoint - center);
-		}
-		return s;
+	/**
+	 * @brief The whole texture covers the sphere once
+	 * @return Texture coordinate units per world unit
+	 */
+	virtual float GetTextureDensity() const
+	{
+		const float PI(3.14159265358979f);
+		return 1.0f / (2.0f * radius * std::sqrt(PI));
 	}
 };
 
@@ -114,428 +436,6389 @@ struct Triangle : public SceneObject
 	 */
 	virtual float Intersect(const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal)
 	{
-		float s(NO_INTERSECTION);
-
-		glm::vec3 n(glm::cross(B - A, C - A));
-		glm::vec3 e(glm::cross(-incomingRay.direction, incomingRay.origin - A));
-		float f(glm::dot(-incomingRay.direction, n));
-
-		float t(glm::dot((incomingRay.origin - A), n) / f);
-		float u(glm::dot(C - A, e) / f);
-		float v(-glm::dot(B - A, e) / f);
-
-		if (f > 0 and t > 0 and u >= 0 and v >= 0 and u + v <= 1)
-		{
-			s = t;
-		}
-
-		if (s != NO_INTERSECTION)
-		{
-			outIntersectionPoint = incomingRay.origin + (t * incomingRay.direction);
-			outIntersectionNormal = glm::normalize(n);
-		}
-		return s;
+		return IntersectTriangle(A, B, C, incomingRay, outIntersectionPoint, outIntersectionNormal);
 	}
-};
 
-struct Camera
-{
-	glm::vec3 position;		// Position
-	glm::vec3 lookTarget; // Look target
-	glm::vec3 globalUp;		// Global up-vector
-	float fovY;						// Vertical field of view
-	float focalLength;		// Focal length
+	/**
+	 * @brief Triangle bounding box
+	 * @return Axis-aligned box that contains the whole triangle
+	 */
+	virtual Bounds GetBounds() const
+	{
+		Bounds bounds;
+		bounds.Grow(A);
+		bounds.Grow(B);
+		bounds.Grow(C);
+		return bounds;
+	}
 
-	int imageWidth;	 // image width
-	int imageHeight; // image height
+	/**
+	 * @brief Plane of the triangle
+	 * @param[out] outNormal   Normal of the front face
+	 * @param[out] outDistance Signed distance of the plane from the origin along outNormal
+	 * @return Whether the triangle is not degenerate
+	 */
+	virtual bool GetPlane(glm::vec3& outNormal, float& outDistance) const
+	{
+		glm::vec3 n(glm::cross(B - A, C - A));
+		if (glm::length(n) == 0.0f)
+			return false;
+		outNormal = glm::normalize(n);
+		outDistance = glm::dot(outNormal, A);
+		return true;
+	}
 };
 
-struct Light
+// Triangle with texture coordinates at its vertices. Only textured triangles pay for them.
+struct TexturedTriangle : public Triangle
 {
-	glm::vec4 position; // Light position (w = 1 if point light, w = 0 if directional light)
+	glm::vec2 uv[3]; // Texture coordinates of A, B and C
 
-	glm::vec3 ambient;	// Light's ambient intensity
-	glm::vec3 diffuse;	// Light's diffuse intensity
-	glm::vec3 specular; // Light's specular intensity
+	/**
+	 * @brief Interpolates the vertices' texture coordinates at a point of the triangle
+	 * @param[in] point Point on the surface
+	 * @return Texture coordinates (uv)
+	 */
+	virtual glm::vec2 GetTextureCoordinates(const glm::vec3& point) const
+	{
+		glm::vec3 n(glm::cross(B - A, C - A));
+		float b(glm::dot(glm::cross(point - A, C - A), n) / glm::dot(n, n));
+		float c(glm::dot(glm::cross(B - A, point - A), n) / glm::dot(n, n));
+		return (uv[0] * (1.0f - b - c)) + (uv[1] * b) + (uv[2] * c);
+	}
 
-	// --- Attenuation variables ---
-	float constant;	 // Constant factor
-	float linear;		 // Linear factor
-	float quadratic; // Quadratic factor
+	/**
+	 * @brief Ratio between the triangle's size in texture space and in the world
+	 * @return Texture coordinate units per world unit
+	 */
+	virtual float GetTextureDensity() const
+	{
+		glm::vec2 e1(uv[1] - uv[0]), e2(uv[2] - uv[0]);
+		float uvArea(std::abs((e1.x * e2.y) - (e1.y * e2.x)));
+		return std::sqrt(uvArea / glm::length(glm::cross(B - A, C - A)));
+	}
 };
 
-struct IntersectionInfo
+enum SpaceFillingCurve
 {
-	Ray incomingRay;							// Ray used to calculate the intersection
-	float t;											// Distance from the ray's origin to the point of intersection (if there was an intersection).
-	SceneObject* obj;							// Object that the ray intersected with. If this is equal to nullptr, then no intersection occured.
-	glm::vec3 intersectionPoint;	// Point where the intersection occured (if there was an intersection)
-	glm::vec3 intersectionNormal; // Normal vector at the point of intersection (if there was an intersection)
+	NO_CURVE,
+	MORTON_CURVE,
+	HILBERT_CURVE
 };
 
-struct Scene
+enum PrimitiveType
 {
-	std::vector<SceneObject*> objects; // List of all objects in the scene
-	std::vector<Light> lights;					// List of all lights in the scene
+	SPHERE_PRIMITIVE,
+	TRIANGLE_PRIMITIVE
 };
 
-struct Image
+// Flat, pointer-free copy of a scene object record. This is the layout stored in packed geometry files.
+struct PackedPrimitive
 {
-	std::vector<unsigned char> data; // Image data
-	int width;											 // Image width
-	int height;											 // Image height
-
-	/**
-	 * @brief Constructor
-	 * @param[in] w Width
-	 * @param[in] h Height
-	 */
-	Image(const int& w, const int& h)
-		: width(w), height(h)
-	{
-		data.resize(w * h * 3, 0);
-	}
+	int32_t type;				 // PrimitiveType
+	float data[9];			 // Sphere: center (xyz) and radius. Triangle: A, B and C (xyz each).
+	Material material;	 // Material
+	uint32_t visibility; // Ray types that see this primitive (VisibilityFlags)
+	float uv[6];				 // Texture coordinates of a textured triangle's A, B and C (uv each)
 
 	/**
-	 * @brief Converts the provided color value from [0, 1] to [0, 255]
-	 * @param[in] c Color value in [0, 1] range
-	 * @return Color value in [0, 255] range
+	 * @brief Intersection of this primitive with the provided ray
+	 * @param[in]   incomingRay             Ray that will be checked for intersection with this primitive
+	 * @param[out]  outIntersectionPoint    Point of intersection (in case there is an intersection)
+	 * @param[out]  outIntersectionNormal   Normal vector at the point of intersection (in case there is an intersection)
+	 * @return If there is an intersection, returns the distance from the ray origin to the intersection point. Otherwise, returns a negative number.
 	 */
-	unsigned char ToChar(float c)
+	float Intersect(const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal) const
 	{
-		c = glm::clamp(c, 0.0f, 1.0f);
-		return static_cast<unsigned char>(c * 255);
+		if (type == SPHERE_PRIMITIVE)
+			return IntersectSphere(glm::vec3(data[0], data[1], data[2]), data[3], incomingRay, outIntersectionPoint, outIntersectionNormal);
+		return IntersectTriangle(glm::vec3(data[0], data[1], data[2]), glm::vec3(data[3], data[4], data[5]), glm::vec3(data[6], data[7], data[8]), incomingRay, outIntersectionPoint, outIntersectionNormal);
 	}
 
 	/**
-	 * @brief Sets the color at the specified pixel location
-	 * @param[in] x     X-coordinate of the pixel
-	 * @param[in] y     Y-coordinate of the pixel
-	 * @param[in] color Pixel color
+	 * @return Axis-aligned box that contains the whole primitive
 	 */
-	void SetColor(const int& x, const int& y, const glm::vec3& color)
+	Bounds GetBounds() const
 	{
-		int index = (y * width + x) * 3;
-		data[index] = ToChar(color.r);
-		data[index + 1] = ToChar(color.g);
-		data[index + 2] = ToChar(color.b);
+		Bounds bounds;
+		if (type == SPHERE_PRIMITIVE)
+		{
+			glm::vec3 center(data[0], data[1], data[2]);
+			bounds.Grow(center - glm::vec3(data[3]));
+			bounds.Grow(center + glm::vec3(data[3]));
+		}
+		else
+		{
+			bounds.Grow(glm::vec3(data[0], data[1], data[2]));
+			bounds.Grow(glm::vec3(data[3], data[4], data[5]));
+			bounds.Grow(glm::vec3(data[6], data[7], data[8]));
+		}
+		return bounds;
 	}
 };
 
 /**
- * @brief Gets the ray that goes from the camera's position to the specified pixel at (x, y)
- * @param[in] camera Camera data
- * @param[in] x X-coordinate of the pixel (upper-left corner of the pixel)
- * @param[in] y Y-coordinate of the pixel (upper-left corner of the pixel)
- * @param[in] aa anti-aliasing
- * @return Ray that passes through the pixel at (x, y)
+ * @brief Tells whether a token of a .test file's object section starts a record, and how many geometry values the record has.
+ * Every word other than the prefixes (visibility, texture, uv) names an object type: "sphere" is a sphere, anything else a triangle.
+ * @param[in] token Token
+ * @return Number of geometry values after the token (4 for a sphere, 9 for a triangle), or 0 if the token does not start a record
  */
-Ray GetRayThruPixel(const Camera& camera, const int& pixelX, const int& pixelY, const bool aa = false)
+int GetRecordGeometrySize(const std::string& token)
 {
-	Ray ray;
-	glm::vec3 cameraLookDirection(glm::normalize(camera.lookTarget - camera.position));
-
-	// VIEWPORT SIZING
-	float viewportHeight(2 * camera.focalLength * glm::tan(glm::radians(camera.fovY) / 2));
-	float viewportWidth(camera.imageWidth * viewportHeight / camera.imageHeight);
-
-	// UV directions of the camera
-	glm::vec3 u(glm::normalize(glm::cross(cameraLookDirection, camera.globalUp)));
-	glm::vec3 v(glm::normalize(glm::cross(u, cameraLookDirection)));
+	if (token.empty() or !std::isalpha(static_cast<unsigned char>(token[0])) or token == "visibility" or token == "texture" or token == "uv")
+		return 0;
+	return (token == "sphere") ? 4 : 9;
+}
 
-	glm::vec3 viewportLowerLeft(camera.position + (cameraLookDirection * camera.focalLength) - (u * (viewportWidth / 2)) - (v * (viewportHeight / 2)));
+/**
+ * @brief Reads one object record (type, geometry and material) from a .test file.
+ * A record can be preceded, in any order, by "visibility <camera> <shadow> <reflection>" (each 0 or 1) to hide the object from some ray types,
+ * "texture <file>" to modulate its ambient and diffuse colors with a binary PPM image (relative to the scene file), and, for a textured
+ * triangle, "uv <u0> <v0> <u1> <v1> <u2> <v2>" to set the texture coordinates of its vertices (default: (0, 0), (1, 0) and (0, 1)).
+ * @param[in]     sceneFile     Stream positioned at the start of the record
+ * @param[out]    outPrimitive  Record that was read
+ * @param[in,out] textureNames  Texture files named so far; a new name is appended, and the record stores its index
+ * @return Whether the record could be read
+ */
+bool ReadPrimitive(std::istream& sceneFile, PackedPrimitive& outPrimitive, std::vector<std::string>& textureNames)
+{
+	std::string objectType, textureName;
+	int camera, shadow, reflection;
+	outPrimitive = PackedPrimitive();
+	outPrimitive.visibility = ALL_VISIBLE;
+	outPrimitive.uv[2] = outPrimitive.uv[5] = 1.0f;
 
-	float pixelXOffset(0.5f); // the part of the pixel that the ray passes through
-	float pixelYOffset(0.5f);
-	if (aa)
+	sceneFile >> objectType;
+	while (sceneFile and (objectType == "visibility" or objectType == "texture" or objectType == "uv"))
 	{
-		pixelXOffset = static_cast<float>(rand()) / static_cast<float>(RAND_MAX); // the part of the pixel that the ray passes through
-		pixelYOffset = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+		if (objectType == "visibility") // VISIBILITY
+		{
+			sceneFile >> camera >> shadow >> reflection;
+			outPrimitive.visibility = (camera ? CAMERA_VISIBLE : 0) | (shadow ? SHADOW_VISIBLE : 0) | (reflection ? REFLECTION_VISIBLE : 0);
+		}
+		else if (objectType == "texture") // TEXTURE
+			sceneFile >> textureName;
+		else // TEXTURE COORDINATES
+		{
+			for (int i = 0; i < 6; ++i)
+				sceneFile >> outPrimitive.uv[i];
+		}
+		sceneFile >> objectType;
 	}
 
-	// position of pixel in viewport
-	float s((pixelX + pixelXOffset) * viewportWidth / camera.imageWidth);
-	float t((pixelY + pixelYOffset) * viewportHeight / camera.imageHeight);
-	glm::vec3 pixelPosition(viewportLowerLeft + (u * s) + (v * t));
+	int geometrySize(GetRecordGeometrySize(objectType));
+	if (geometrySize == 0)
+		return false;
+	outPrimitive.type = (geometrySize == 4) ? SPHERE_PRIMITIVE : TRIANGLE_PRIMITIVE; // SPHERE or TRIANGLE
+	for (int i = 0; i < geometrySize; ++i)
+		sceneFile >> outPrimitive.data[i];
 
-	ray.origin = camera.position;
-	ray.direction = glm::normalize(pixelPosition - ray.origin);
+	sceneFile >> outPrimitive.material.ambient.r >> outPrimitive.material.ambient.g >> outPrimitive.material.ambient.b;
+	sceneFile >> outPrimitive.material.diffuse.r >> outPrimitive.material.diffuse.g >> outPrimitive.material.diffuse.b;
+	sceneFile >> outPrimitive.material.specular.r >> outPrimitive.material.specular.g >> outPrimitive.material.specular.b;
+	sceneFile >> outPrimitive.material.shininess;
 
-	return ray;
+	outPrimitive.material.texture = NO_TEXTURE;
+	if (!textureName.empty())
+	{
+		outPrimitive.material.texture = static_cast<int32_t>(std::find(textureNames.begin(), textureNames.end(), textureName) - textureNames.begin());
+		if (outPrimitive.material.texture == static_cast<int32_t>(textureNames.size()))
+			textureNames.push_back(textureName);
+	}
+	return static_cast<bool>(sceneFile);
 }
 
 /**
- * @brief Cast a ray to the scene.
- * @param[in] ray   Ray to cast to the scene
- * @param[in] scene Scene object
- * @return Returns an IntersectionInfo object that will contain the results of the raycast
+ * @brief Creates the scene object described by a record
+ * @param[in] primitive Record read from a .test file
+ * @return Newly allocated Sphere, Triangle or TexturedTriangle (owned by the caller)
  */
-IntersectionInfo Raycast(const Ray& ray, const Scene& scene)
+SceneObject* CreateSceneObject(const PackedPrimitive& primitive)
+{
+	if (primitive.type == SPHERE_PRIMITIVE)
+	{
+		Sphere* sphere = new Sphere();
+		sphere->center = glm::vec3(primitive.data[0], primitive.data[1], primitive.data[2]);
+		sphere->radius = primitive.data[3];
+		sphere->material = primitive.material;
+		sphere->visibility = primitive.visibility;
+		return sphere;
+	}
+
+	Triangle* triangle;
+	if (primitive.material.texture != NO_TEXTURE)
+	{
+		TexturedTriangle* texturedTriangle = new TexturedTriangle();
+		for (int i = 0; i < 3; ++i)
+			texturedTriangle->uv[i] = glm::vec2(primitive.uv[i * 2], primitive.uv[(i * 2) + 1]);
+		triangle = texturedTriangle;
+	}
+	else
+		triangle = new Triangle();
+	triangle->A = glm::vec3(primitive.data[0], primitive.data[1], primitive.data[2]);
+	triangle->B = glm::vec3(primitive.data[3], primitive.data[4], primitive.data[5]);
+	triangle->C = glm::vec3(primitive.data[6], primitive.data[7], primitive.data[8]);
+	triangle->material = primitive.material;
+	triangle->visibility = primitive.visibility;
+	return triangle;
+}
+
+/**
+ * @brief Checks whether a record describes an object that no ray can meaningfully hit (zero-area triangle, zero-radius sphere, or non-finite data)
+ * @param[in] primitive Record read from a .test file
+ * @return Whether the record can be dropped
+ */
+bool IsDegenerate(const PackedPrimitive& primitive)
+{
+	if (primitive.type == SPHERE_PRIMITIVE)
+		return !(primitive.data[3] > 0.0f) or !std::isfinite(primitive.data[0] + primitive.data[1] + primitive.data[2] + primitive.data[3]);
+
+	glm::vec3 A(primitive.data[0], primitive.data[1], primitive.data[2]);
+	glm::vec3 B(primitive.data[3], primitive.data[4], primitive.data[5]);
+	glm::vec3 C(primitive.data[6], primitive.data[7], primitive.data[8]);
+	float area(glm::length(glm::cross(B - A, C - A)));
+	return !(area > 0.0f) or !std::isfinite(area);
+}
+
+// Quantized vertex position with 16 bits per axis
+struct Vertex16
+{
+	uint16_t q[3]; // Grid coordinates (x, y, z)
+};
+
+// Quantized vertex position with 21 bits per axis, packed as x | y << 21 | z << 42
+typedef uint64_t Vertex21;
+
+// Regular grid spanning the scene bounds that quantized vertex positions are snapped to
+struct QuantizationGrid
+{
+	glm::vec3 origin; // Position of grid coordinate 0
+	glm::vec3 scale;	// Size of one grid step along each axis
+	int bits;					// Bits per axis (0 if vertices are not quantized)
+
+	/**
+	 * @brief Constructor
+	 */
+	QuantizationGrid()
+		: bits(0)
+	{
+	}
+
+	/**
+	 * @brief Fits the grid to the provided bounds
+	 * @param[in] bounds     Bounds of all vertices that will be quantized
+	 * @param[in] gridBits   Bits per axis (16 or 21)
+	 */
+	void Fit(const Bounds& bounds, const int& gridBits)
+	{
+		float steps(static_cast<float>((1u << gridBits) - 1));
+		bits = gridBits;
+		origin = bounds.min;
+		scale = glm::max(bounds.max - bounds.min, glm::vec3(FLT_MIN)) / steps;
+	}
+
+	/**
+	 * @return Largest distance between a vertex and its quantized position
+	 */
+	float MaxError() const
+	{
+		return glm::length(scale) * 0.5f;
+	}
+
+	/**
+	 * @brief Snaps one coordinate to the grid
+	 * @param[in] p    Position
+	 * @param[in] axis Axis of the coordinate
+	 * @return Nearest grid coordinate
+	 */
+	uint32_t Quantize(const glm::vec3& p, const int& axis) const
+	{
+		float steps(static_cast<float>((1u << bits) - 1));
+		return static_cast<uint32_t>(glm::clamp((p[axis] - origin[axis]) / scale[axis] + 0.5f, 0.0f, steps));
+	}
+
+	/**
+	 * @brief Quantizes a position to 16 bits per axis
+	 */
+	void Encode(const glm::vec3& p, Vertex16& outVertex) const
+	{
+		for (int axis = 0; axis < 3; ++axis)
+			outVertex.q[axis] = static_cast<uint16_t>(Quantize(p, axis));
+	}
+
+	/**
+	 * @brief Quantizes a position to 21 bits per axis
+	 */
+	void Encode(const glm::vec3& p, Vertex21& outVertex) const
+	{
+		outVertex = 0;
+		for (int axis = 0; axis < 3; ++axis)
+			outVertex |= static_cast<uint64_t>(Quantize(p, axis)) << (21 * axis);
+	}
+
+	/**
+	 * @brief Decodes a 16-bit quantized position
+	 */
+	glm::vec3 Decode(const Vertex16& vertex) const
+	{
+		return origin + glm::vec3(vertex.q[0], vertex.q[1], vertex.q[2]) * scale;
+	}
+
+	/**
+	 * @brief Decodes a 21-bit quantized position
+	 */
+	glm::vec3 Decode(const Vertex21& vertex) const
+	{
+		const uint64_t mask((1u << 21) - 1);
+		return origin + glm::vec3(static_cast<float>(vertex & mask), static_cast<float>((vertex >> 21) & mask), static_cast<float>((vertex >> 42) & mask)) * scale;
+	}
+};
+
+/**
+ * @brief Sign of a value, treating zero as positive
+ */
+float SignNotZero(const float& v)
+{
+	return (v >= 0.0f) ? 1.0f : -1.0f;
+}
+
+/**
+ * @brief Encodes a unit vector with the octahedral mapping, 16 bits per component
+ * @param[in] n Unit vector
+ * @return Encoded vector
+ */
+uint32_t EncodeOctahedral(const glm::vec3& n)
+{
+	float l1(glm::abs(n.x) + glm::abs(n.y) + glm::abs(n.z));
+	float u(n.x / l1);
+	float v(n.y / l1);
+	if (n.z < 0.0f)
+	{
+		float wrappedU((1.0f - glm::abs(v)) * SignNotZero(u));
+		v = (1.0f - glm::abs(u)) * SignNotZero(v);
+		u = wrappedU;
+	}
+
+	uint32_t encodedU(static_cast<uint32_t>(glm::clamp(u * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f + 0.5f));
+	uint32_t encodedV(static_cast<uint32_t>(glm::clamp(v * 0.5f + 0.5f, 0.0f, 1.0f) * 65535.0f + 0.5f));
+	return encodedU | (encodedV << 16);
+}
+
+/**
+ * @brief Decodes a unit vector encoded with EncodeOctahedral()
+ * @param[in] encoded Encoded vector
+ * @return Unit vector
+ */
+glm::vec3 DecodeOctahedral(const uint32_t& encoded)
+{
+	float u(static_cast<float>(encoded & 0xFFFFu) / 65535.0f * 2.0f - 1.0f);
+	float v(static_cast<float>(encoded >> 16) / 65535.0f * 2.0f - 1.0f);
+	glm::vec3 n(u, v, 1.0f - glm::abs(u) - glm::abs(v));
+	if (n.z < 0.0f)
+	{
+		float unwrappedX((1.0f - glm::abs(n.y)) * SignNotZero(n.x));
+		n.y = (1.0f - glm::abs(n.x)) * SignNotZero(n.y);
+		n.x = unwrappedX;
+	}
+	return glm::normalize(n);
+}
+
+// Vertices and normals of a scene's quantized triangles, packed in arrays that the QuantizedMesh objects index.
+// Per triangle this is three quantized vertices and one encoded normal; the objects only add a range per mesh.
+struct QuantizedGeometry
+{
+	QuantizationGrid grid;						// Grid that the vertices are stored on
+	std::vector<Vertex16> vertices16; // Three vertices per triangle, with 16-bit grids
+	std::vector<Vertex21> vertices21; // Three vertices per triangle, with 21-bit grids
+	std::vector<uint32_t> normals;		// Octahedral-encoded normal of each triangle
+
+	/**
+	 * @return Vertex array of the given encoding
+	 */
+	template <typename Vertex>
+	std::vector<Vertex>& Vertices();
+
+	/**
+	 * @return Vertex array of the given encoding
+	 */
+	template <typename Vertex>
+	const std::vector<Vertex>& Vertices() const
+	{
+		return const_cast<QuantizedGeometry*>(this)->Vertices<Vertex>();
+	}
+};
+
+template <>
+std::vector<Vertex16>& QuantizedGeometry::Vertices<Vertex16>()
+{
+	return vertices16;
+}
+
+template <>
+std::vector<Vertex21>& QuantizedGeometry::Vertices<Vertex21>()
+{
+	return vertices21;
+}
+
+// Run of triangles with one material whose vertices are stored in the scene's QuantizedGeometry and decoded on the fly when intersected.
+// The normal of each original triangle is stored octahedral-encoded, so shading does not pick up the quantization error.
+template <typename Vertex>
+struct QuantizedMesh : public SceneObject
+{
+	const QuantizedGeometry* geometry; // Scene's quantized triangles
+	uint32_t firstTriangle;						 // First triangle of the mesh in geometry
+	uint32_t numOfTriangles;					 // Number of triangles
+
+	/**
+	 * @brief Closest conservative hit (see IntersectTriangleConservative()) of the ray with the mesh's decoded triangles
+	 * @param[in]   incomingRay             Ray that will be checked for intersection with this object
+	 * @param[out]  outIntersectionPoint    Point of intersection (in case there is an intersection)
+	 * @param[out]  outIntersectionNormal   Normal vector at the point of intersection (in case there is an intersection)
+	 * @return If there is an intersection, returns the distance from the ray origin to the intersection point. Otherwise, returns a negative number.
+	 */
+	virtual float Intersect(const Ray& incomingRay, glm::vec3& outIntersectionPoint, glm::vec3& outIntersectionNormal)
+	{
+		const std::vector<Vertex>& vertices(geometry->template Vertices<Vertex>());
+		float slack(geometry->grid.MaxError());
+		float s(NO_INTERSECTION);
+		glm::vec3 point;
+		for (uint32_t i = firstTriangle; i < firstTriangle + numOfTriangles; ++i)
+		{
+			float t(IntersectTriangleConservative(geometry->grid.Decode(vertices[i * 3]), geometry->grid.Decode(vertices[(i * 3) + 1]), geometry->grid.Decode(vertices[(i * 3) + 2]), slack, incomingRay, point));
+			if (t != NO_INTERSECTION and (s == NO_INTERSECTION or t < s))
+			{
+				s = t;
+				outIntersectionPoint = point;
+				outIntersectionNormal = DecodeOctahedral(geometry->normals[i]);
+			}
+		}
+		return s;
+	}
+
+	/**
+	 * @brief Bounding box of the decoded triangles, grown by the quantization error that hits are widened by
+	 * @return Axis-aligned box that contains every hit on the mesh
+	 */
+	virtual Bounds GetBounds() const
+	{
+		const std::vector<Vertex>& vertices(geometry->template Vertices<Vertex>());
+		Bounds bounds;
+		for (uint32_t i = firstTriangle * 3; i < (firstTriangle + numOfTriangles) * 3; ++i)
+			bounds.Grow(geometry->grid.Decode(vertices[i]));
+		bounds.min -= glm::vec3(geometry->grid.MaxError());
+		bounds.max += glm::vec3(geometry->grid.MaxError());
+		return bounds;
+	}
+
+	/**
+	 * @brief Plane of the mesh, if all of its triangles lie in one
+	 * @param[out] outNormal   Normal of the front face (the stored normal of the first triangle)
+	 * @param[out] outDistance Signed distance of the plane from the origin along outNormal
+	 * @return Whether the mesh is flat
+	 */
+	virtual bool GetPlane(glm::vec3& outNormal, float& outDistance) const
+	{
+		const std::vector<Vertex>& vertices(geometry->template Vertices<Vertex>());
+		float slack(geometry->grid.MaxError());
+		outNormal = DecodeOctahedral(geometry->normals[firstTriangle]);
+		outDistance = glm::dot(outNormal, geometry->grid.Decode(vertices[firstTriangle * 3]));
+		for (uint32_t i = firstTriangle; i < firstTriangle + numOfTriangles; ++i)
+		{
+			if (glm::dot(DecodeOctahedral(geometry->normals[i]), outNormal) < 1.0f - QUANTIZED_PLANE_TOLERANCE)
+				return false;
+			for (int v = 0; v < 3; ++v)
+			{
+				if (glm::abs(glm::dot(outNormal, geometry->grid.Decode(vertices[(i * 3) + v])) - outDistance) > 2.0f * slack)
+					return false;
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @return Number of triangles in the mesh
+	 */
+	virtual size_t GetNumOfPrimitives() const
+	{
+		return numOfTriangles;
+	}
+};
+
+/**
+ * @brief Quantizes a run of untextured triangle records with one material and visibility into a scene's packed arrays
+ * and creates the mesh object over them. Triangles whose vertices collapse onto a line once snapped to the grid are dropped:
+ * no ray can hit them, and the widened edges of their neighbours cover the gap they leave.
+ * @param[in]     primitives        Records
+ * @param[in]     first             First record of the run
+ * @param[in]     count             Number of records in the run
+ * @param[in,out] geometry          Packed arrays to append to (with its grid fitted)
+ * @param[out]    outNumOfCollapsed Number of triangles of the run that were dropped
+ * @return Newly allocated QuantizedMesh (owned by the caller), or nullptr if every triangle collapsed
+ */
+template <typename Vertex>
+SceneObject* CreateQuantizedMesh(const std::vector<PackedPrimitive>& primitives, const size_t& first, const size_t& count, QuantizedGeometry& geometry, size_t& outNumOfCollapsed)
+{
+	std::vector<Vertex>& vertices(geometry.Vertices<Vertex>());
+	uint32_t firstTriangle(static_cast<uint32_t>(geometry.normals.size()));
+	outNumOfCollapsed = 0;
+	for (size_t i = first; i < first + count; ++i)
+	{
+		const PackedPrimitive& primitive(primitives[i]);
+		Vertex quantized[3];
+		for (int v = 0; v < 3; ++v)
+			geometry.grid.Encode(glm::vec3(primitive.data[v * 3], primitive.data[(v * 3) + 1], primitive.data[(v * 3) + 2]), quantized[v]);
+		glm::vec3 A(geometry.grid.Decode(quantized[0]));
+		if (glm::length(glm::cross(geometry.grid.Decode(quantized[1]) - A, geometry.grid.Decode(quantized[2]) - A)) == 0.0f)
+		{
+			++outNumOfCollapsed;
+			continue;
+		}
+
+		glm::vec3 a(primitive.data[0], primitive.data[1], primitive.data[2]);
+		glm::vec3 b(primitive.data[3], primitive.data[4], primitive.data[5]);
+		glm::vec3 c(primitive.data[6], primitive.data[7], primitive.data[8]);
+		vertices.insert(vertices.end(), quantized, quantized + 3);
+		geometry.normals.push_back(EncodeOctahedral(glm::normalize(glm::cross(b - a, c - a))));
+	}
+	if (geometry.normals.size() == firstTriangle)
+		return nullptr;
+
+	QuantizedMesh<Vertex>* mesh = new QuantizedMesh<Vertex>();
+	mesh->geometry = &geometry;
+	mesh->firstTriangle = firstTriangle;
+	mesh->numOfTriangles = static_cast<uint32_t>(geometry.normals.size()) - firstTriangle;
+	mesh->material = primitives[first].material;
+	mesh->visibility = primitives[first].visibility;
+	return mesh;
+}
+
+// One level of detail of a mesh
+struct LodLevel
+{
+	std::vector<Triangle*> triangles; // Triangles of the level (owned by the mesh)
+	float error;											// Largest distance between the level's surface and the original mesh
+};
+
+// Run of triangle records that share a material, stored apart from Scene::objects with simplified copies of itself.
+// Each ray tests only the coarsest level whose error it cannot resolve at the distance where it reaches the mesh.
+struct LodMesh
+{
+	Bounds bounds;								// Bounds of the original mesh
+	uint32_t visibility;					// Ray types that see the mesh (VisibilityFlags)
+	std::vector<LodLevel> levels; // Levels of detail, the original triangles first
+
+	/**
+	 * @brief Constructor
+	 */
+	LodMesh()
+		: visibility(ALL_VISIBLE)
+	{
+	}
+
+	LodMesh(const LodMesh&) = delete;
+	LodMesh& operator=(const LodMesh&) = delete;
+
+	/**
+	 * @brief Destructor
+	 */
+	~LodMesh()
+	{
+		for (size_t l = 0; l < levels.size(); ++l)
+		{
+			for (size_t i = 0; i < levels[l].triangles.size(); ++i)
+				delete levels[l].triangles[i];
+		}
+	}
+
+	/**
+	 * @brief Picks the level of detail that a ray tests. Rays that start inside the mesh's bounds (such as the shadow and reflection
+	 * rays of the mesh itself) always see the original triangles, so a coarse level cannot shadow or reflect the surface it approximates.
+	 * @param[in] ray         Ray to cast
+	 * @param[in] rayType     Type of the ray (one of VisibilityFlags)
+	 * @param[in] entry       Distance from the ray's origin to where it enters the bounds
+	 * @param[in] pixelSpread Width of a pixel's ray cone per unit of distance
+	 * @return Level to test
+	 */
+	const LodLevel& SelectLevel(const Ray& ray, const uint32_t& rayType, const float& entry, const float& pixelSpread) const
+	{
+		if (!(entry > 0.0f))
+			return levels[0];
+
+		float tolerance((ray.pathLength + entry) * pixelSpread * ((rayType == CAMERA_VISIBLE) ? LOD_PRIMARY_ERROR_PIXELS : LOD_SECONDARY_ERROR_PIXELS));
+		size_t level(0);
+		while (level + 1 < levels.size() and levels[level + 1].error <= tolerance)
+			++level;
+		return levels[level];
+	}
+};
+
+// Ray cost attributed to one object or mesh by --profile
+struct ObjectCost
+{
+	uint64_t tests;				// Intersection tests against the object (every triangle of the level tested, for a mesh)
+	uint64_t shadowTests; // Tests made by shadow rays
+	uint64_t hits;				// Rays whose closest hit was the object
+	uint64_t occlusions;	// Shadow rays that the object kept from reaching their light
+	uint64_t steps;				// Traversal steps: visits of the object in the object list, bounds tests of a mesh
+
+	/**
+	 * @brief Constructor
+	 */
+	ObjectCost()
+		: tests(0), shadowTests(0), hits(0), occlusions(0), steps(0)
+	{
+	}
+
+	/**
+	 * @brief Adds another cost to this one
+	 * @param[in] other Cost to add
+	 */
+	void Add(const ObjectCost& other)
+	{
+		tests += other.tests;
+		shadowTests += other.shadowTests;
+		hits += other.hits;
+		occlusions += other.occlusions;
+		steps += other.steps;
+	}
+};
+
+// Per-object ray costs of a scene. Entries 0 to N - 1 are Scene::objects, the following ones Scene::meshes.
+// Every thread that casts rays counts into its own array, so profiling adds no contention; Total() adds them up.
+struct RayCostProfile
+{
+	uint64_t id;																			 // Identifies the profile in the threads' caches
+	size_t numOfEntries;															 // Objects and meshes
+	std::unordered_map<const SceneObject*, uint32_t> entryOf; // Entry of every object and of every triangle of every mesh level
+	std::mutex mutex;																	 // Guards threadCosts
+	std::vector<std::unique_ptr<ObjectCost[]>> threadCosts; // Costs counted by each thread that cast rays
+
+	/**
+	 * @brief Constructor
+	 * @param[in] objects Objects of the scene
+	 * @param[in] meshes  Meshes with levels of detail of the scene
+	 */
+	RayCostProfile(const std::vector<SceneObject*>& objects, const std::vector<LodMesh*>& meshes)
+		: numOfEntries(objects.size() + meshes.size())
+	{
+		static std::atomic<uint64_t> nextId(1);
+		id = nextId++;
+		for (size_t i = 0; i < objects.size(); ++i)
+			entryOf[objects[i]] = static_cast<uint32_t>(i);
+		for (size_t m = 0; m < meshes.size(); ++m)
+		{
+			for (size_t l = 0; l < meshes[m]->levels.size(); ++l)
+			{
+				for (size_t i = 0; i < meshes[m]->levels[l].triangles.size(); ++i)
+					entryOf[meshes[m]->levels[l].triangles[i]] = static_cast<uint32_t>(objects.size() + m);
+			}
+		}
+	}
+
+	RayCostProfile(const RayCostProfile&) = delete;
+	RayCostProfile& operator=(const RayCostProfile&) = delete;
+
+	/**
+	 * @return Cost array of the calling thread (created on its first ray)
+	 */
+	ObjectCost* ThreadCosts()
+	{
+		thread_local uint64_t cachedId(0);
+		thread_local ObjectCost* cachedCosts(nullptr);
+		if (cachedId != id)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			threadCosts.emplace_back(new ObjectCost[numOfEntries]);
+			cachedCosts = threadCosts.back().get();
+			cachedId = id;
+		}
+		return cachedCosts;
+	}
+
+	/**
+	 * @brief Adds up the costs counted by all threads (call once they stopped casting rays)
+	 * @return Cost of every entry
+	 */
+	std::vector<ObjectCost> Total()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<ObjectCost> total(numOfEntries);
+		for (size_t t = 0; t < threadCosts.size(); ++t)
+		{
+			for (size_t i = 0; i < numOfEntries; ++i)
+				total[i].Add(threadCosts[t][i]);
+		}
+		return total;
+	}
+};
+
+// Header at the start of a tiled texture file. It is followed by the level table and then by the tiles of every level, in scanline order.
+struct TiledTextureHeader
+{
+	char magic[8];				// TILED_TEXTURE_MAGIC
+	uint64_t buildOptions; // TEXTURE_TILE_SIZE of the build that wrote the file
+	uint32_t width;				// Width of level 0 in texels
+	uint32_t height;			// Height of level 0 in texels
+	uint32_t numOfLevels; // Mip levels, halving down to 1x1
+	uint32_t reserved;		// Padding (0)
+};
+
+// Entry of the level table of a tiled texture file
+struct TextureLevel
+{
+	uint32_t width;			// Width in texels
+	uint32_t height;		// Height in texels
+	uint32_t tilesX;		// Tiles per row
+	uint32_t tilesY;		// Rows of tiles
+	uint64_t firstTile; // Index of the level's first tile in the file
+};
+
+const char TILED_TEXTURE_MAGIC[8] = {'R', 'T', 'T', 'E', 'X', '0', '0', '2'};
+const size_t TEXTURE_TILE_TEXELS(TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE); // Texels per tile (RGBA, 8 bits per channel)
+const uint64_t NO_CACHED_TILE(UINT64_MAX);													 // Tile of an empty cache slot
+
+// Texture stored in a tiled texture file
+struct TiledTexture
+{
+	std::vector<TextureLevel> levels; // Mip levels, largest first
+	uint64_t firstTile;								// Index of the texture's first tile among the tiles of all textures
+	std::string path;									// Tiled texture file
+	std::vector<std::unique_ptr<std::ifstream>> idleFiles; // Open handles of the file that no thread is reading from (guarded by TextureCache::filesMutex)
+};
+
+// Fixed-size cache of texture tiles shared by all render threads. Only tiles that rays actually touch are read from disk.
+// Hits are lock-free: a page table maps every tile of every texture to the slot that holds it, and each slot's sequence number
+// tells a reader whether the slot was refilled while it was reading. Misses read the tile on a file handle of their own and then
+// take a mutex only to put it into a slot chosen by the clock algorithm (an approximation of LRU, where hits set a slot's
+// reference bit and the clock hand clears it).
+struct TextureCache
+{
+	// Cache entry holding one tile
+	struct Slot
+	{
+		std::atomic<uint32_t> sequence; // Odd while the slot is being refilled
+		std::atomic<uint64_t> tile;			// Tile held by the slot (NO_CACHED_TILE if none)
+		std::atomic<bool> referenced;		// Whether the slot was hit since the clock hand last passed it
+	};
+
+	std::vector<TiledTexture> textures;								 // Textures, in the order of Material::texture
+	uint64_t numOfTiles;															 // Tiles of all textures
+	std::unique_ptr<std::atomic<int32_t>[]> pageTable; // Slot holding each tile (-1 if the tile is not cached)
+	std::unique_ptr<Slot[]> slots;										 // Cache slots
+	std::unique_ptr<std::atomic<uint32_t>[]> texels;	 // TEXTURE_TILE_TEXELS texels per slot
+	size_t numOfSlots;																 // Number of slots
+	std::mutex mutex;																	 // Serializes filling slots
+	std::mutex filesMutex;														 // Guards the textures' idle file handles
+	size_t clockHand;																	 // Next slot to consider for eviction (guarded by mutex)
+	uint64_t numOfLoads;															 // Tiles read from disk (guarded by mutex)
+	uint64_t numOfEvictions;													 // Tiles dropped to make room (guarded by mutex)
+
+	/**
+	 * @brief Constructor. Creates an empty cache; add the textures and then allocate it.
+	 */
+	TextureCache()
+		: numOfTiles(0), numOfSlots(0), clockHand(0), numOfLoads(0), numOfEvictions(0)
+	{
+	}
+
+	TextureCache(const TextureCache&) = delete;
+	TextureCache& operator=(const TextureCache&) = delete;
+
+	/**
+	 * @brief Opens a tiled texture file and reads its level table. No texels are read until they are sampled.
+	 * @param[in] path Path of the tiled texture file
+	 * @return Whether the file is a valid tiled texture file
+	 */
+	bool AddTexture(const std::string& path)
+	{
+		TiledTextureHeader header;
+		textures.emplace_back();
+		TiledTexture& texture(textures.back());
+		std::unique_ptr<std::ifstream> file(new std::ifstream(path, std::ios::binary));
+		file->read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (!*file or std::memcmp(header.magic, TILED_TEXTURE_MAGIC, sizeof(TILED_TEXTURE_MAGIC)) != 0 or header.buildOptions != TEXTURE_TILE_SIZE or header.numOfLevels == 0)
+			return false;
+
+		texture.levels.resize(header.numOfLevels);
+		file->read(reinterpret_cast<char*>(texture.levels.data()), header.numOfLevels * sizeof(TextureLevel));
+		texture.firstTile = numOfTiles;
+		texture.path = path;
+		numOfTiles += texture.levels.back().firstTile + (static_cast<uint64_t>(texture.levels.back().tilesX) * texture.levels.back().tilesY);
+		if (!*file)
+			return false;
+		texture.idleFiles.push_back(std::move(file));
+		return true;
+	}
+
+	/**
+	 * @brief Allocates the page table and as many slots as fit in the budget (but no more than there are tiles)
+	 * @param[in] budgetBytes Memory budget of the cached texels
+	 */
+	void Allocate(const size_t& budgetBytes)
+	{
+		numOfSlots = static_cast<size_t>(std::min<uint64_t>(numOfTiles, std::max<size_t>(budgetBytes / (TEXTURE_TILE_TEXELS * sizeof(uint32_t)), 1)));
+		pageTable.reset(new std::atomic<int32_t>[numOfTiles]);
+		for (uint64_t i = 0; i < numOfTiles; ++i)
+			pageTable[i].store(-1, std::memory_order_relaxed);
+		slots.reset(new Slot[numOfSlots]);
+		texels.reset(new std::atomic<uint32_t>[numOfSlots * TEXTURE_TILE_TEXELS]);
+		for (size_t i = 0; i < numOfSlots; ++i)
+		{
+			slots[i].sequence.store(0, std::memory_order_relaxed);
+			slots[i].tile.store(NO_CACHED_TILE, std::memory_order_relaxed);
+			slots[i].referenced.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	/**
+	 * @return Memory used by the page table and the slots
+	 */
+	size_t MemoryBytes() const
+	{
+		return (numOfTiles * sizeof(std::atomic<int32_t>)) + (numOfSlots * (sizeof(Slot) + (TEXTURE_TILE_TEXELS * sizeof(uint32_t))));
+	}
+
+	/**
+	 * @brief Reads a texel if its tile is cached, without locking
+	 * @param[in]  tile   Tile (index among the tiles of all textures)
+	 * @param[in]  texel  Texel within the tile
+	 * @param[out] outRGBA Texel
+	 * @return Whether the tile was cached and stayed cached while the texel was read
+	 */
+	bool ReadCached(const uint64_t& tile, const size_t& texel, uint32_t& outRGBA) const
+	{
+		int32_t slot(pageTable[tile].load(std::memory_order_acquire));
+		if (slot < 0)
+			return false;
+
+		Slot& cached(slots[slot]);
+		uint32_t sequence(cached.sequence.load(std::memory_order_acquire));
+		if ((sequence & 1) != 0 or cached.tile.load(std::memory_order_relaxed) != tile)
+			return false;
+		outRGBA = texels[(slot * TEXTURE_TILE_TEXELS) + texel].load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (cached.sequence.load(std::memory_order_relaxed) != sequence)
+			return false;
+
+		if (!cached.referenced.load(std::memory_order_relaxed))
+			cached.referenced.store(true, std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	 * @brief Reads a texel whose tile was not cached: reads the tile from disk and puts it into the slot the clock hand picks
+	 * @param[in] texture Texture (index in textures)
+	 * @param[in] tile    Tile (index among the tiles of all textures)
+	 * @param[in] texel   Texel within the tile
+	 * @return Texel (opaque black if the file could not be read)
+	 */
+	uint32_t Load(const size_t& texture, const uint64_t& tile, const size_t& texel)
+	{
+		// The read happens without the cache's mutex, on a handle no other thread uses, so misses don't wait for each other's reads
+		TiledTexture& source(textures[texture]);
+		std::unique_ptr<std::ifstream> file;
+		{
+			std::lock_guard<std::mutex> filesLock(filesMutex);
+			if (!source.idleFiles.empty())
+			{
+				file = std::move(source.idleFiles.back());
+				source.idleFiles.pop_back();
+			}
+		}
+		if (file == nullptr)
+			file.reset(new std::ifstream(source.path, std::ios::binary));
+
+		std::array<uint32_t, TEXTURE_TILE_TEXELS> tileTexels;
+		uint64_t tileInFile(tile - source.firstTile);
+		file->clear();
+		file->seekg(static_cast<std::streamoff>(sizeof(TiledTextureHeader) + (source.levels.size() * sizeof(TextureLevel)) + (tileInFile * TEXTURE_TILE_TEXELS * sizeof(uint32_t))));
+		if (!file->read(reinterpret_cast<char*>(tileTexels.data()), TEXTURE_TILE_TEXELS * sizeof(uint32_t)))
+			tileTexels.fill(0xFF000000u);
+		{
+			std::lock_guard<std::mutex> filesLock(filesMutex);
+			source.idleFiles.push_back(std::move(file));
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		++numOfLoads;
+
+		// Another thread may have loaded the tile while this one was reading it
+		int32_t slot(pageTable[tile].load(std::memory_order_relaxed));
+		if (slot >= 0)
+			return tileTexels[texel];
+
+		// Second chance: skip (and clear) slots that were hit since the hand last passed them
+		while (slots[clockHand].referenced.load(std::memory_order_relaxed))
+		{
+			slots[clockHand].referenced.store(false, std::memory_order_relaxed);
+			clockHand = (clockHand + 1) % numOfSlots;
+		}
+		slot = static_cast<int32_t>(clockHand);
+		clockHand = (clockHand + 1) % numOfSlots;
+
+		Slot& victim(slots[slot]);
+		uint64_t evicted(victim.tile.load(std::memory_order_relaxed));
+		if (evicted != NO_CACHED_TILE)
+		{
+			pageTable[evicted].store(-1, std::memory_order_relaxed);
+			++numOfEvictions;
+		}
+		uint32_t sequence(victim.sequence.load(std::memory_order_relaxed));
+		victim.sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < TEXTURE_TILE_TEXELS; ++i)
+			texels[(slot * TEXTURE_TILE_TEXELS) + i].store(tileTexels[i], std::memory_order_relaxed);
+		victim.tile.store(tile, std::memory_order_relaxed);
+		victim.sequence.store(sequence + 2, std::memory_order_release);
+		victim.referenced.store(true, std::memory_order_relaxed);
+		pageTable[tile].store(slot, std::memory_order_release);
+		return tileTexels[texel];
+	}
+
+	/**
+	 * @brief Reads one texel, wrapping the coordinates around the level (the texture repeats)
+	 * @param[in] texture Texture (index in textures)
+	 * @param[in] level   Mip level
+	 * @param[in] x       X-coordinate of the texel
+	 * @param[in] y       Y-coordinate of the texel (0 is the top row)
+	 * @return Texel color in [0, 1]
+	 */
+	glm::vec3 Fetch(const size_t& texture, const size_t& level, int x, int y)
+	{
+		const TextureLevel& mip(textures[texture].levels[level]);
+		uint32_t rgba;
+		x = ((x % static_cast<int>(mip.width)) + mip.width) % mip.width;
+		y = ((y % static_cast<int>(mip.height)) + mip.height) % mip.height;
+
+		uint64_t tile(textures[texture].firstTile + mip.firstTile + (static_cast<uint64_t>(y / TEXTURE_TILE_SIZE) * mip.tilesX) + (x / TEXTURE_TILE_SIZE));
+		size_t texel(((y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE) + (x % TEXTURE_TILE_SIZE));
+		if (!ReadCached(tile, texel, rgba))
+			rgba = Load(texture, tile, texel);
+		return glm::vec3(static_cast<float>(rgba & 0xFF), static_cast<float>((rgba >> 8) & 0xFF), static_cast<float>((rgba >> 16) & 0xFF)) / 255.0f;
+	}
+
+	/**
+	 * @brief Bilinearly filters one mip level
+	 * @param[in] texture Texture (index in textures)
+	 * @param[in] level   Mip level
+	 * @param[in] uv      Texture coordinates (v = 0 is the top of the image)
+	 * @return Filtered color
+	 */
+	glm::vec3 SampleLevel(const size_t& texture, const size_t& level, const glm::vec2& uv)
+	{
+		const TextureLevel& mip(textures[texture].levels[level]);
+		float x((uv.x * mip.width) - 0.5f), y((uv.y * mip.height) - 0.5f);
+		float x0(std::floor(x)), y0(std::floor(y));
+		float fx(x - x0), fy(y - y0);
+		int ix(static_cast<int>(x0)), iy(static_cast<int>(y0));
+		glm::vec3 top((Fetch(texture, level, ix, iy) * (1.0f - fx)) + (Fetch(texture, level, ix + 1, iy) * fx));
+		glm::vec3 bottom((Fetch(texture, level, ix, iy + 1) * (1.0f - fx)) + (Fetch(texture, level, ix + 1, iy + 1) * fx));
+		return (top * (1.0f - fy)) + (bottom * fy);
+	}
+
+	/**
+	 * @brief Samples a texture with trilinear filtering, picking the mip levels whose texels match the footprint
+	 * @param[in] texture   Texture (index in textures)
+	 * @param[in] uv        Texture coordinates
+	 * @param[in] footprint Width of the area to average, in texture coordinate units
+	 * @return Filtered color
+	 */
+	glm::vec3 Sample(const int32_t& texture, const glm::vec2& uv, const float& footprint)
+	{
+		const std::vector<TextureLevel>& levels(textures[texture].levels);
+		float texelsCovered(footprint * static_cast<float>(std::max(levels[0].width, levels[0].height)));
+		float level(glm::clamp((texelsCovered > 1.0f) ? std::log2(texelsCovered) : 0.0f, 0.0f, static_cast<float>(levels.size() - 1)));
+		size_t level0(static_cast<size_t>(level));
+		float blend(level - static_cast<float>(level0));
+		glm::vec2 wrapped(uv.x - std::floor(uv.x), uv.y - std::floor(uv.y));
+
+		glm::vec3 color(SampleLevel(texture, level0, wrapped));
+		if (blend > 0.0f and level0 + 1 < levels.size())
+			color = (color * (1.0f - blend)) + (SampleLevel(texture, level0 + 1, wrapped) * blend);
+		return color;
+	}
+};
+
+struct Camera
+{
+	glm::vec3 position;		// Position
+	glm::vec3 lookTarget; // Look target
+	glm::vec3 globalUp;		// Global up-vector
+	float fovY;						// Vertical field of view
+	float focalLength;		// Focal length
+
+	int imageWidth;	 // image width
+	int imageHeight; // image height
+};
+
+struct Light
+{
+	glm::vec4 position; // Light position (w = 1 if point light, w = 0 if directional light)
+
+	glm::vec3 ambient;	// Light's ambient intensity
+	glm::vec3 diffuse;	// Light's diffuse intensity
+	glm::vec3 specular; // Light's specular intensity
+
+	// --- Attenuation variables ---
+	float constant;	 // Constant factor
+	float linear;		 // Linear factor
+	float quadratic; // Quadratic factor
+};
+
+struct IntersectionInfo
+{
+	Ray incomingRay;							// Ray used to calculate the intersection
+	float t;											// Distance from the ray's origin to the point of intersection (if there was an intersection).
+	SceneObject* obj;							// Object that the ray intersected with. If this is equal to nullptr, then no intersection occured.
+	glm::vec3 intersectionPoint;	// Point where the intersection occured (if there was an intersection)
+	glm::vec3 intersectionNormal; // Normal vector at the point of intersection (if there was an intersection)
+};
+
+struct Scene
+{
+	std::vector<SceneObject*> objects; // List of all objects in the scene
+	std::vector<Light> lights;					// List of all lights in the scene
+	QuantizedGeometry quantizedGeometry; // Quantized triangles, which the QuantizedMesh objects index into
+	std::unique_ptr<TextureCache> textures; // Textures of the materials (nullptr if no material is textured)
+	std::vector<LodMesh*> meshes;				// Meshes with levels of detail, tested after the objects (empty unless enabled)
+	float pixelSpread;									// Width of a pixel's ray cone per unit of distance (picks the meshes' levels of detail)
+	std::unique_ptr<RayCostProfile> profile; // Ray costs of the objects and meshes (nullptr unless profiling)
+};
+
+struct Image
+{
+	std::vector<unsigned char> data; // Image data
+	int width;											 // Image width
+	int height;											 // Image height
+
+	/**
+	 * @brief Constructor. Creates an empty image.
+	 */
+	Image()
+		: width(0), height(0)
+	{
+	}
+
+	/**
+	 * @brief Constructor
+	 * @param[in] w Width
+	 * @param[in] h Height
+	 */
+	Image(const int& w, const int& h)
+		: width(w), height(h)
+	{
+		data.resize(w * h * 3, 0);
+	}
+
+	/**
+	 * @brief Converts the provided color value from [0, 1] to [0, 255]
+	 * @param[in] c Color value in [0, 1] range
+	 * @return Color value in [0, 255] range
+	 */
+	unsigned char ToChar(float c)
+	{
+		c = glm::clamp(c, 0.0f, 1.0f);
+		return static_cast<unsigned char>(c * 255);
+	}
+
+	/**
+	 * @brief Sets the color at the specified pixel location
+	 * @param[in] x     X-coordinate of the pixel
+	 * @param[in] y     Y-coordinate of the pixel
+	 * @param[in] color Pixel color
+	 */
+	void SetColor(const int& x, const int& y, const glm::vec3& color)
+	{
+		int index = (y * width + x) * 3;
+		data[index] = ToChar(color.r);
+		data[index + 1] = ToChar(color.g);
+		data[index + 2] = ToChar(color.b);
+	}
+};
+
+// Small PCG random number generator. Each pixel seeds its own, so its samples do not depend on which thread renders it or when.
+struct Random
+{
+	uint64_t state; // Generator state
+
+	/**
+	 * @brief Constructor
+	 * @param[in] seed Seed
+	 */
+	Random(const uint64_t& seed)
+		: state(0)
+	{
+		NextUInt();
+		state += seed;
+		NextUInt();
+	}
+
+	/**
+	 * @return Next random 32-bit value
+	 */
+	uint32_t NextUInt()
+	{
+		uint64_t oldState(state);
+		state = oldState * 6364136223846793005ull + 1442695040888963407ull;
+		uint32_t xorShifted(static_cast<uint32_t>(((oldState >> 18u) ^ oldState) >> 27u));
+		uint32_t rotation(static_cast<uint32_t>(oldState >> 59u));
+		return (xorShifted >> rotation) | (xorShifted << ((32 - rotation) & 31));
+	}
+
+	/**
+	 * @return Next random value in [0, 1)
+	 */
+	float NextFloat()
+	{
+		return static_cast<float>(NextUInt() >> 8) / 16777216.0f;
+	}
+};
+
+/**
+ * @brief Seed of the random numbers used for a pixel
+ * @param[in] x X-coordinate of the pixel
+ * @param[in] y Y-coordinate of the pixel
+ * @return Seed
+ */
+uint64_t PixelSeed(const int& x, const int& y)
+{
+	return (static_cast<uint64_t>(static_cast<uint32_t>(y)) << 32) | static_cast<uint32_t>(x);
+}
+
+/**
+ * @brief Gets the ray that goes from the camera's position to the specified pixel at (x, y)
+ * @param[in] camera Camera data
+ * @param[in] x X-coordinate of the pixel (upper-left corner of the pixel)
+ * @param[in] y Y-coordinate of the pixel (upper-left corner of the pixel)
+ * @param[in] random Source of the anti-aliasing jitter (nullptr to pass through the center of the pixel)
+ * @return Ray that passes through the pixel at (x, y)
+ */
+Ray GetRayThruPixel(const Camera& camera, const int& pixelX, const int& pixelY, Random* random = nullptr)
+{
+	Ray ray;
+	glm::vec3 cameraLookDirection(glm::normalize(camera.lookTarget - camera.position));
+
+	// VIEWPORT SIZING
+	float viewportHeight(2 * camera.focalLength * glm::tan(glm::radians(camera.fovY) / 2));
+	float viewportWidth(camera.imageWidth * viewportHeight / camera.imageHeight);
+
+	// UV directions of the camera
+	glm::vec3 u(glm::normalize(glm::cross(cameraLookDirection, camera.globalUp)));
+	glm::vec3 v(glm::normalize(glm::cross(u, cameraLookDirection)));
+
+	glm::vec3 viewportLowerLeft(camera.position + (cameraLookDirection * camera.focalLength) - (u * (viewportWidth / 2)) - (v * (viewportHeight / 2)));
+
+	float pixelXOffset(0.5f); // the part of the pixel that the ray passes through
+	float pixelYOffset(0.5f);
+	if (random != nullptr)
+	{
+		pixelXOffset = random->NextFloat(); // the part of the pixel that the ray passes through
+		pixelYOffset = random->NextFloat();
+	}
+
+	// position of pixel in viewport
+	float s((pixelX + pixelXOffset) * viewportWidth / camera.imageWidth);
+	float t((pixelY + pixelYOffset) * viewportHeight / camera.imageHeight);
+	glm::vec3 pixelPosition(viewportLowerLeft + (u * s) + (v * t));
+
+	ray.origin = camera.position;
+	ray.direction = glm::normalize(pixelPosition - ray.origin);
+	ray.pathLength = 0.0f;
+
+	return ray;
+}
+
+// Rays cast by the current thread. Render loops add the difference over a tile to an atomic counter that progress reporting samples.
+thread_local uint64_t numOfRaysCast(0);
+
+/**
+ * @brief The traversal of Raycast(), counting the work spent on every object and mesh into the scene's profile
+ * @param[in,out] ret     Result of the raycast being made
+ * @param[in]     test    Raycast()'s test of one object against the ray, which updates ret
+ * @param[in]     scene   Scene object (scene.profile must not be nullptr)
+ * @param[in]     rayType Type of the ray (one of VisibilityFlags)
+ * @return Returns an IntersectionInfo object that will contain the results of the raycast
+ */
+template <typename Test>
+IntersectionInfo ProfiledRaycast(IntersectionInfo& ret, const Test& test, const Scene& scene, const uint32_t& rayType)
+{
+	ObjectCost* costs(scene.profile->ThreadCosts());
+	uint64_t shadowTest((rayType == SHADOW_VISIBLE) ? 1 : 0);
+	for (size_t i = 0; i < scene.objects.size(); ++i)
+	{
+		++costs[i].steps;
+		if (scene.objects[i]->visibility & rayType)
+		{
+			test(scene.objects[i]);
+			costs[i].tests += scene.objects[i]->GetNumOfPrimitives();
+			costs[i].shadowTests += shadowTest * scene.objects[i]->GetNumOfPrimitives();
+		}
+	}
+
+	for (size_t m = 0; m < scene.meshes.size(); ++m)
+	{
+		const LodMesh& mesh(*scene.meshes[m]);
+		ObjectCost& cost(costs[scene.objects.size() + m]);
+		float entry;
+		++cost.steps;
+		if (!(mesh.visibility & rayType) or !mesh.bounds.Intersect(ret.incomingRay, entry) or (ret.t > 0 and entry > ret.t))
+			continue;
+
+		const LodLevel& level(mesh.SelectLevel(ret.incomingRay, rayType, entry, scene.pixelSpread));
+		for (size_t i = 0; i < level.triangles.size(); ++i)
+			test(level.triangles[i]);
+		cost.tests += level.triangles.size();
+		cost.shadowTests += shadowTest * level.triangles.size();
+	}
+
+	if (ret.obj != nullptr)
+		++costs[scene.profile->entryOf.at(ret.obj)].hits;
+	return ret;
+}
+
+/**
+ * @brief Cast a ray to the scene.
+ * @param[in] ray      Ray to cast to the scene
+ * @param[in] scene    Scene object
+ * @param[in] rayType  Type of the ray (one of VisibilityFlags). Objects hidden from this type are skipped.
+ * @return Returns an IntersectionInfo object that will contain the results of the raycast
+ */
+
+IntersectionInfo Raycast(const Ray& ray, const Scene& scene, const uint32_t& rayType = CAMERA_VISIBLE)
 {
 	IntersectionInfo ret;
 	IntersectionInfo infoTemp;
+	bool first(true);
+	++numOfRaysCast;
 	ret.incomingRay = ray;
+	ret.t = NO_INTERSECTION;
+	ret.obj = nullptr;
 	infoTemp.incomingRay = ray;
 	infoTemp.intersectionPoint = glm::vec3();
 	infoTemp.intersectionNormal = glm::vec3();
 
-	// Go through all objects in the scene.
-	// If the object is closer to the ray origin than the last object, overwrite the contents of ret.
-	for (size_t i = 0; i < scene.objects.size(); ++i)
+	// If the object is closer to the ray origin than the last object, overwrite the contents of ret.
+	auto test = [&](SceneObject* object)
+	{
+		infoTemp.t = object->Intersect(infoTemp.incomingRay, infoTemp.intersectionPoint, infoTemp.intersectionNormal);
+
+		// Set ret.t on first iteration
+		// Only set obj, point, and normal if infoTemp.t is an intersection
+		if (first)
+		{
+			first = false;
+			ret.t = infoTemp.t;
+			if (infoTemp.t != NO_INTERSECTION)
+			{
+				ret.obj = object;
+				ret.intersectionPoint = infoTemp.intersectionPoint;
+				ret.intersectionNormal = infoTemp.intersectionNormal;
+			}
+			else
+			{
+				ret.obj = nullptr;
+			}
+		}
+		// On succeeding iterations, only overwrite ret if:
+		// both infoTemp and ret's t values are positive, and infoTemp.t is less than ret.t, OR
+		// ret.t has no intersection while infoTemp.t has
+		else
+		{
+			if ((infoTemp.t > 0 and ret.t > 0 and infoTemp.t < ret.t) or (ret.t == NO_INTERSECTION and infoTemp.t > 0))
+			{
+				ret.t = infoTemp.t;
+				ret.obj = object;
+				ret.intersectionPoint = infoTemp.intersectionPoint;
+				ret.intersectionNormal = infoTemp.intersectionNormal;
+			}
+		}
+	};
+
+	if (scene.profile != nullptr)
+		return ProfiledRaycast(ret, test, scene, rayType);
+
+	// Go through all objects in the scene that this type of ray sees.
+	for (size_t i = 0; i < scene.objects.size(); ++i)
+	{
+		if (scene.objects[i]->visibility & rayType)
+			test(scene.objects[i]);
+	}
+
+	// Then through the meshes with levels of detail that the ray reaches before its closest hit so far, at the level it needs
+	for (size_t m = 0; m < scene.meshes.size(); ++m)
+	{
+		const LodMesh& mesh(*scene.meshes[m]);
+		float entry;
+		if (!(mesh.visibility & rayType) or !mesh.bounds.Intersect(ray, entry) or (ret.t > 0 and entry > ret.t))
+			continue;
+
+		const LodLevel& level(mesh.SelectLevel(ray, rayType, entry, scene.pixelSpread));
+		for (size_t i = 0; i < level.triangles.size(); ++i)
+			test(level.triangles[i]);
+	}
+	return ret;
+}
+
+// Contribution of one light at a surface point, before shadowing is taken into account
+struct LightSample
+{
+	glm::vec3 ambient;		 // Ambient contribution (added whether or not the point is shadowed)
+	glm::vec3 direct;			 // Attenuated diffuse + specular contribution (added only if the point is lit)
+	Ray shadowRay;				 // Ray from the surface point towards the light
+	float distanceToLight; // Distance from the shadow ray origin to the light
+};
+
+/**
+ * @brief Evaluates the lighting model for one light at a surface point
+ * @param[in] light        Light data
+ * @param[in] numOfLights  Number of lights in the scene (ambient light is split between them)
+ * @param[in] material     Material of the surface
+ * @param[in] point        Surface point
+ * @param[in] normal       Surface normal at the point
+ * @param[in] camera       Camera data
+ * @return Ambient and direct contributions of the light, and the shadow ray that decides whether the direct part applies
+ */
+LightSample SampleLight(const Light& light, const size_t& numOfLights, const Material& material, const glm::vec3& point, const glm::vec3& normal, const Camera& camera)
+{
+	LightSample sample;
+	glm::vec3 diffuse, specular;
+	glm::vec3 directionToLight;
+	float distanceToLight;
+	float diffuseStrength;
+	glm::vec3 reflectedLight;
+	float specularStrength;
+	float attenuation;
+
+	// AMBIENT
+	sample.ambient = material.ambient * (light.ambient / static_cast<float>(numOfLights));
+
+	// DIFFUSE
+	directionToLight = (light.position.w == POINT_LIGHT)
+		? glm::normalize(glm::vec3(light.position) - point)
+		: glm::normalize(glm::vec3(-light.position));
+	diffuseStrength = glm::max(glm::dot(directionToLight, normal), 0.0f);
+	diffuse = diffuseStrength * material.diffuse * light.diffuse;
+
+	// SPECULAR
+	reflectedLight = glm::reflect(-directionToLight, normal);
+	specularStrength = glm::pow(glm::max(glm::dot(reflectedLight, glm::normalize(camera.position - point)), 0.0f), material.shininess);
+	specular = specularStrength * material.specular * light.specular;
+
+	// ATTENUATION
+	attenuation = 1.0f;
+
+	if (light.position.w != DIRECTIONAL_LIGHT)
+	{
+		distanceToLight = glm::distance(point, glm::vec3(light.position));
+		attenuation = 1.0f / (light.constant + (light.linear * distanceToLight) + (light.quadratic * distanceToLight * distanceToLight));
+	}
+	sample.direct = (diffuse + specular) * attenuation;
+
+	// SHADOWING
+	sample.shadowRay.origin = point + (normal * SHADOW_BIAS);
+	sample.shadowRay.direction = directionToLight;
+	sample.shadowRay.pathLength = 0.0f;
+	sample.distanceToLight = (light.position.w == POINT_LIGHT)
+		? glm::distance(sample.shadowRay.origin, glm::vec3(light.position))
+		: glm::distance(sample.shadowRay.origin, sample.shadowRay.direction * 999.0f);
+
+	return sample;
+}
+
+/**
+ * @brief Decides whether the result of a shadow ray leaves the point lit
+ * @param[in] sample         Light sample whose shadow ray was cast
+ * @param[in] occluded       Whether the shadow ray hit anything
+ * @param[in] occluderPoint  Point where the shadow ray hit (only read if occluded is true)
+ * @return Whether the direct contribution of the light applies
+ */
+bool IsLit(const LightSample& sample, const bool& occluded, const glm::vec3& occluderPoint)
+{
+	// Lit when there is no occluder, or the occluder is farther away than the light
+	return not occluded or glm::distance(sample.shadowRay.origin, occluderPoint) > sample.distanceToLight;
+}
+
+glm::vec3 RayTrace(const Ray& ray, const Scene& scene, const Camera& camera, int maxDepth = 1, const uint32_t& rayType = CAMERA_VISIBLE);
+
+/**
+ * @brief Computes the reflection ray of a hit
+ * @param[in] intersectionInfo Hit to reflect
+ * @return Mirrored ray, starting just above the surface
+ */
+Ray GetReflectionRay(const IntersectionInfo& intersectionInfo)
+{
+	Ray reflectionRay;
+	reflectionRay.origin = intersectionInfo.intersectionPoint + (intersectionInfo.intersectionNormal * REFLECTION_BIAS);
+	reflectionRay.direction = glm::reflect(intersectionInfo.incomingRay.direction, intersectionInfo.intersectionNormal);
+	reflectionRay.pathLength = intersectionInfo.incomingRay.pathLength + intersectionInfo.t;
+	return reflectionRay;
+}
+
+/**
+ * @brief Gets the material of a hit, with its texture (if any) applied to the ambient and diffuse colors.
+ * The texture is filtered over the footprint of the hit's ray cone (a pixel wide at the camera, widening along the whole path
+ * and stretched on surfaces seen at a grazing angle), so distant, reflected and grazing surfaces read coarse mip levels.
+ * @param[in] intersectionInfo Hit (intersectionInfo.obj must not be nullptr)
+ * @param[in] scene            Scene data
+ * @param[in] camera           Camera data
+ * @return Material to shade the hit with
+ */
+Material GetSurfaceMaterial(const IntersectionInfo& intersectionInfo, const Scene& scene, const Camera& camera)
+{
+	Material material(intersectionInfo.obj->material);
+	if (material.texture == NO_TEXTURE or scene.textures == nullptr)
+		return material;
+
+	const Ray& ray(intersectionInfo.incomingRay);
+	float pixelSpread(2.0f * glm::tan(glm::radians(camera.fovY) / 2) / static_cast<float>(camera.imageHeight));
+	float cosine(std::max(std::abs(glm::dot(ray.direction, intersectionInfo.intersectionNormal)), MIN_FOOTPRINT_COSINE));
+	float footprint((ray.pathLength + intersectionInfo.t) * pixelSpread / cosine * intersectionInfo.obj->GetTextureDensity());
+	glm::vec3 texel(scene.textures->Sample(material.texture, intersectionInfo.obj->GetTextureCoordinates(intersectionInfo.intersectionPoint), footprint));
+	material.ambient = material.ambient * texel;
+	material.diffuse = material.diffuse * texel;
+	return material;
+}
+
+/**
+ * @brief Casts the shadow ray of a light sample. Occluders are counted into the scene's profile.
+ * @param[in] lightSample Light sample
+ * @param[in] scene       Scene data
+ * @return Whether the direct contribution of the light applies
+ */
+bool CastShadowRay(const LightSample& lightSample, const Scene& scene)
+{
+	IntersectionInfo shadowingInfo(Raycast(lightSample.shadowRay, scene, SHADOW_VISIBLE));
+	bool lit(IsLit(lightSample, shadowingInfo.obj != nullptr, shadowingInfo.intersectionPoint));
+	if (!lit and scene.profile != nullptr)
+		++scene.profile->ThreadCosts()[scene.profile->entryOf.at(shadowingInfo.obj)].occlusions;
+	return lit;
+}
+
+/**
+ * @brief Casts the shadow rays of a surface point ahead of Shade(), e.g. to find out whether its reflection is needed
+ * @param[in]  intersectionInfo Hit (intersectionInfo.obj must not be nullptr)
+ * @param[in]  scene            Scene data
+ * @param[in]  camera           Camera data
+ * @param[out] outLitLights     Whether each light of the scene reaches the point
+ * @return Whether any light reaches the point (Shade() traces no reflection otherwise)
+ */
+bool FindLitLights(const IntersectionInfo& intersectionInfo, const Scene& scene, const Camera& camera, std::vector<bool>& outLitLights)
+{
+	Material material(GetSurfaceMaterial(intersectionInfo, scene, camera));
+	bool anyLit(false);
+	outLitLights.resize(scene.lights.size());
+	for (size_t i = 0; i < scene.lights.size(); ++i)
+	{
+		outLitLights[i] = CastShadowRay(SampleLight(scene.lights[i], scene.lights.size(), material, intersectionInfo.intersectionPoint, intersectionInfo.intersectionNormal, camera), scene);
+		anyLit = anyLit or outLitLights[i];
+	}
+	return anyLit;
+}
+
+/**
+ * @brief Shades a surface point: lights it, casts its shadow rays and traces its reflection
+ * @param[in] intersectionInfo  Hit to shade (intersectionInfo.obj must not be nullptr)
+ * @param[in] scene             Scene data
+ * @param[in] camera            Camera data
+ * @param[in] maxDepth          Maximum depth of the trace, counting the ray that made the hit
+ * @param[in] reflectionColor   Color already traced along the reflection ray (nullptr to trace it here if it is needed)
+ * @param[in] litLights         Lights that reach the point, from FindLitLights() (nullptr to cast the shadow rays here)
+ * @return Color of the point as seen along intersectionInfo.incomingRay
+ */
+glm::vec3 Shade(const IntersectionInfo& intersectionInfo, const Scene& scene, const Camera& camera, const int& maxDepth, const glm::vec3* reflectionColor = nullptr, const std::vector<bool>* litLights = nullptr)
+{
+	glm::vec3 color(BACKGROUND_COLOR);
+
+	LightSample lightSample;
+	Material material(GetSurfaceMaterial(intersectionInfo, scene, camera));
+
+	glm::vec3 reflection;
+	bool hasReflection(reflectionColor != nullptr);
+	if (hasReflection)
+		reflection = *reflectionColor;
+
+	for (size_t i = 0; i < scene.lights.size(); ++i)
+	{
+		lightSample = SampleLight(scene.lights[i], scene.lights.size(), material, intersectionInfo.intersectionPoint, intersectionInfo.intersectionNormal, camera);
+		bool lit((litLights != nullptr) ? static_cast<bool>((*litLights)[i]) : CastShadowRay(lightSample, scene));
+
+		color += lightSample.ambient;
+
+		if (lit)
+		{
+			color += lightSample.direct;
+
+			// REFLECTION (the same for every light that lights the point, so it is traced once)
+			if (maxDepth > 1)
+			{
+				if (!hasReflection)
+				{
+					reflection = RayTrace(GetReflectionRay(intersectionInfo), scene, camera, maxDepth - 1, REFLECTION_VISIBLE);
+					hasReflection = true;
+				}
+				color += reflection * intersectionInfo.obj->material.shininess / REFLECTIVITY_CONSTANT;
+			}
+		}
+	}
+
+	return color;
+}
+
+/**
+ * @brief Perform a ray-trace to the scene
+ * @param[in] ray       Ray to trace
+ * @param[in] scene     Scene data
+ * @param[in] camera    Camera data
+ * @param[in] maxDepth  Maximum depth of the trace
+ * @param[in] rayType   Type of the ray (CAMERA_VISIBLE for primary rays, REFLECTION_VISIBLE for reflected ones)
+ * @return Resulting color after the ray bounced around the scene
+ */
+glm::vec3 RayTrace(const Ray& ray, const Scene& scene, const Camera& camera, int maxDepth, const uint32_t& rayType)
+{
+	IntersectionInfo intersectionInfo = Raycast(ray, scene, rayType);
+	if (intersectionInfo.obj == nullptr)
+		return BACKGROUND_COLOR;
+	return Shade(intersectionInfo, scene, camera, maxDepth);
+}
+
+// Plane of one or more flat mirrors. Reflection rays off it are the rays of a virtual camera mirrored behind the plane,
+// restarted at the surface, so the reflection rays of neighboring pixels form a coherent packet.
+struct MirrorPlane
+{
+	glm::vec3 normal; // Normal of the mirrors' front face
+	float distance;		// Signed distance of the plane from the origin along normal
+};
+
+// Planar mirrors of a scene, and the objects their reflection rays may hit
+struct PlanarMirrors
+{
+	std::vector<MirrorPlane> planes;									// Mirror planes
+	std::map<const SceneObject*, size_t> planeOfMirror; // Plane of every mirror object
+	std::vector<uint32_t> reflectedObjects;						// Indices in Scene::objects of the objects visible to reflection rays
+	std::vector<Bounds> reflectedBounds;							// Bounds of those objects
+};
+
+/**
+ * @brief Largest signed distance of a box from a plane
+ * @param[in] bounds   Box
+ * @param[in] normal   Unit normal of the plane
+ * @param[in] distance Signed distance of the plane from the origin along normal
+ * @return Signed distance of the box corner farthest along the normal
+ */
+float MaxPlaneDistance(const Bounds& bounds, const glm::vec3& normal, const float& distance)
+{
+	return glm::dot(normal, (bounds.min + bounds.max) * 0.5f) + glm::dot(glm::abs(normal), (bounds.max - bounds.min) * 0.5f) - distance;
+}
+
+/**
+ * @brief Finds the flat objects that reflect at least MIRROR_MIN_REFLECTIVITY of the light and groups them by plane
+ * @param[in] scene Scene data
+ * @return Mirror planes (none if the scene has no planar mirrors)
+ */
+PlanarMirrors FindPlanarMirrors(const Scene& scene)
+{
+	PlanarMirrors mirrors;
+	for (size_t i = 0; i < scene.objects.size(); ++i)
+	{
+		glm::vec3 normal;
+		float distance;
+		if (scene.objects[i]->visibility & REFLECTION_VISIBLE)
+		{
+			mirrors.reflectedObjects.push_back(static_cast<uint32_t>(i));
+			mirrors.reflectedBounds.push_back(scene.objects[i]->GetBounds());
+		}
+		if (scene.objects[i]->material.shininess / REFLECTIVITY_CONSTANT < MIRROR_MIN_REFLECTIVITY or !scene.objects[i]->GetPlane(normal, distance))
+			continue;
+
+		size_t p(0);
+		while (p < mirrors.planes.size() and (1.0f - glm::dot(mirrors.planes[p].normal, normal) > MIRROR_PLANE_TOLERANCE or std::abs(mirrors.planes[p].distance - distance) > MIRROR_PLANE_TOLERANCE))
+			++p;
+		if (p == mirrors.planes.size())
+			mirrors.planes.push_back({normal, distance});
+		mirrors.planeOfMirror[scene.objects[i]] = p;
+	}
+	if (mirrors.planes.empty())
+		mirrors = PlanarMirrors();
+	return mirrors;
+}
+
+/**
+ * @brief Finds the objects that a packet of reflection rays off one mirror plane may hit.
+ * The packet is bounded by the frustum of the mirrored virtual camera through the rectangle around the rays' origins on the plane,
+ * and by the plane itself. A bounding plane only culls if every ray moves away from it, and only objects farther behind it than
+ * the farthest ray origin, so the result holds however the mirrors' actual normals deviate from the plane.
+ * @param[in]  mirrors    Planar mirrors of the scene
+ * @param[in]  plane      Mirror plane the rays start on
+ * @param[in]  camera     Camera data (the primary rays start at its position)
+ * @param[in]  rays       Reflection rays
+ * @param[out] outObjects Indices in Scene::objects of the objects to test, in scene order
+ */
+void CullForMirrorPacket(const PlanarMirrors& mirrors, const MirrorPlane& plane, const Camera& camera, const std::vector<Ray>& rays, std::vector<uint32_t>& outObjects)
+{
+	glm::vec3 virtualCamera(camera.position - (2.0f * (glm::dot(plane.normal, camera.position) - plane.distance) * plane.normal));
+	glm::vec3 u(glm::normalize(glm::cross(plane.normal, (std::abs(plane.normal.x) < 0.9f) ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f))));
+	glm::vec3 v(glm::cross(plane.normal, u));
+
+	// Rectangle around the ray origins, grown a little so that no ray runs along a side of the frustum
+	glm::vec2 low(FLT_MAX), high(-FLT_MAX);
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		glm::vec2 p(glm::dot(u, rays[i].origin), glm::dot(v, rays[i].origin));
+		low = glm::min(low, p);
+		high = glm::max(high, p);
+	}
+	glm::vec2 margin((high - low) * 0.01f + glm::vec2(REFLECTION_BIAS));
+	low -= margin;
+	high += margin;
+	glm::vec3 center(plane.normal * plane.distance);
+	glm::vec3 corners[4] = {center + u * low.x + v * low.y, center + u * high.x + v * low.y, center + u * high.x + v * high.y, center + u * low.x + v * high.y};
+	glm::vec3 middle(center + u * ((low.x + high.x) * 0.5f) + v * ((low.y + high.y) * 0.5f));
+
+	// Bounding planes: the four sides of the virtual camera's frustum and the mirror plane
+	glm::vec3 normals[5];
+	float distances[5], slack[5];
+	bool valid[5];
+	for (int j = 0; j < 4; ++j)
+	{
+		glm::vec3 n(glm::cross(corners[j] - virtualCamera, corners[(j + 1) % 4] - virtualCamera));
+		n = (glm::length(n) > 0.0f) ? glm::normalize(n) : glm::vec3();
+		normals[j] = (glm::dot(n, middle - virtualCamera) < 0.0f) ? -n : n;
+		distances[j] = glm::dot(normals[j], virtualCamera);
+	}
+	normals[4] = plane.normal;
+	distances[4] = plane.distance;
+	for (int j = 0; j < 5; ++j)
+	{
+		valid[j] = glm::length(normals[j]) > 0.0f;
+		slack[j] = MIRROR_PLANE_TOLERANCE;
+		for (size_t i = 0; i < rays.size() and valid[j]; ++i)
+		{
+			valid[j] = glm::dot(normals[j], rays[i].direction) >= 0.0f;
+			slack[j] = std::max(slack[j], MIRROR_PLANE_TOLERANCE - (glm::dot(normals[j], rays[i].origin) - distances[j]));
+		}
+	}
+
+	outObjects.clear();
+	for (size_t k = 0; k < mirrors.reflectedObjects.size(); ++k)
+	{
+		bool culled(false);
+		for (int j = 0; j < 5 and !culled; ++j)
+			culled = valid[j] and MaxPlaneDistance(mirrors.reflectedBounds[k], normals[j], distances[j]) < -slack[j];
+		if (!culled)
+			outObjects.push_back(mirrors.reflectedObjects[k]);
+	}
+}
+
+/**
+ * @brief Casts a packet of rays against some of the scene's objects, object by object. Every ray gets the same result as Raycast()
+ * over those objects, so leaving out objects that no ray of the packet can reach gives the same hits as Raycast().
+ * @param[in]  rays          Rays to cast
+ * @param[in]  scene         Scene data
+ * @param[in]  objectIndices Indices in Scene::objects of the objects to test, in scene order
+ * @param[in]  rayType       Type of the rays (one of VisibilityFlags)
+ * @param[out] outHits       Closest hit of every ray
+ */
+void RaycastPacket(const std::vector<Ray>& rays, const Scene& scene, const std::vector<uint32_t>& objectIndices, const uint32_t& rayType, std::vector<IntersectionInfo>& outHits)
+{
+	numOfRaysCast += rays.size();
+	outHits.resize(rays.size());
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		outHits[i].incomingRay = rays[i];
+		outHits[i].t = NO_INTERSECTION;
+		outHits[i].obj = nullptr;
+	}
+
+	bool first(true);
+	glm::vec3 point, normal;
+	for (size_t k = 0; k < objectIndices.size(); ++k)
+	{
+		SceneObject* object(scene.objects[objectIndices[k]]);
+		if (!(object->visibility & rayType))
+			continue;
+
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			IntersectionInfo& hit(outHits[i]);
+			float t(object->Intersect(rays[i], point, normal));
+			if ((first and t != NO_INTERSECTION) or (!first and ((t > 0 and hit.t > 0 and t < hit.t) or (hit.t == NO_INTERSECTION and t > 0))))
+			{
+				hit.t = t;
+				hit.obj = object;
+				hit.intersectionPoint = point;
+				hit.intersectionNormal = normal;
+			}
+		}
+		first = false;
+	}
+
+	if (scene.profile != nullptr)
+	{
+		ObjectCost* costs(scene.profile->ThreadCosts());
+		uint64_t shadowTests((rayType == SHADOW_VISIBLE) ? rays.size() : 0);
+		for (size_t k = 0; k < objectIndices.size(); ++k)
+		{
+			ObjectCost& cost(costs[objectIndices[k]]);
+			cost.steps += rays.size();
+			if (scene.objects[objectIndices[k]]->visibility & rayType)
+			{
+				cost.tests += rays.size() * scene.objects[objectIndices[k]]->GetNumOfPrimitives();
+				cost.shadowTests += shadowTests * scene.objects[objectIndices[k]]->GetNumOfPrimitives();
+			}
+		}
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			if (outHits[i].obj != nullptr)
+				++costs[scene.profile->entryOf.at(outHits[i].obj)].hits;
+		}
+	}
+}
+
+// CPUs this process may use. std::thread::hardware_concurrency() reports every CPU of the host,
+// while containers are usually limited by a cgroup CPU quota or an affinity mask.
+struct CpuBudget
+{
+	unsigned hardwareThreads; // Hardware threads of the machine
+	unsigned affinityThreads; // CPUs in the affinity mask (0 if unknown)
+	double quotaCpus;					// CPUs allowed by the cgroup CPU quota (0 if there is no quota)
+
+	/**
+	 * @return Number of worker threads that uses the budget without oversubscribing it
+	 */
+	unsigned Threads() const
+	{
+		unsigned threads(std::max(1u, hardwareThreads));
+		if (affinityThreads > 0)
+			threads = std::min(threads, affinityThreads);
+		if (quotaCpus > 0.0)
+			threads = std::min(threads, static_cast<unsigned>(std::ceil(quotaCpus)));
+		return std::max(1u, threads);
+	}
+
+	/**
+	 * @brief Reads a cgroup CPU quota file
+	 * @param[in]  path    cpu.max (cgroup v2) or cpu.cfs_quota_us (cgroup v1, with cpu.cfs_period_us next to it)
+	 * @param[out] outCpus CPUs allowed by the quota
+	 * @return Whether the file exists and sets a quota
+	 */
+	static bool ReadQuota(const std::string& path, double& outCpus)
+	{
+		std::ifstream file(path);
+		std::string quota;
+		double period(0.0);
+		if (!(file >> quota) or quota == "max" or quota[0] == '-')
+			return false;
+		if (path.size() >= 7 and path.compare(path.size() - 7, 7, "cpu.max") == 0)
+			file >> period;
+		else
+		{
+			std::ifstream periodFile(path.substr(0, path.rfind('/')) + "/cpu.cfs_period_us");
+			periodFile >> period;
+		}
+		if (!(period > 0.0))
+			return false;
+		outCpus = std::atof(quota.c_str()) / period;
+		return outCpus > 0.0;
+	}
+
+	/**
+	 * @brief Finds the tightest CPU quota of the cgroups this process belongs to, including their ancestors
+	 * @return CPUs allowed (0 if there is no quota)
+	 */
+	static double DetectQuota()
+	{
+		double tightest(0.0), cpus;
+		std::ifstream cgroups("/proc/self/cgroup");
+		std::string line;
+		while (std::getline(cgroups, line))
+		{
+			// "<id>:<controllers>:<path>"; cgroup v2 has id 0 and no controllers
+			size_t first(line.find(':')), second(line.find(':', first + 1));
+			if (first == std::string::npos or second == std::string::npos)
+				continue;
+			std::string controllers("," + line.substr(first + 1, second - first - 1) + ",");
+			std::string path(line.substr(second + 1));
+
+			std::vector<std::string> files;
+			if (controllers == ",,")
+				files.push_back("/sys/fs/cgroup%/cpu.max");
+			else if (controllers.find(",cpu,") != std::string::npos)
+			{
+				files.push_back("/sys/fs/cgroup/cpu%/cpu.cfs_quota_us");
+				files.push_back("/sys/fs/cgroup/cpu,cpuacct%/cpu.cfs_quota_us");
+			}
+
+			// Walk from the process's cgroup up to the root, since any ancestor's quota limits it too
+			while (true)
+			{
+				for (size_t i = 0; i < files.size(); ++i)
+				{
+					std::string file(files[i]);
+					file.replace(file.find('%'), 1, (path == "/") ? "" : path);
+					if (ReadQuota(file, cpus) and (tightest == 0.0 or cpus < tightest))
+						tightest = cpus;
+				}
+				if (path.empty() or path == "/")
+					break;
+				path = path.substr(0, path.rfind('/'));
+				if (path.empty())
+					path = "/";
+			}
+		}
+		return tightest;
+	}
+
+	/**
+	 * @brief Detects the CPU budget of this process
+	 * @return Hardware threads, affinity mask size and cgroup quota
+	 */
+	static CpuBudget Detect()
+	{
+		CpuBudget budget;
+		budget.hardwareThreads = std::thread::hardware_concurrency();
+		budget.affinityThreads = 0;
+		budget.quotaCpus = 0.0;
+#ifdef _WIN32
+		DWORD_PTR processMask, systemMask;
+		if (GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+		{
+			for (; processMask != 0; processMask &= processMask - 1)
+				++budget.affinityThreads;
+		}
+#elif defined(__linux__)
+		cpu_set_t mask;
+		if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+			budget.affinityThreads = CPU_COUNT(&mask);
+		budget.quotaCpus = DetectQuota();
+#endif
+		return budget;
+	}
+};
+
+/**
+ * @return Number of worker threads for parallel work that no thread count was given for (detected once)
+ */
+unsigned DefaultThreadCount()
+{
+	static const unsigned threads(CpuBudget::Detect().Threads());
+	return threads;
+}
+
+/**
+ * @brief Runs a function over the ranges [begin, end) of a work list on several threads.
+ * Ranges start at multiples of grain, so outputs packed at a coarser granularity than one item (e.g. bits) are never shared between threads.
+ * @param[in] count        Number of work items
+ * @param[in] grain        Items per range
+ * @param[in] numOfThreads Number of threads to use (0 for DefaultThreadCount())
+ * @param[in] function     Called with (begin, end) for every range
+ */
+template <typename Function>
+void ParallelFor(const size_t& count, const size_t& grain, unsigned numOfThreads, const Function& function)
+{
+	if (numOfThreads == 0)
+		numOfThreads = DefaultThreadCount();
+	size_t numOfRanges((count + grain - 1) / grain);
+	numOfThreads = static_cast<unsigned>(std::min<size_t>(numOfThreads, numOfRanges));
+
+	std::atomic<size_t> nextRange(0);
+	auto worker = [&] {
+		for (size_t range = nextRange++; range < numOfRanges; range = nextRange++)
+			function(range * grain, std::min(count, (range + 1) * grain));
+	};
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 1; i < numOfThreads; ++i)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < threads.size(); ++i)
+		threads[i].join();
+}
+
+// Header at the start of a packed geometry file. It is followed by the chunk table and then by the primitives.
+struct PackedGeometryHeader
+{
+	char magic[8];					 // PACKED_GEOMETRY_MAGIC
+	uint64_t buildOptions;	 // PackedGeometryOptions() of the build that wrote the file
+	uint64_t chunkCount;		 // Number of entries in the chunk table
+	uint64_t primitiveCount; // Number of primitives
+};
+
+// Entry of the chunk table: a run of spatially close primitives that is read from disk as one unit
+struct PackedChunk
+{
+	Bounds bounds;					 // Bounds of all primitives in the chunk
+	uint64_t firstPrimitive; // Index of the first primitive of the chunk
+	uint64_t primitiveCount; // Number of primitives in the chunk
+};
+
+const char PACKED_GEOMETRY_MAGIC[8] = {'R', 'T', 'P', 'A', 'C', 'K', '0', '4'};
+
+// Node of the bounding volume hierarchy over the chunk table of a packed geometry file, stored depth first
+// (the first child of a node follows it). Chunks are sorted along a space-filling curve, so halving the chunk range gives compact nodes.
+struct ChunkTreeNode
+{
+	Bounds bounds;				 // Bounds of the node's chunks
+	uint32_t firstChunk;	 // First chunk of the node
+	uint32_t numOfChunks;	 // Number of chunks (1 for a leaf)
+	uint32_t secondChild;	 // Index of the second child (unused for a leaf)
+};
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+	const unsigned char* data; // Start of the mapping (nullptr if nothing is mapped)
+	size_t size;							 // Size of the mapping in bytes
+#ifdef _WIN32
+	HANDLE file;		// File handle
+	HANDLE mapping; // File mapping handle
+#else
+	int file; // File descriptor
+#endif
+
+	/**
+	 * @brief Constructor
+	 */
+	MappedFile()
+		: data(nullptr), size(0)
+#ifdef _WIN32
+		, file(INVALID_HANDLE_VALUE), mapping(nullptr)
+#else
+		, file(-1)
+#endif
+	{
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	/**
+	 * @brief Destructor
+	 */
+	~MappedFile()
+	{
+		Close();
+	}
+
+	/**
+	 * @brief Maps the provided file
+	 * @param[in] path Path of the file
+	 * @return Whether the file could be mapped. Empty files cannot be mapped.
+	 */
+	bool Open(const std::string& path)
+	{
+		Close();
+#ifdef _WIN32
+		LARGE_INTEGER fileSize;
+		file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE or !GetFileSizeEx(file, &fileSize) or fileSize.QuadPart == 0)
+		{
+			Close();
+			return false;
+		}
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (view == nullptr)
+		{
+			Close();
+			return false;
+		}
+		size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		struct stat fileStatus;
+		file = open(path.c_str(), O_RDONLY);
+		if (file < 0 or fstat(file, &fileStatus) != 0 or fileStatus.st_size == 0)
+		{
+			Close();
+			return false;
+		}
+		void* view = mmap(nullptr, static_cast<size_t>(fileStatus.st_size), PROT_READ, MAP_SHARED, file, 0);
+		if (view == MAP_FAILED)
+		{
+			Close();
+			return false;
+		}
+		size = static_cast<size_t>(fileStatus.st_size);
+#endif
+		data = static_cast<const unsigned char*>(view);
+		return true;
+	}
+
+	/**
+	 * @brief Unmaps the file (if one is mapped)
+	 */
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE)
+			CloseHandle(file);
+		mapping = nullptr;
+		file = INVALID_HANDLE_VALUE;
+#else
+		if (data != nullptr)
+			munmap(const_cast<unsigned char*>(data), size);
+		if (file >= 0)
+			close(file);
+		file = -1;
+#endif
+		data = nullptr;
+		size = 0;
+	}
+
+	/**
+	 * @brief Hints the OS that a byte range is about to be read, so that it can start reading it from disk
+	 * @param[in] offset Start of the range
+	 * @param[in] length Length of the range in bytes
+	 */
+	void Prefetch(const size_t& offset, const size_t& length) const
+	{
+#ifndef _WIN32
+		Advise(offset, length, MADV_WILLNEED);
+#endif
+	}
+
+	/**
+	 * @brief Hints the OS that a byte range is not needed for now, so that it can drop it from memory
+	 * @param[in] offset Start of the range
+	 * @param[in] length Length of the range in bytes
+	 */
+	void Release(const size_t& offset, const size_t& length) const
+	{
+#ifndef _WIN32
+		Advise(offset, length, MADV_DONTNEED);
+#endif
+	}
+
+#ifndef _WIN32
+	/**
+	 * @brief Passes a madvise() hint for a byte range, widened to whole pages
+	 */
+	void Advise(const size_t& offset, const size_t& length, const int& advice) const
+	{
+		size_t pageSize(static_cast<size_t>(sysconf(_SC_PAGESIZE)));
+		size_t start(offset - (offset % pageSize));
+		if (data == nullptr or length == 0)
+			return;
+		madvise(const_cast<unsigned char*>(data) + start, offset + length - start, advice);
+	}
+#endif
+};
+
+// Geometry of a scene stored in a memory-mapped packed file (out-of-core mode).
+// Primitives are sorted along a Morton curve and grouped into chunks, and only the chunk table needs to stay in memory.
+struct PackedGeometry
+{
+	MappedFile file;											 // Mapped packed geometry file
+	const PackedGeometryHeader* header;		 // File header
+	const PackedChunk* chunks;						 // Chunk table
+	const PackedPrimitive* primitives;		 // All primitives, chunk after chunk
+	std::vector<ChunkTreeNode> chunkTree;	 // Hierarchy over the chunk table (empty if there are no chunks)
+
+	/**
+	 * @brief Constructor
+	 */
+	PackedGeometry()
+		: header(nullptr), chunks(nullptr), primitives(nullptr)
+	{
+	}
+
+	/**
+	 * @brief Maps a packed geometry file and validates its layout
+	 * @param[in] path Path of the file
+	 * @return Whether the file is a valid packed geometry file
+	 */
+	bool Open(const std::string& path)
+	{
+		if (!file.Open(path) or file.size < sizeof(PackedGeometryHeader))
+			return false;
+
+		header = reinterpret_cast<const PackedGeometryHeader*>(file.data);
+		if (std::memcmp(header->magic, PACKED_GEOMETRY_MAGIC, sizeof(PACKED_GEOMETRY_MAGIC)) != 0)
+			return false;
+		if (file.size != sizeof(PackedGeometryHeader) + (header->chunkCount * sizeof(PackedChunk)) + (header->primitiveCount * sizeof(PackedPrimitive)))
+			return false;
+
+		chunks = reinterpret_cast<const PackedChunk*>(file.data + sizeof(PackedGeometryHeader));
+		primitives = reinterpret_cast<const PackedPrimitive*>(chunks + header->chunkCount);
+		chunkTree.clear();
+		if (header->chunkCount > 0)
+			BuildChunkTree(0, static_cast<uint32_t>(header->chunkCount));
+		return true;
+	}
+
+	/**
+	 * @brief Appends the node over a range of chunks and its subtree to chunkTree
+	 * @param[in] firstChunk  First chunk of the range
+	 * @param[in] numOfChunks Number of chunks in the range (at least 1)
+	 * @return Index of the node
+	 */
+	uint32_t BuildChunkTree(const uint32_t& firstChunk, const uint32_t& numOfChunks)
+	{
+		uint32_t index(static_cast<uint32_t>(chunkTree.size()));
+		ChunkTreeNode node;
+		node.firstChunk = firstChunk;
+		node.numOfChunks = numOfChunks;
+		node.secondChild = 0;
+		for (uint32_t c = firstChunk; c < firstChunk + numOfChunks; ++c)
+			node.bounds.Grow(chunks[c].bounds);
+		chunkTree.push_back(node);
+		if (numOfChunks > 1)
+		{
+			BuildChunkTree(firstChunk, numOfChunks / 2);
+			uint32_t secondChild(BuildChunkTree(firstChunk + (numOfChunks / 2), numOfChunks - (numOfChunks / 2)));
+			chunkTree[index].secondChild = secondChild;
+		}
+		return index;
+	}
+
+	/**
+	 * @brief Byte offset of the primitives of a chunk inside the file
+	 * @param[in] chunk Index of the chunk
+	 */
+	size_t ChunkOffset(const size_t& chunk) const
+	{
+		return reinterpret_cast<const unsigned char*>(primitives + chunks[chunk].firstPrimitive) - file.data;
+	}
+
+	/**
+	 * @brief Size in bytes of the primitives of a chunk
+	 * @param[in] chunk Index of the chunk
+	 */
+	size_t ChunkSize(const size_t& chunk) const
+	{
+		return chunks[chunk].primitiveCount * sizeof(PackedPrimitive);
+	}
+};
+
+/**
+ * @brief Spreads the lower 10 bits of v so that there are two zero bits between each of them
+ * @param[in] v Value to spread
+ * @return Spread value
+ */
+uint32_t ExpandBits(uint32_t v)
+{
+	v = (v * 0x00010001u) & 0xFF0000FFu;
+	v = (v * 0x00000101u) & 0x0F00F00Fu;
+	v = (v * 0x00000011u) & 0xC30C30C3u;
+	v = (v * 0x00000005u) & 0x49249249u;
+	return v;
+}
+
+/**
+ * @brief Snaps a point to the 1024^3 grid that space-filling curve codes are computed on
+ * @param[in]  p             Point
+ * @param[in]  bounds        Bounds the grid is fitted to
+ * @param[out] outQuantized  Grid coordinates of the point
+ */
+void QuantizeForCurve(const glm::vec3& p, const Bounds& bounds, uint32_t outQuantized[3])
+{
+	glm::vec3 extent(bounds.max - bounds.min);
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		float normalized(extent[axis] > 0.0f ? (p[axis] - bounds.min[axis]) / extent[axis] : 0.0f);
+		outQuantized[axis] = static_cast<uint32_t>(glm::clamp(normalized * 1024.0f, 0.0f, 1023.0f));
+	}
+}
+
+/**
+ * @brief Position of a point along a 30-bit Morton (Z-order) curve through the provided bounds
+ * @param[in] p      Point
+ * @param[in] bounds Bounds the curve is fitted to
+ * @return Morton code of the point
+ */
+uint32_t MortonCode(const glm::vec3& p, const Bounds& bounds)
+{
+	uint32_t quantized[3];
+	QuantizeForCurve(p, bounds, quantized);
+	return (ExpandBits(quantized[0]) << 2) | (ExpandBits(quantized[1]) << 1) | ExpandBits(quantized[2]);
+}
+
+/**
+ * @brief Position of a point along a 30-bit Hilbert curve through the provided bounds (Skilling's transpose algorithm).
+ * Unlike the Morton curve, consecutive Hilbert codes are always neighbouring grid cells, so runs of codes are more compact.
+ * @param[in] p      Point
+ * @param[in] bounds Bounds the curve is fitted to
+ * @return Hilbert code of the point
+ */
+uint32_t HilbertCode(const glm::vec3& p, const Bounds& bounds)
+{
+	const uint32_t highestBit(1u << 9);
+	uint32_t x[3];
+	uint32_t t;
+	QuantizeForCurve(p, bounds, x);
+
+	// Inverse undo
+	for (uint32_t q = highestBit; q > 1; q >>= 1)
+	{
+		uint32_t lowerBits(q - 1);
+		for (int i = 0; i < 3; ++i)
+		{
+			if (x[i] & q)
+				x[0] ^= lowerBits;
+			else
+			{
+				t = (x[0] ^ x[i]) & lowerBits;
+				x[0] ^= t;
+				x[i] ^= t;
+			}
+		}
+	}
+
+	// Gray encode
+	x[1] ^= x[0];
+	x[2] ^= x[1];
+	t = 0;
+	for (uint32_t q = highestBit; q > 1; q >>= 1)
+	{
+		if (x[2] & q)
+			t ^= q - 1;
+	}
+	for (int i = 0; i < 3; ++i)
+		x[i] ^= t;
+
+	return (ExpandBits(x[0]) << 2) | (ExpandBits(x[1]) << 1) | ExpandBits(x[2]);
+}
+
+/**
+ * @brief Position of a point along the selected space-filling curve
+ * @param[in] curve  Curve to use (NO_CURVE falls back to the Morton curve)
+ * @param[in] p      Point
+ * @param[in] bounds Bounds the curve is fitted to
+ * @return Curve code of the point
+ */
+uint32_t CurveCode(const SpaceFillingCurve& curve, const glm::vec3& p, const Bounds& bounds)
+{
+	return (curve == HILBERT_CURVE) ? HilbertCode(p, bounds) : MortonCode(p, bounds);
+}
+
+/**
+ * @brief Position of a grid cell along a 2D Morton (Z-order) curve
+ * @param[in] x Column (16 bits)
+ * @param[in] y Row (16 bits)
+ * @return Morton code of the cell
+ */
+uint32_t MortonCode2D(const uint32_t& x, const uint32_t& y)
+{
+	uint32_t bits[2] = {x & 0xFFFFu, y & 0xFFFFu};
+	for (int i = 0; i < 2; ++i)
+	{
+		bits[i] = (bits[i] | (bits[i] << 8)) & 0x00FF00FFu;
+		bits[i] = (bits[i] | (bits[i] << 4)) & 0x0F0F0F0Fu;
+		bits[i] = (bits[i] | (bits[i] << 2)) & 0x33333333u;
+		bits[i] = (bits[i] | (bits[i] << 1)) & 0x55555555u;
+	}
+	return (bits[1] << 1) | bits[0];
+}
+
+/**
+ * @brief Position of a grid cell along a 2D Hilbert curve through an n x n grid
+ * @param[in] x Column
+ * @param[in] y Row
+ * @param[in] n Side of the grid (a power of two larger than x and y)
+ * @return Hilbert code of the cell
+ */
+uint32_t HilbertCode2D(uint32_t x, uint32_t y, const uint32_t& n)
+{
+	uint32_t code(0);
+	for (uint32_t s = n / 2; s > 0; s /= 2)
+	{
+		uint32_t rx((x & s) > 0), ry((y & s) > 0);
+		code += s * s * ((3 * rx) ^ ry);
+
+		// Rotate the quadrant so that the curve inside it starts and ends next to its neighbours
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			std::swap(x, y);
+		}
+	}
+	return code;
+}
+
+/**
+ * @brief Lists the cells of a grid in the order a curve visits them
+ * @param[in] curve  Curve to follow (NO_CURVE for scanline order)
+ * @param[in] width  Columns of the grid
+ * @param[in] height Rows of the grid
+ * @return Cell indices (row * width + column) in visiting order
+ */
+std::vector<uint32_t> GridOrder(const SpaceFillingCurve& curve, const int& width, const int& height)
+{
+	uint32_t n(1);
+	while (n < static_cast<uint32_t>(std::max(width, height)))
+		n *= 2;
+
+	std::vector<std::pair<uint32_t, uint32_t>> order;
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = 0; x < width; ++x)
+		{
+			uint32_t code((curve == NO_CURVE) ? static_cast<uint32_t>(y * width + x) : (curve == MORTON_CURVE) ? MortonCode2D(x, y) : HilbertCode2D(x, y, n));
+			order.push_back(std::make_pair(code, static_cast<uint32_t>(y * width + x)));
+		}
+	}
+	std::sort(order.begin(), order.end());
+
+	std::vector<uint32_t> cells(order.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		cells[i] = order[i].second;
+	return cells;
+}
+
+/**
+ * @brief Build options that a packed geometry file depends on, so that a file built with other ones is not reused
+ * @param[in] curve Space-filling curve that orders the primitives
+ * @return Curve (Morton for NO_CURVE) in the low byte, primitives per chunk above it
+ */
+uint64_t PackedGeometryOptions(const SpaceFillingCurve& curve)
+{
+	return static_cast<uint64_t>((curve == NO_CURVE) ? MORTON_CURVE : curve) | (static_cast<uint64_t>(OUT_OF_CORE_CHUNK_SIZE) << 8);
+}
+
+/**
+ * @brief Streams the object records of a .test file into a packed geometry file.
+ * Only the Morton keys of the primitives are kept in memory; the records themselves go through a temporary file on disk.
+ * @param[in] sceneFile    Stream positioned at the first object record
+ * @param[in] numOfObjects Number of object records
+ * @param[in] path         Path of the packed geometry file to write
+ * @param[in] curve        Space-filling curve that orders the primitives (Morton if NO_CURVE)
+ * @param[out] outTextureNames Texture files named by the records
+ * @return Whether the file could be written
+ */
+bool BuildPackedGeometry(std::istream& sceneFile, const size_t& numOfObjects, const std::string& path, const SpaceFillingCurve& curve, std::vector<std::string>& outTextureNames)
+{
+	std::string temporaryPath(path + ".tmp");
+	PackedPrimitive primitive;
+	Bounds centroidBounds;
+	MappedFile unordered;
+
+	// Neither a temporary file nor a partly written packed file may be left behind
+	auto fail = [&]()
+	{
+		unordered.Close();
+		std::remove(temporaryPath.c_str());
+		std::remove(path.c_str());
+		return false;
+	};
+
+	// Copy the non-degenerate records to an unordered temporary file, keeping only the bounds of their centers
+	std::ofstream temporaryFile(temporaryPath, std::ios::binary | std::ios::trunc);
+	size_t numOfPrimitives(0);
+	for (size_t i = 0; i < numOfObjects; ++i)
+	{
+		if (!ReadPrimitive(sceneFile, primitive, outTextureNames))
+		{
+			temporaryFile.close();
+			return fail();
+		}
+		if (IsDegenerate(primitive))
+			continue;
+		temporaryFile.write(reinterpret_cast<const char*>(&primitive), sizeof(primitive));
+		centroidBounds.Grow(primitive.GetBounds().Center());
+		++numOfPrimitives;
+	}
+	temporaryFile.close();
+	if (!temporaryFile)
+		return fail();
+
+	const PackedPrimitive* unorderedPrimitives(nullptr);
+	if (numOfPrimitives > 0)
+	{
+		if (!unordered.Open(temporaryPath))
+			return fail();
+		unorderedPrimitives = reinterpret_cast<const PackedPrimitive*>(unordered.data);
+	}
+
+	// Sort along a space-filling curve so that every chunk covers a compact region of space
+	std::vector<std::pair<uint32_t, uint64_t>> order(numOfPrimitives);
+	for (size_t i = 0; i < numOfPrimitives; ++i)
+		order[i] = std::make_pair(CurveCode(curve, unorderedPrimitives[i].GetBounds().Center(), centroidBounds), static_cast<uint64_t>(i));
+	std::sort(order.begin(), order.end());
+
+	std::vector<PackedChunk> chunks;
+	for (size_t first = 0; first < numOfPrimitives; first += OUT_OF_CORE_CHUNK_SIZE)
+	{
+		PackedChunk chunk;
+		chunk.firstPrimitive = first;
+		chunk.primitiveCount = std::min(numOfPrimitives - first, static_cast<size_t>(OUT_OF_CORE_CHUNK_SIZE));
+		for (size_t i = first; i < first + chunk.primitiveCount; ++i)
+			chunk.bounds.Grow(unorderedPrimitives[order[i].second].GetBounds());
+		chunks.push_back(chunk);
+	}
+
+	PackedGeometryHeader header;
+	std::memcpy(header.magic, PACKED_GEOMETRY_MAGIC, sizeof(PACKED_GEOMETRY_MAGIC));
+	header.buildOptions = PackedGeometryOptions(curve);
+	header.chunkCount = chunks.size();
+	header.primitiveCount = numOfPrimitives;
+
+	std::ofstream packedFile(path, std::ios::binary | std::ios::trunc);
+	packedFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	packedFile.write(reinterpret_cast<const char*>(chunks.data()), chunks.size() * sizeof(PackedChunk));
+	for (size_t i = 0; i < numOfPrimitives; ++i)
+		packedFile.write(reinterpret_cast<const char*>(&unorderedPrimitives[order[i].second]), sizeof(PackedPrimitive));
+	packedFile.close();
+	if (!packedFile)
+		return fail();
+
+	unordered.Close();
+	std::remove(temporaryPath.c_str());
+	return true;
+}
+
+// Closest hit of one ray of a batch traced against packed geometry
+struct PackedHit
+{
+	float t;													// Distance from the ray's origin to the point of intersection (if there was an intersection)
+	const PackedPrimitive* primitive; // Primitive that the ray intersected with. If this is equal to nullptr, then no intersection occured.
+	glm::vec3 intersectionPoint;			// Point where the intersection occured (if there was an intersection)
+	glm::vec3 intersectionNormal;			// Normal vector at the point of intersection (if there was an intersection)
+};
+
+/**
+ * @brief Finds the closest hit of every ray of a batch.
+ * Rays are first queued on every chunk whose bounds they cross (found through the chunk tree), then each chunk is visited once for the whole batch,
+ * so a chunk that is not resident is read from disk once per batch instead of being faulted in once per ray.
+ * @param[in]  geometry Packed geometry
+ * @param[in]  rays     Rays to cast
+ * @param[in]  rayType  Type of the rays (one of VisibilityFlags). Primitives hidden from this type are skipped.
+ * @param[out] outHits  Closest hit of each ray
+ */
+void RaycastBatch(const PackedGeometry& geometry, const std::vector<Ray>& rays, const uint32_t& rayType, std::vector<PackedHit>& outHits)
+{
+	PackedHit miss;
+	miss.t = NO_INTERSECTION;
+	miss.primitive = nullptr;
+	outHits.assign(rays.size(), miss);
+	numOfRaysCast += rays.size();
+
+	// Queue every ray on the chunks it crosses, along with the distance at which it enters them, by walking down the chunk tree
+	size_t chunkCount(static_cast<size_t>(geometry.header->chunkCount));
+	std::vector<std::vector<std::pair<uint32_t, float>>> queues(chunkCount);
+	std::vector<uint32_t> stack;
+	float entry;
+	for (size_t i = 0; i < rays.size() and !geometry.chunkTree.empty(); ++i)
+	{
+		stack.assign(1, 0);
+		while (!stack.empty())
+		{
+			uint32_t index(stack.back());
+			const ChunkTreeNode& node(geometry.chunkTree[index]);
+			stack.pop_back();
+			if (!node.bounds.Intersect(rays[i], entry))
+				continue;
+			if (node.numOfChunks == 1)
+				queues[node.firstChunk].push_back(std::make_pair(static_cast<uint32_t>(i), entry));
+			else
+			{
+				stack.push_back(node.secondChild);
+				stack.push_back(index + 1);
+			}
+		}
+	}
+
+	glm::vec3 point, normal;
+	float t;
+	size_t next(0);
+	for (size_t c = 0; c < chunkCount; c = next)
+	{
+		// Let the OS start reading the next chunk with queued rays while this one is processed
+		for (next = c + 1; next < chunkCount and queues[next].empty(); ++next)
+			;
+		if (queues[c].empty())
+			continue;
+		if (next < chunkCount)
+			geometry.file.Prefetch(geometry.ChunkOffset(next), geometry.ChunkSize(next));
+
+		const PackedPrimitive* first(geometry.primitives + geometry.chunks[c].firstPrimitive);
+		const PackedPrimitive* last(first + geometry.chunks[c].primitiveCount);
+		for (size_t q = 0; q < queues[c].size(); ++q)
+		{
+			const Ray& ray(rays[queues[c][q].first]);
+			PackedHit& hit(outHits[queues[c][q].first]);
+
+			// Skip the chunk if a closer hit was already found in another one
+			if (hit.primitive != nullptr and queues[c][q].second > hit.t)
+				continue;
+
+			for (const PackedPrimitive* primitive = first; primitive != last; ++primitive)
+			{
+				if (!(primitive->visibility & rayType))
+					continue;
+				t = primitive->Intersect(ray, point, normal);
+				if (t > 0 and (hit.primitive == nullptr or t < hit.t))
+				{
+					hit.t = t;
+					hit.primitive = primitive;
+					hit.intersectionPoint = point;
+					hit.intersectionNormal = normal;
+				}
+			}
+		}
+
+		// The whole batch is done with this chunk
+		std::vector<std::pair<uint32_t, float>>().swap(queues[c]);
+		geometry.file.Release(geometry.ChunkOffset(c), geometry.ChunkSize(c));
+	}
+}
+
+/**
+ * @brief Batched counterpart of RayTrace() for packed geometry.
+ * Primary, shadow and reflection rays are each traced as whole batches, and contributions are accumulated in the same order as RayTrace().
+ * @param[in]  geometry  Packed geometry
+ * @param[in]  scene     Scene data (only the lights are used)
+ * @param[in]  camera    Camera data
+ * @param[in]  rays      Rays to trace
+ * @param[in]  maxDepth  Maximum depth of the trace
+ * @param[in]  rayType   Type of the rays (CAMERA_VISIBLE for primary rays, REFLECTION_VISIBLE for reflected ones)
+ * @param[out] outColors Resulting color of each ray
+ */
+void RayTraceBatch(const PackedGeometry& geometry, const Scene& scene, const Camera& camera, const std::vector<Ray>& rays, const int& maxDepth, const uint32_t& rayType, std::vector<glm::vec3>& outColors)
+{
+	size_t numOfLights(scene.lights.size());
+	std::vector<PackedHit> hits;
+	RaycastBatch(geometry, rays, rayType, hits);
+
+	// SHADOWING: one shadow ray per (hit, light) pair
+	std::vector<LightSample> lightSamples(rays.size() * numOfLights);
+	std::vector<char> lit(rays.size() * numOfLights, 0);
+	std::vector<Ray> shadowRays;
+	std::vector<size_t> shadowOwners;
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		if (hits[i].primitive == nullptr)
+			continue;
+		for (size_t l = 0; l < numOfLights; ++l)
+		{
+			lightSamples[i * numOfLights + l] = SampleLight(scene.lights[l], numOfLights, hits[i].primitive->material, hits[i].intersectionPoint, hits[i].intersectionNormal, camera);
+			shadowRays.push_back(lightSamples[i * numOfLights + l].shadowRay);
+			shadowOwners.push_back(i * numOfLights + l);
+		}
+	}
+
+	std::vector<PackedHit> shadowHits;
+	RaycastBatch(geometry, shadowRays, SHADOW_VISIBLE, shadowHits);
+	for (size_t s = 0; s < shadowRays.size(); ++s)
+		lit[shadowOwners[s]] = IsLit(lightSamples[shadowOwners[s]], shadowHits[s].primitive != nullptr, shadowHits[s].intersectionPoint);
+
+	// REFLECTION: one reflection ray per hit that at least one light reaches
+	std::vector<Ray> reflectionRays;
+	std::vector<size_t> reflectionIndices(rays.size(), 0);
+	std::vector<glm::vec3> reflectionColors;
+	if (maxDepth > 1)
+	{
+		Ray reflectionRay;
+		for (size_t i = 0; i < rays.size(); ++i)
+		{
+			if (hits[i].primitive == nullptr or std::find(lit.begin() + (i * numOfLights), lit.begin() + ((i + 1) * numOfLights), 1) == lit.begin() + ((i + 1) * numOfLights))
+				continue;
+			reflectionRay.origin = hits[i].intersectionPoint + (hits[i].intersectionNormal * REFLECTION_BIAS);
+			reflectionRay.direction = glm::reflect(rays[i].direction, hits[i].intersectionNormal);
+			reflectionRay.pathLength = rays[i].pathLength + hits[i].t;
+			reflectionIndices[i] = reflectionRays.size();
+			reflectionRays.push_back(reflectionRay);
+		}
+		RayTraceBatch(geometry, scene, camera, reflectionRays, maxDepth - 1, REFLECTION_VISIBLE, reflectionColors);
+	}
+
+	outColors.assign(rays.size(), BACKGROUND_COLOR);
+	for (size_t i = 0; i < rays.size(); ++i)
+	{
+		if (hits[i].primitive == nullptr)
+			continue;
+		for (size_t l = 0; l < numOfLights; ++l)
+		{
+			outColors[i] += lightSamples[i * numOfLights + l].ambient;
+			if (lit[i * numOfLights + l])
+			{
+				outColors[i] += lightSamples[i * numOfLights + l].direct;
+				if (maxDepth > 1)
+					outColors[i] += reflectionColors[reflectionIndices[i]] * hits[i].primitive->material.shininess / REFLECTIVITY_CONSTANT;
+			}
+		}
+	}
+}
+
+// Flag that asks running renders to stop early. Render loops poll it between rows and tiles, so stopping is cooperative:
+// finished work is kept and the render returns with a partial image. Setting it is async-signal-safe.
+struct CancellationToken
+{
+	std::atomic<bool> cancelled; // Whether cancellation was requested
+
+	static_assert(std::atomic<bool>::is_always_lock_free, "cancellation must be requestable from a signal handler");
+
+	/**
+	 * @brief Constructor
+	 */
+	CancellationToken()
+		: cancelled(false)
+	{
+	}
+
+	/**
+	 * @brief Requests cancellation
+	 */
+	void Cancel()
+	{
+		cancelled.store(true, std::memory_order_relaxed);
+	}
+
+	/**
+	 * @return Whether cancellation was requested
+	 */
+	bool IsCancelled() const
+	{
+		return cancelled.load(std::memory_order_relaxed);
+	}
+};
+
+// Work counters that a render loop bumps and a ProgressReporter samples from another thread
+struct ProgressCounters
+{
+	std::atomic<uint64_t> completedWork; // Finished units of work
+	uint64_t totalWork;									 // Units of work in the whole render
+	std::atomic<uint64_t> raysCast;			 // Rays cast so far
+
+	/**
+	 * @brief Constructor
+	 * @param[in] total Units of work in the whole render
+	 */
+	explicit ProgressCounters(const uint64_t& total)
+		: completedWork(0), totalWork(total), raysCast(0)
+	{
+	}
+};
+
+/**
+ * @brief Renders the image from packed geometry, tracing OUT_OF_CORE_BATCH_ROWS rows of rays per batch, one batch per thread at a time
+ * @param[in]  geometry     Packed geometry
+ * @param[in]  scene        Scene data (only the lights are used)
+ * @param[in]  camera       Camera data
+ * @param[in]  maxDepth     Maximum depth of the trace
+ * @param[in]  antiAliasing Whether to average SAMPLES_PER_PIXEL jittered rays per pixel
+ * @param[in]  numOfThreads Number of threads to use (0 for DefaultThreadCount())
+ * @param[out] image        Rendered image
+ * @param[out] progress     Counts finished rows and cast rays
+ * @param[in]  cancellation Stops the render before the next batch when cancelled (rows not rendered yet stay black)
+ */
+void RenderOutOfCore(const PackedGeometry& geometry, const Scene& scene, const Camera& camera, const int& maxDepth, const bool& antiAliasing, const unsigned& numOfThreads,
+	Image& image, ProgressCounters& progress, const CancellationToken& cancellation)
+{
+	int samples(antiAliasing ? SAMPLES_PER_PIXEL : 1);
+	size_t numOfBatches((image.height + OUT_OF_CORE_BATCH_ROWS - 1) / OUT_OF_CORE_BATCH_ROWS);
+	ParallelFor(numOfBatches, 1, numOfThreads, [&](const size_t& batch, const size_t&) {
+		if (cancellation.IsCancelled())
+			return;
+		int firstRow(static_cast<int>(batch) * OUT_OF_CORE_BATCH_ROWS);
+		int lastRow(std::min(firstRow + OUT_OF_CORE_BATCH_ROWS, image.height));
+
+		std::vector<Ray> rays;
+		std::vector<glm::vec3> colors;
+		for (int y = firstRow; y < lastRow; ++y)
+		{
+			for (int x = 0; x < image.width; ++x)
+			{
+				Random random(PixelSeed(x, y));
+				for (int i = 0; i < samples; ++i)
+					rays.push_back(GetRayThruPixel(camera, x, image.height - y - 1, antiAliasing ? &random : nullptr));
+			}
+		}
+
+		uint64_t raysBefore(numOfRaysCast);
+		RayTraceBatch(geometry, scene, camera, rays, maxDepth, CAMERA_VISIBLE, colors);
+		progress.raysCast += numOfRaysCast - raysBefore;
+
+		size_t r(0);
+		for (int y = firstRow; y < lastRow; ++y)
+		{
+			for (int x = 0; x < image.width; ++x)
+			{
+				glm::vec3 colorSum;
+				for (int i = 0; i < samples; ++i)
+					colorSum += colors[r++];
+				if (antiAliasing)
+					colorSum /= static_cast<float>(SAMPLES_PER_PIXEL);
+				image.SetColor(x, y, colorSum);
+			}
+		}
+
+		progress.completedWork += lastRow - firstRow;
+	});
+}
+
+// Rectangle of pixels that is rendered as one unit of work
+struct Tile
+{
+	int x0; // First column
+	int y0; // First row
+	int x1; // One past the last column
+	int y1; // One past the last row
+};
+
+// Pixel formats of a shared-memory framebuffer
+enum FramebufferFormat
+{
+	FRAMEBUFFER_U8,	 // 3 bytes per pixel, same as the PNG output
+	FRAMEBUFFER_F32, // 3 floats per pixel, unclamped
+};
+
+const char SHARED_FRAMEBUFFER_MAGIC[8] = {'R', 'T', 'F', 'B', 'U', 'F', '0', '1'};
+
+// Start of a shared-memory framebuffer. It is followed by one ready flag per tile (std::atomic<uint32_t>, tiles in scanline order)
+// at flagsOffset and by the RGB pixels (top row first) at pixelsOffset.
+// A tile's flag is the number of passes committed to it; it is stored with release semantics after the tile's pixels,
+// so a viewer that sees a flag change (acquire) can read the tile right away.
+struct SharedFramebufferHeader
+{
+	char magic[8];									// SHARED_FRAMEBUFFER_MAGIC
+	uint32_t width;									// Image width
+	uint32_t height;								// Image height
+	uint32_t tileSize;							// Width and height of the tiles (tiles at the right and bottom edges may be smaller)
+	uint32_t format;								// FramebufferFormat of the pixels
+	uint32_t tilesX;								// Tiles per row
+	uint32_t tilesY;								// Tiles per column
+	uint64_t flagsOffset;						// Byte offset of the ready flags
+	uint64_t pixelsOffset;					// Byte offset of the pixels
+	std::atomic<uint32_t> finished; // Set to 1 when the render is complete, or to 2 when it was cancelled with tiles missing
+};
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) and std::atomic<uint32_t>::is_always_lock_free, "ready flags must be plain lock-free words to be shared between processes");
+
+// Named shared-memory segment that finished tiles are written into, so a viewer or compositor in another process can show them without file I/O.
+// The segment outlives the renderer on POSIX (remove it with shm_unlink); on Windows it exists while a process has it open.
+struct SharedFramebuffer
+{
+	unsigned char* data;					 // Start of the mapping (nullptr if nothing is mapped)
+	size_t size;									 // Size of the mapping in bytes
+	SharedFramebufferHeader* header; // Header at the start of the mapping
+#ifdef _WIN32
+	HANDLE mapping; // File mapping handle
+#endif
+
+	/**
+	 * @brief Constructor
+	 */
+	SharedFramebuffer()
+		: data(nullptr), size(0), header(nullptr)
+#ifdef _WIN32
+		, mapping(nullptr)
+#endif
+	{
+	}
+
+	SharedFramebuffer(const SharedFramebuffer&) = delete;
+	SharedFramebuffer& operator=(const SharedFramebuffer&) = delete;
+
+	/**
+	 * @brief Destructor. Unmaps the segment but leaves it for viewers.
+	 */
+	~SharedFramebuffer()
+	{
+		Close();
+	}
+
+	/**
+	 * @brief Creates (or recreates) the named segment and initializes its header. All flags and pixels start at 0.
+	 * @param[in] name   Name of the segment ("/name" on POSIX; a leading '/' is added if missing)
+	 * @param[in] width  Image width
+	 * @param[in] height Image height
+	 * @param[in] format Pixel format
+	 * @return Whether the segment could be created
+	 */
+	bool Create(const std::string& name, const int& width, const int& height, const FramebufferFormat& format)
+	{
+		Close();
+		uint32_t tilesX((width + TILE_SIZE - 1) / TILE_SIZE), tilesY((height + TILE_SIZE - 1) / TILE_SIZE);
+		size_t flagsOffset(sizeof(SharedFramebufferHeader));
+		size_t pixelsOffset(((flagsOffset + (static_cast<size_t>(tilesX) * tilesY * sizeof(uint32_t))) + 15) & ~static_cast<size_t>(15));
+		size = pixelsOffset + (static_cast<size_t>(width) * height * 3 * ((format == FRAMEBUFFER_F32) ? sizeof(float) : 1));
+
+#ifdef _WIN32
+		mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(static_cast<uint64_t>(size) >> 32), static_cast<DWORD>(size), name.c_str());
+		void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : nullptr;
+		if (view == nullptr)
+		{
+			Close();
+			return false;
+		}
+		std::memset(view, 0, size);
+#else
+		// A fresh segment is zero-filled, so stale flags of an earlier render are never seen
+		std::string posixName((name.empty() or name[0] != '/') ? "/" + name : name);
+		shm_unlink(posixName.c_str());
+		int descriptor(shm_open(posixName.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644));
+		if (descriptor < 0)
+			return false;
+		void* view = (ftruncate(descriptor, static_cast<off_t>(size)) == 0) ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+		close(descriptor);
+		if (view == MAP_FAILED)
+		{
+			shm_unlink(posixName.c_str());
+			size = 0;
+			return false;
+		}
+#endif
+		data = static_cast<unsigned char*>(view);
+		header = new (data) SharedFramebufferHeader;
+		std::memcpy(header->magic, SHARED_FRAMEBUFFER_MAGIC, sizeof(SHARED_FRAMEBUFFER_MAGIC));
+		header->width = width;
+		header->height = height;
+		header->tileSize = TILE_SIZE;
+		header->format = format;
+		header->tilesX = tilesX;
+		header->tilesY = tilesY;
+		header->flagsOffset = flagsOffset;
+		header->pixelsOffset = pixelsOffset;
+		header->finished.store(0);
+		for (size_t i = 0; i < static_cast<size_t>(tilesX) * tilesY; ++i)
+			new (Flags() + i) std::atomic<uint32_t>(0);
+		return true;
+	}
+
+	/**
+	 * @return Ready flags of the tiles
+	 */
+	std::atomic<uint32_t>* Flags() const
+	{
+		return reinterpret_cast<std::atomic<uint32_t>*>(data + header->flagsOffset);
+	}
+
+	/**
+	 * @brief Copies a finished tile into the segment and then publishes it through its ready flag
+	 * @param[in] tileIndex Index of the tile in scanline order
+	 * @param[in] tile      Pixels covered by the tile
+	 * @param[in] image     Image the tile was committed to (source of FRAMEBUFFER_U8 pixels)
+	 * @param[in] colors    Tile's colors in scanline order within the tile (source of FRAMEBUFFER_F32 pixels; nullptr to convert from the image)
+	 * @param[in] passes    Number of passes committed to the tile
+	 */
+	void WriteTile(const size_t& tileIndex, const Tile& tile, const Image& image, const glm::vec3* colors, const uint32_t& passes)
+	{
+		size_t i(0);
+		for (int y = tile.y0; y < tile.y1; ++y)
+		{
+			size_t first((static_cast<size_t>(y) * image.width + tile.x0) * 3);
+			size_t count(static_cast<size_t>(tile.x1 - tile.x0) * 3);
+			if (header->format == FRAMEBUFFER_U8)
+			{
+				std::memcpy(data + header->pixelsOffset + first, image.data.data() + first, count);
+				continue;
+			}
+
+			float* pixels(reinterpret_cast<float*>(data + header->pixelsOffset) + first);
+			for (size_t c = 0; c < count; c += 3, ++i)
+			{
+				glm::vec3 color((colors != nullptr) ? colors[i] : glm::vec3(image.data[first + c], image.data[first + c + 1], image.data[first + c + 2]) / 255.0f);
+				pixels[c] = color.r;
+				pixels[c + 1] = color.g;
+				pixels[c + 2] = color.b;
+			}
+		}
+		Flags()[tileIndex].store(passes, std::memory_order_release);
+	}
+
+	/**
+	 * @brief Unmaps the segment (if one is mapped)
+	 */
+	void Close()
+	{
+#ifdef _WIN32
+		if (data != nullptr)
+			UnmapViewOfFile(data);
+		if (mapping != nullptr)
+			CloseHandle(mapping);
+		mapping = nullptr;
+#else
+		if (data != nullptr)
+			munmap(data, size);
+#endif
+		data = nullptr;
+		header = nullptr;
+		size = 0;
+	}
+};
+
+// One scene render, split into tiles that the workers of a RenderScheduler pick up
+struct RenderJob
+{
+	std::string name;						// Scene file name, used in progress output
+	std::string outputFileName; // Image file the render is written to
+	int priority;								// Jobs with a higher priority get workers first
+	Scene scene;								// Scene data
+	Camera camera;							// Camera data
+	int maxDepth;								// Maximum depth of the trace
+	bool antiAliasing;					// Whether to average SAMPLES_PER_PIXEL jittered rays per pixel
+	bool multisampling;					// Whether anti-aliasing shades every object hit by a pixel's samples once instead of every sample
+	int shadingRate;						// Width and height of the pixel blocks that variable-rate shading shades once when they are smooth (1 shades every pixel)
+	float shadingThreshold;			// Largest difference within a block that variable-rate shading still interpolates across
+	uint64_t numOfInterpolated; // Pixels whose color was interpolated by variable-rate shading (guarded by the scheduler's mutex)
+	PlanarMirrors mirrors;			// Planar mirrors whose reflections are traced in packets (none unless enabled)
+	Image image;								// Rendered image
+	SharedFramebuffer* framebuffer; // Shared-memory framebuffer that finished tiles are also written to (nullptr if none)
+	const CancellationToken* cancellation; // Stops the job after the tiles in flight when cancelled (nullptr if the job can't be cancelled)
+
+	std::vector<Tile> tiles;						// Tiles in scanline order
+	SpaceFillingCurve traversal;				// Curve that tiles are handed out along and that pixels are rendered along within a tile
+	std::vector<uint32_t> tileOrder;		// Indices of the tiles in the order they are handed out
+	std::vector<uint32_t> pixelOrder;		// Pixels of a TILE_SIZE x TILE_SIZE tile (row * TILE_SIZE + column) in the order they are rendered
+	size_t nextTile;										// Position in tileOrder of the next tile of the current pass to hand out (guarded by the scheduler's mutex)
+	size_t sequence;										// Submission order, breaks ties between equal priorities
+	std::atomic<size_t> completedTiles; // Number of tiles of the current pass that are fully rendered
+	std::atomic<uint64_t> raysCast;			// Rays cast for this job so far
+	uint64_t sourceHash;								// Hash of the scene file's contents and the camera, checked when resuming (0 unless checkpoints are written)
+
+	// --- Progressive rendering ---
+	bool progressive;														 // Whether the job refines the image pass after pass (until its deadline or until it converges)
+	bool hasDeadline;														 // Whether refinement stops at the deadline
+	std::chrono::steady_clock::time_point deadline; // Time at which refinement stops
+	float targetError;													 // Estimated error below which a tile gets no more samples (0 to sample every tile)
+	int pass;																		 // Current pass: 0 = preview without reflections, 1 = full depth, 2+ = one more jittered sample
+	std::vector<glm::vec3> accumulation;				 // Sum of the samples of each pixel (passes 1+)
+	std::vector<float> squareAccumulation;			 // Sum of the squared luminances of the samples of each pixel (passes 1+)
+
+	std::vector<int32_t> tilePasses; // Number of passes committed to each tile (guarded by the scheduler's mutex)
+	std::vector<float> tileErrors;	 // Estimated error of the mean of each tile's pixels (FLT_MAX until it has two samples)
+
+	/**
+	 * @brief Constructor
+	 */
+	RenderJob()
+		: priority(0), maxDepth(1), antiAliasing(false), multisampling(false), shadingRate(1), shadingThreshold(DEFAULT_SHADING_THRESHOLD), numOfInterpolated(0), framebuffer(nullptr), cancellation(nullptr), traversal(NO_CURVE), nextTile(0), sequence(0), completedTiles(0), raysCast(0), sourceHash(0), progressive(false), hasDeadline(false), targetError(0.0f), pass(0)
+	{
+	}
+
+	/**
+	 * @brief Switches the job to time-budgeted rendering
+	 * @param[in] budget Time from now until the image has to be ready
+	 */
+	void SetTimeBudget(const std::chrono::steady_clock::duration& budget)
+	{
+		progressive = true;
+		hasDeadline = true;
+		deadline = std::chrono::steady_clock::now() + budget;
+	}
+
+	/**
+	 * @brief Switches the job to progressive rendering that stops sampling a tile once its estimated error is low enough
+	 * @param[in] error Target error of the tiles' pixel means
+	 */
+	void SetTargetError(const float& error)
+	{
+		progressive = true;
+		targetError = error;
+	}
+
+	/**
+	 * @return Whether the deadline has passed while refining. The first pass always completes, so that the image has no holes.
+	 */
+	bool IsOutOfTime() const
+	{
+		return hasDeadline and pass > 0 and std::chrono::steady_clock::now() >= deadline;
+	}
+
+	/**
+	 * @return Whether the job was cancelled. Unlike running out of time, this also cuts the first pass short.
+	 */
+	bool IsCancelled() const
+	{
+		return cancellation != nullptr and cancellation->IsCancelled();
+	}
+
+	/**
+	 * @return Whether a tile has enough samples for its error estimate and the estimate is below the target
+	 */
+	bool IsTileConverged(const size_t& tileIndex) const
+	{
+		return targetError > 0.0f and tilePasses[tileIndex] > MIN_CONVERGENCE_SAMPLES and tileErrors[tileIndex] <= targetError;
+	}
+
+	/**
+	 * @return Whether a tile is rendered in the current pass or needs no more samples
+	 */
+	bool IsTileDone(const size_t& tileIndex) const
+	{
+		return tilePasses[tileIndex] > pass or IsTileConverged(tileIndex);
+	}
+
+	/**
+	 * @brief Skips tiles of the current pass that are already rendered (restored from a checkpoint). Must be called with the scheduler's mutex held.
+	 * @return Whether a tile is left to hand out
+	 */
+	bool HasTilesLeft()
+	{
+		while (nextTile < tiles.size() and IsTileDone(tileOrder[nextTile]))
+			++nextTile;
+		return nextTile < tiles.size();
+	}
+
+	/**
+	 * @brief Stops handing out tiles of the current pass and counts the remaining ones as done. Must be called with the scheduler's mutex held.
+	 */
+	void SkipRemainingTiles()
+	{
+		for (; nextTile < tiles.size(); ++nextTile)
+		{
+			if (!IsTileDone(tileOrder[nextTile]))
+				++completedTiles;
+		}
+	}
+
+	/**
+	 * @brief Moves on to the next refinement pass once every tile of the current one is rendered. Must be called with the scheduler's mutex held.
+	 * @return Whether there is a next pass (false when the job is done)
+	 */
+	bool StartNextPass()
+	{
+		// Pass N >= 1 leaves N samples in every pixel that is not converged
+		if (!progressive or pass >= MAX_REFINEMENT_SAMPLES or (hasDeadline and std::chrono::steady_clock::now() >= deadline) or IsCancelled())
+			return false;
+
+		size_t numOfConverged(0);
+		for (size_t i = 0; i < tiles.size(); ++i)
+		{
+			if (IsTileConverged(i))
+				++numOfConverged;
+		}
+		if (numOfConverged == tiles.size())
+			return false;
+
+		++pass;
+		nextTile = 0;
+		completedTiles = numOfConverged;
+		return true;
+	}
+
+	/**
+	 * @brief Destructor
+	 */
+	~RenderJob()
+	{
+		for (size_t i = 0; i < scene.objects.size(); ++i)
+		{
+			delete scene.objects[i];
+		}
+		for (size_t i = 0; i < scene.meshes.size(); ++i)
+		{
+			delete scene.meshes[i];
+		}
+	}
+
+	/**
+	 * @brief Creates the image, splits it into TILE_SIZE x TILE_SIZE tiles in scanline order and orders the tiles and their pixels along the traversal curve
+	 */
+	void CreateTiles()
+	{
+		image = Image(camera.imageWidth, camera.imageHeight);
+		if (progressive)
+		{
+			accumulation.assign(image.width * image.height, glm::vec3());
+			squareAccumulation.assign(image.width * image.height, 0.0f);
+		}
+		tiles.clear();
+		for (int y = 0; y < image.height; y += TILE_SIZE)
+		{
+			for (int x = 0; x < image.width; x += TILE_SIZE)
+			{
+				Tile tile = {x, y, std::min(x + TILE_SIZE, image.width), std::min(y + TILE_SIZE, image.height)};
+				tiles.push_back(tile);
+			}
+		}
+		tilePasses.assign(tiles.size(), 0);
+		tileErrors.assign(tiles.size(), FLT_MAX);
+		tileOrder = GridOrder(traversal, (image.width + TILE_SIZE - 1) / TILE_SIZE, (image.height + TILE_SIZE - 1) / TILE_SIZE);
+		pixelOrder = GridOrder(traversal, TILE_SIZE, TILE_SIZE);
+	}
+
+	/**
+	 * @return Whether every tile is rendered
+	 */
+	bool IsFinished() const
+	{
+		return completedTiles.load() == tiles.size();
+	}
+
+	/**
+	 * @return Rendered fraction of the image in percent
+	 */
+	int PercentDone() const
+	{
+		return tiles.empty() ? 100 : static_cast<int>((100 * completedTiles.load()) / tiles.size());
+	}
+};
+
+/**
+ * @brief Computes the anti-aliased color of one pixel, multisampled: visibility is sampled with the same SAMPLES_PER_PIXEL jittered rays
+ * as supersampling, but every object the samples hit is shaded once, at the centroid of its samples, and weighted by their number.
+ * Shadow and reflection rays are therefore only cast once per object, so pixels inside an object cost about as much as without anti-aliasing.
+ * @param[in] job Render job
+ * @param[in] x   X-coordinate of the pixel in the image
+ * @param[in] y   Y-coordinate of the pixel in the image (0 is the top row)
+ * @return Pixel color
+ */
+glm::vec3 MultisamplePixel(const RenderJob& job, const int& x, const int& y)
+{
+	int pixelY(job.image.height - y - 1);
+	Random random(PixelSeed(x, y));
+	IntersectionInfo hits[SAMPLES_PER_PIXEL];
+	for (int i = 0; i < SAMPLES_PER_PIXEL; ++i)
+		hits[i] = Raycast(GetRayThruPixel(job.camera, x, pixelY, &random), job.scene);
+
+	glm::vec3 colorSum;
+	bool shaded[SAMPLES_PER_PIXEL] = {};
+	for (int i = 0; i < SAMPLES_PER_PIXEL; ++i)
+	{
+		if (shaded[i])
+			continue;
+		if (hits[i].obj == nullptr)
+		{
+			colorSum += BACKGROUND_COLOR;
+			continue;
+		}
+
+		// Later samples that hit the same object are covered by this one's shading
+		glm::vec3 directionSum(hits[i].incomingRay.direction);
+		int numOfSamples(1);
+		for (int j = i + 1; j < SAMPLES_PER_PIXEL; ++j)
+		{
+			if (hits[j].obj != hits[i].obj)
+				continue;
+			directionSum += hits[j].incomingRay.direction;
+			shaded[j] = true;
+			++numOfSamples;
+		}
+
+		// The centroid ray hits the object too when it is convex (spheres, triangles); otherwise the first sample is shaded
+		IntersectionInfo centroid(hits[i]);
+		if (numOfSamples > 1)
+		{
+			Ray centroidRay(hits[i].incomingRay);
+			centroidRay.direction = glm::normalize(directionSum);
+			glm::vec3 point, normal;
+			if (hits[i].obj->Intersect(centroidRay, point, normal) > 0.0f)
+			{
+				centroid.incomingRay = centroidRay;
+				centroid.intersectionPoint = point;
+				centroid.intersectionNormal = normal;
+			}
+		}
+		colorSum += Shade(centroid, job.scene, job.camera, job.maxDepth) * static_cast<float>(numOfSamples);
+	}
+	return colorSum / static_cast<float>(SAMPLES_PER_PIXEL);
+}
+
+/**
+ * @brief Computes the color of one pixel
+ * @param[in] job Render job
+ * @param[in] x   X-coordinate of the pixel in the image
+ * @param[in] y   Y-coordinate of the pixel in the image (0 is the top row)
+ * @return Pixel color
+ */
+glm::vec3 RenderPixel(const RenderJob& job, const int& x, const int& y)
+{
+	int pixelY(job.image.height - y - 1);
+
+	// ANTI-ALIASING
+	if (job.antiAliasing and job.multisampling)
+		return MultisamplePixel(job, x, y);
+	if (job.antiAliasing)
+	{
+		Random random(PixelSeed(x, y));
+		glm::vec3 colorSum;
+		for (int i = 0; i < SAMPLES_PER_PIXEL; ++i)
+		{
+			Ray ray = GetRayThruPixel(job.camera, x, pixelY, &random);
+			colorSum += RayTrace(ray, job.scene, job.camera, job.maxDepth);
+		}
+		colorSum /= static_cast<float>(SAMPLES_PER_PIXEL);
+		return colorSum;
+	}
+
+	Ray ray(GetRayThruPixel(job.camera, x, pixelY));
+	return RayTrace(ray, job.scene, job.camera, job.maxDepth);
+}
+
+/**
+ * @brief Computes the luminance of a color, which convergence is measured on
+ * @param[in] color Linear RGB color
+ * @return Rec. 709 luminance
+ */
+float Luminance(const glm::vec3& color)
+{
+	return (0.2126f * color.r) + (0.7152f * color.g) + (0.0722f * color.b);
+}
+
+/**
+ * @brief Renders one pixel of the job's current refinement pass.
+ * Pass 0 is a preview without reflections, pass 1 replaces it with a full-depth sample through the pixel center,
+ * and every later pass adds one jittered sample to the pixel's average. The jitter only depends on the pixel and the pass,
+ * so a pass that is rendered again (e.g. after resuming from a checkpoint) gives the same result.
+ * @param[in]  job          Progressive render job
+ * @param[in]  x            X-coordinate of the pixel in the image
+ * @param[in]  y            Y-coordinate of the pixel in the image (0 is the top row)
+ * @param[out] outSum       Sum of the pixel's samples after this pass (passes 1+)
+ * @param[out] outSquareSum Sum of the squared luminances of the pixel's samples after this pass (passes 1+)
+ * @return Pixel color
+ */
+glm::vec3 RefinePixel(const RenderJob& job, const int& x, const int& y, glm::vec3& outSum, float& outSquareSum)
+{
+	size_t index(static_cast<size_t>(y) * job.image.width + x);
+	int pixelY(job.image.height - y - 1);
+
+	if (job.pass == 0)
+		return RayTrace(GetRayThruPixel(job.camera, x, pixelY), job.scene, job.camera, 1);
+
+	glm::vec3 sample;
+	if (job.pass == 1)
+		sample = RayTrace(GetRayThruPixel(job.camera, x, pixelY), job.scene, job.camera, job.maxDepth);
+	else
+	{
+		Random random(PixelSeed(x, y) ^ (static_cast<uint64_t>(job.pass) * 0x9E3779B97F4A7C15ull));
+		sample = RayTrace(GetRayThruPixel(job.camera, x, pixelY, &random), job.scene, job.camera, job.maxDepth);
+	}
+
+	float luminance(Luminance(sample));
+	outSum = (job.pass == 1) ? sample : job.accumulation[index] + sample;
+	outSquareSum = ((job.pass == 1) ? 0.0f : job.squareAccumulation[index]) + (luminance * luminance);
+	return outSum / static_cast<float>(job.pass);
+}
+
+// Pixels of a tile rendered by a worker. They are committed to the job all at once, so the job's buffers only ever hold whole tiles.
+struct TileResult
+{
+	std::vector<glm::vec3> colors;			 // Pixel colors in scanline order within the tile
+	std::vector<glm::vec3> accumulation; // Sums of the samples of progressive jobs, in the same order
+	std::vector<float> squareAccumulation; // Sums of the squared luminances of the samples of progressive jobs, in the same order
+	float error;												 // Estimated error of the tile's pixel means (FLT_MAX with fewer than two samples)
+	size_t numOfInterpolated;						 // Pixels whose color was interpolated by variable-rate shading
+};
+
+/**
+ * @brief Decides whether variable-rate shading may interpolate between two primary hits
+ * @param[in] a         First hit
+ * @param[in] b         Second hit
+ * @param[in] maxDepth  Maximum depth of the trace
+ * @param[in] threshold Largest normal (1 - cos), relative depth and reflectivity difference that is still smooth
+ * @return Whether both hit the same object at nearly the same orientation and depth, on a surface whose reflections don't matter
+ */
+bool IsSmoothShading(const IntersectionInfo& a, const IntersectionInfo& b, const int& maxDepth, const float& threshold)
+{
+	if (a.obj != b.obj)
+		return false;
+	if (a.obj == nullptr)
+		return true;
+	return 1.0f - glm::dot(a.intersectionNormal, b.intersectionNormal) <= threshold
+		and std::abs(a.t - b.t) <= threshold * std::max(a.t, b.t)
+		and (maxDepth <= 1 or a.obj->material.shininess / REFLECTIVITY_CONSTANT <= threshold);
+}
+
+/**
+ * @brief Renders a tile with variable-rate shading. Every pixel center is raycast first (visibility is cheap); then the pixels at the corners
+ * of job.shadingRate x job.shadingRate blocks are shaded, and blocks whose pixels all hit the same surface smoothly and whose corner colors
+ * agree are filled by bilinear interpolation. Every other block (edges, reflective surfaces, shadow boundaries) is rendered pixel by pixel.
+ * Blocks are visited in scanline order.
+ * @param[in]  job       Render job (not progressive)
+ * @param[in]  tile      Tile to render
+ * @param[out] outResult Rendered pixels
+ * @return Whether the tile was finished (false if the job was cancelled, in which case the result must be dropped)
+ */
+bool RenderTileVariableRate(const RenderJob& job, const Tile& tile, TileResult& outResult)
+{
+	int rate(job.shadingRate);
+	int tileWidth(tile.x1 - tile.x0), tileHeight(tile.y1 - tile.y0);
+	int blocksX((tileWidth + rate - 1) / rate), blocksY((tileHeight + rate - 1) / rate);
+
+	// Corners of the blocks, one more than the blocks in each direction; the last ones lie in the next tile or at the image edge
+	int latticeWidth(blocksX + 1), latticeHeight(blocksY + 1);
+	std::vector<IntersectionInfo> latticeHits(static_cast<size_t>(latticeWidth) * latticeHeight);
+	std::vector<glm::vec3> latticeColors(latticeHits.size());
+	std::vector<bool> latticeShaded(latticeHits.size(), false);
+	auto latticeX = [&](const int& i) { return std::min(tile.x0 + i * rate, job.image.width - 1); };
+	auto latticeY = [&](const int& j) { return std::min(tile.y0 + j * rate, job.image.height - 1); };
+	auto centerRay = [&](const int& x, const int& y) { return GetRayThruPixel(job.camera, x, job.image.height - y - 1); };
+	for (int j = 0; j < latticeHeight; ++j)
+	{
+		for (int i = 0; i < latticeWidth; ++i)
+			latticeHits[static_cast<size_t>(j) * latticeWidth + i] = Raycast(centerRay(latticeX(i), latticeY(j)), job.scene);
+	}
+	auto latticeColor = [&](const int& i, const int& j) {
+		size_t index(static_cast<size_t>(j) * latticeWidth + i);
+		if (!latticeShaded[index])
+		{
+			latticeColors[index] = (latticeHits[index].obj != nullptr) ? Shade(latticeHits[index], job.scene, job.camera, job.maxDepth) : BACKGROUND_COLOR;
+			latticeShaded[index] = true;
+		}
+		return latticeColors[index];
+	};
+
+	std::vector<IntersectionInfo> hits(static_cast<size_t>(rate) * rate);
+	outResult.numOfInterpolated = 0;
+	for (int by = 0; by < blocksY; ++by)
+	{
+		if (job.IsCancelled())
+			return false;
+
+		for (int bx = 0; bx < blocksX; ++bx)
+		{
+			int x0(tile.x0 + bx * rate), y0(tile.y0 + by * rate);
+			int x1(std::min(x0 + rate, tile.x1)), y1(std::min(y0 + rate, tile.y1));
+			const IntersectionInfo* corners[4] = {
+				&latticeHits[static_cast<size_t>(by) * latticeWidth + bx], &latticeHits[static_cast<size_t>(by) * latticeWidth + bx + 1],
+				&latticeHits[static_cast<size_t>(by + 1) * latticeWidth + bx], &latticeHits[static_cast<size_t>(by + 1) * latticeWidth + bx + 1]};
+
+			// Primary visibility of every pixel of the block (the top-left one is a lattice point)
+			bool smooth(true);
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					IntersectionInfo& hit(hits[static_cast<size_t>(y - y0) * rate + (x - x0)]);
+					hit = (x == x0 and y == y0) ? *corners[0] : Raycast(centerRay(x, y), job.scene);
+					smooth = smooth and IsSmoothShading(*corners[0], hit, job.maxDepth, job.shadingThreshold);
+				}
+			}
+			for (int c = 1; c < 4 and smooth; ++c)
+				smooth = IsSmoothShading(*corners[0], *corners[c], job.maxDepth, job.shadingThreshold);
+
+			glm::vec3 colors[4];
+			if (smooth)
+			{
+				colors[0] = latticeColor(bx, by);
+				colors[1] = latticeColor(bx + 1, by);
+				colors[2] = latticeColor(bx, by + 1);
+				colors[3] = latticeColor(bx + 1, by + 1);
+				for (int c = 1; c < 4 and smooth; ++c)
+				{
+					glm::vec3 difference(glm::abs(colors[c] - colors[0]));
+					smooth = std::max(difference.r, std::max(difference.g, difference.b)) <= job.shadingThreshold;
+				}
+			}
+
+			float spanX(static_cast<float>(latticeX(bx + 1) - latticeX(bx))), spanY(static_cast<float>(latticeY(by + 1) - latticeY(by)));
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					glm::vec3& color(outResult.colors[static_cast<size_t>(y - tile.y0) * tileWidth + (x - tile.x0)]);
+					const IntersectionInfo& hit(hits[static_cast<size_t>(y - y0) * rate + (x - x0)]);
+					if (smooth)
+					{
+						float u((spanX > 0.0f) ? (x - x0) / spanX : 0.0f), v((spanY > 0.0f) ? (y - y0) / spanY : 0.0f);
+						color = glm::mix(glm::mix(colors[0], colors[1], u), glm::mix(colors[2], colors[3], u), v);
+						++outResult.numOfInterpolated;
+					}
+					else if (job.antiAliasing)
+						color = RenderPixel(job, x, y);
+					else
+						color = (hit.obj != nullptr) ? Shade(hit, job.scene, job.camera, job.maxDepth) : BACKGROUND_COLOR;
+				}
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Renders a tile whose reflections off planar mirrors are traced in packets. The primary rays and the shadow rays of the mirror hits
+ * are cast first; the reflection rays of all lit pixels that see the same mirror plane are then cast together, object by object, against
+ * only the objects that the mirrored virtual camera can see through the pixels' part of the mirror. Everything else is traced as usual,
+ * so the image is the same as RenderPixel()'s.
+ * @param[in]  job       Render job (not progressive, without anti-aliasing)
+ * @param[in]  tile      Tile to render
+ * @param[out] outResult Rendered pixels
+ * @return Whether the tile was finished (false if the job was cancelled, in which case the result must be dropped)
+ */
+bool RenderTileMirrorPackets(const RenderJob& job, const Tile& tile, TileResult& outResult)
+{
+	int tileWidth(tile.x1 - tile.x0);
+	std::vector<IntersectionInfo> hits(outResult.colors.size());
+	std::vector<std::vector<size_t>> packets(job.mirrors.planes.size()); // Lit pixels (indices in hits) that see each mirror plane
+	std::vector<std::vector<bool>> litLights(hits.size());						 // Lights that reach each pixel that sees a mirror (empty for other pixels)
+	for (size_t k = 0; k < job.pixelOrder.size(); ++k)
+	{
+		if (k % TILE_SIZE == 0 and job.IsCancelled())
+			return false;
+
+		int dx(job.pixelOrder[k] % TILE_SIZE), dy(job.pixelOrder[k] / TILE_SIZE);
+		int x(tile.x0 + dx), y(tile.y0 + dy);
+		if (x >= tile.x1 or y >= tile.y1)
+			continue;
+
+		size_t i(static_cast<size_t>(dy) * tileWidth + dx);
+		hits[i] = Raycast(GetRayThruPixel(job.camera, x, job.image.height - y - 1), job.scene);
+		std::map<const SceneObject*, size_t>::const_iterator mirror(job.mirrors.planeOfMirror.find(hits[i].obj));
+		// Shade() only reflects at points that some light reaches, so unlit mirror pixels stay out of the packets
+		if (hits[i].obj != nullptr and job.maxDepth > 1 and mirror != job.mirrors.planeOfMirror.end()
+			and FindLitLights(hits[i], job.scene, job.camera, litLights[i]))
+			packets[mirror->second].push_back(i);
+	}
+
+	std::vector<glm::vec3> reflectionColors(hits.size());
+	std::vector<Ray> rays;
+	std::vector<uint32_t> objects;
+	std::vector<IntersectionInfo> reflectionHits;
+	for (size_t p = 0; p < packets.size(); ++p)
+	{
+		if (packets[p].empty())
+			continue;
+		rays.resize(packets[p].size());
+		for (size_t j = 0; j < packets[p].size(); ++j)
+			rays[j] = GetReflectionRay(hits[packets[p][j]]);
+		CullForMirrorPacket(job.mirrors, job.mirrors.planes[p], job.camera, rays, objects);
+		RaycastPacket(rays, job.scene, objects, REFLECTION_VISIBLE, reflectionHits);
+		for (size_t j = 0; j < packets[p].size(); ++j)
+			reflectionColors[packets[p][j]] = (reflectionHits[j].obj != nullptr) ? Shade(reflectionHits[j], job.scene, job.camera, job.maxDepth - 1) : BACKGROUND_COLOR;
+	}
+
+	std::vector<bool> traced(hits.size(), false);
+	for (size_t p = 0; p < packets.size(); ++p)
+	{
+		for (size_t j = 0; j < packets[p].size(); ++j)
+			traced[packets[p][j]] = true;
+	}
+	for (size_t i = 0; i < hits.size(); ++i)
+	{
+		if (hits[i].obj == nullptr)
+			outResult.colors[i] = BACKGROUND_COLOR;
+		else
+			outResult.colors[i] = Shade(hits[i], job.scene, job.camera, job.maxDepth, traced[i] ? &reflectionColors[i] : nullptr, litLights[i].empty() ? nullptr : &litLights[i]);
+	}
+	return true;
+}
+
+/**
+ * @brief Renders every pixel of a tile
+ * @param[in]  job       Render job
+ * @param[in]  tile      Tile to render
+ * @param[out] outResult Rendered pixels
+ * @return Whether the tile was finished (false if refinement ran out of time or the job was cancelled, in which case the result must be dropped)
+ */
+bool RenderTile(const RenderJob& job, const Tile& tile, TileResult& outResult)
+{
+	size_t numOfPixels(static_cast<size_t>(tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+	outResult.colors.resize(numOfPixels);
+	outResult.accumulation.resize(job.progressive ? numOfPixels : 0);
+	outResult.squareAccumulation.resize(job.progressive ? numOfPixels : 0);
+	outResult.error = FLT_MAX;
+	outResult.numOfInterpolated = 0;
+	if (job.shadingRate > 1 and !job.progressive)
+		return RenderTileVariableRate(job, tile, outResult);
+	if (!job.mirrors.planes.empty() and !job.progressive and !job.antiAliasing)
+		return RenderTileMirrorPackets(job, tile, outResult);
+
+	int tileWidth(tile.x1 - tile.x0);
+	for (size_t k = 0; k < job.pixelOrder.size(); ++k)
+	{
+		// Refinement stops right at the deadline: every pixel already holds the result of an earlier pass.
+		// Cancellation stops rendering within a row's worth of pixels, whatever the pass.
+		if (k % TILE_SIZE == 0 and (job.IsOutOfTime() or job.IsCancelled()))
+			return false;
+
+		// Tiles at the right and bottom edges are smaller than TILE_SIZE x TILE_SIZE
+		int dx(job.pixelOrder[k] % TILE_SIZE), dy(job.pixelOrder[k] / TILE_SIZE);
+		int x(tile.x0 + dx), y(tile.y0 + dy);
+		if (x >= tile.x1 or y >= tile.y1)
+			continue;
+
+		size_t i(static_cast<size_t>(dy) * tileWidth + dx);
+		if (job.progressive)
+			outResult.colors[i] = RefinePixel(job, x, y, outResult.accumulation[i], outResult.squareAccumulation[i]);
+		else
+			outResult.colors[i] = RenderPixel(job, x, y);
+	}
+
+	// Root mean square over the tile of the standard error of each pixel's mean luminance, from the sample variance
+	if (job.progressive and job.pass >= 2)
+	{
+		float n(static_cast<float>(job.pass)), squaredErrorSum(0.0f);
+		for (size_t j = 0; j < numOfPixels; ++j)
+		{
+			float mean(Luminance(outResult.accumulation[j]) / n);
+			float variance(std::max(0.0f, (outResult.squareAccumulation[j] - (n * mean * mean)) / (n - 1.0f)));
+			squaredErrorSum += variance / n;
+		}
+		outResult.error = std::sqrt(squaredErrorSum / static_cast<float>(numOfPixels));
+	}
+	return true;
+}
+
+/**
+ * @brief Writes a finished tile into the job's image (and sample sums) and marks it rendered in the current pass.
+ * Must be called with the scheduler's mutex held.
+ * @param[in,out] job       Render job
+ * @param[in]     tileIndex Index of the tile in job.tiles
+ * @param[in]     result    Rendered pixels
+ */
+void CommitTile(RenderJob& job, const size_t& tileIndex, const TileResult& result)
+{
+	const Tile& tile(job.tiles[tileIndex]);
+	size_t i(0);
+	for (int y = tile.y0; y < tile.y1; ++y)
+	{
+		for (int x = tile.x0; x < tile.x1; ++x, ++i)
+		{
+			job.image.SetColor(x, y, result.colors[i]);
+			if (job.progressive and job.pass > 0)
+			{
+				job.accumulation[static_cast<size_t>(y) * job.image.width + x] = result.accumulation[i];
+				job.squareAccumulation[static_cast<size_t>(y) * job.image.width + x] = result.squareAccumulation[i];
+			}
+		}
+	}
+	job.tilePasses[tileIndex] = job.pass + 1;
+	job.tileErrors[tileIndex] = result.error;
+	job.numOfInterpolated += result.numOfInterpolated;
+	if (job.framebuffer != nullptr)
+		job.framebuffer->WriteTile(tileIndex, tile, job.image, result.colors.data(), job.tilePasses[tileIndex]);
+}
+
+// Pixels that a preview render shades; the rest of the image is reconstructed from them
+enum PreviewMode
+{
+	PREVIEW_NONE,					// Full render
+	PREVIEW_QUARTER,			// Every second pixel in both directions (1/4 of the pixels)
+	PREVIEW_SIXTEENTH,		// Every fourth pixel in both directions (1/16 of the pixels)
+	PREVIEW_CHECKERBOARD, // Pixels with an even x + y (1/2 of the pixels)
+};
+
+// Shaded pixel of a preview render
+struct PreviewSample
+{
+	glm::vec3 color;				// Shaded color
+	const SceneObject* obj; // Object seen through the pixel center (nullptr for the background)
+};
+
+/**
+ * @brief Renders a quick preview of a job into job.image: only some pixels are shaded, with at most PREVIEW_MAX_DEPTH bounces
+ * and without anti-aliasing, and the others are reconstructed with edge-aware upsampling.
+ * A reduced-resolution preview shades a lattice of every 2nd or 4th pixel and interpolates bilinearly between lattice pixels that see
+ * the same object; where they don't, the pixel takes the color of the nearest lattice pixels on the same object as the nearest one,
+ * so object edges stay sharp instead of bleeding. A checkerboard preview fills each unshaded pixel from the horizontal or vertical pair
+ * of shaded neighbors, whichever differs less, so it interpolates along edges rather than across them.
+ * @param[in,out] job          Render job with its image created
+ * @param[in]     mode         Pixels to shade (not PREVIEW_NONE)
+ * @param[in]     numOfThreads Number of threads to use (0 for DefaultThreadCount())
+ * The image is left untouched if the job is cancelled.
+ */
+void RenderPreview(RenderJob& job, const PreviewMode& mode, const unsigned& numOfThreads)
+{
+	int width(job.image.width), height(job.image.height), maxDepth(std::min(job.maxDepth, PREVIEW_MAX_DEPTH));
+	auto shade = [&](const int& x, const int& y) {
+		IntersectionInfo hit(Raycast(GetRayThruPixel(job.camera, x, height - y - 1), job.scene));
+		PreviewSample sample = {(hit.obj != nullptr) ? Shade(hit, job.scene, job.camera, maxDepth) : BACKGROUND_COLOR, hit.obj};
+		return sample;
+	};
+
+	if (mode == PREVIEW_CHECKERBOARD)
+	{
+		std::vector<glm::vec3> colors(static_cast<size_t>(width) * height);
+		ParallelFor(colors.size(), PREVIEW_GRAIN, numOfThreads, [&](const size_t& begin, const size_t& end) {
+			for (size_t k = begin; k < end and !job.IsCancelled(); ++k)
+			{
+				int x(static_cast<int>(k % width)), y(static_cast<int>(k / width));
+				if ((x + y) % 2 == 0)
+					colors[k] = shade(x, y).color;
+			}
+		});
+		if (job.IsCancelled())
+			return;
+		auto at = [&](const int& x, const int& y) { return colors[static_cast<size_t>(y) * width + x]; };
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				if ((x + y) % 2 == 0)
+				{
+					job.image.SetColor(x, y, at(x, y));
+					continue;
+				}
+
+				glm::vec3 color;
+				bool horizontal(x > 0 and x + 1 < width), vertical(y > 0 and y + 1 < height);
+				if (horizontal and (!vertical or glm::length(at(x - 1, y) - at(x + 1, y)) <= glm::length(at(x, y - 1) - at(x, y + 1))))
+					color = (at(x - 1, y) + at(x + 1, y)) * 0.5f;
+				else if (vertical)
+					color = (at(x, y - 1) + at(x, y + 1)) * 0.5f;
+				else
+				{
+					// Image corners and one pixel wide images: average the neighbors there are
+					int numOfNeighbors(0);
+					const int offsets[4][2] = {{-1, 0}, {1, 0}, {0, -1}, {0, 1}};
+					for (int n = 0; n < 4; ++n)
+					{
+						int nx(x + offsets[n][0]), ny(y + offsets[n][1]);
+						if (nx >= 0 and nx < width and ny >= 0 and ny < height)
+						{
+							color += at(nx, ny);
+							++numOfNeighbors;
+						}
+					}
+					color /= static_cast<float>(std::max(numOfNeighbors, 1));
+				}
+				job.image.SetColor(x, y, color);
+			}
+		}
+		return;
+	}
+
+	// Lattice of shaded pixels; the last column and row are clamped to the image edge
+	int step((mode == PREVIEW_QUARTER) ? 2 : 4);
+	int latticeWidth((width - 1 + step - 1) / step + 1), latticeHeight((height - 1 + step - 1) / step + 1);
+	auto latticeX = [&](const int& i) { return std::min(i * step, width - 1); };
+	auto latticeY = [&](const int& j) { return std::min(j * step, height - 1); };
+	std::vector<PreviewSample> lattice(static_cast<size_t>(latticeWidth) * latticeHeight);
+	ParallelFor(lattice.size(), PREVIEW_GRAIN, numOfThreads, [&](const size_t& begin, const size_t& end) {
+		for (size_t k = begin; k < end and !job.IsCancelled(); ++k)
+			lattice[k] = shade(latticeX(static_cast<int>(k % latticeWidth)), latticeY(static_cast<int>(k / latticeWidth)));
+	});
+	if (job.IsCancelled())
+		return;
+
+	for (int y = 0; y < height; ++y)
+	{
+		int j(std::min(y / step, latticeHeight - 2));
+		float spanY(static_cast<float>(latticeY(j + 1) - latticeY(j)));
+		float v((spanY > 0.0f) ? (y - latticeY(j)) / spanY : 0.0f);
+		for (int x = 0; x < width; ++x)
+		{
+			int i(std::min(x / step, latticeWidth - 2));
+			float spanX(static_cast<float>(latticeX(i + 1) - latticeX(i)));
+			float u((spanX > 0.0f) ? (x - latticeX(i)) / spanX : 0.0f);
+			const PreviewSample* corners[4] = {
+				&lattice[static_cast<size_t>(j) * latticeWidth + i], &lattice[static_cast<size_t>(j) * latticeWidth + i + 1],
+				&lattice[static_cast<size_t>(j + 1) * latticeWidth + i], &lattice[static_cast<size_t>(j + 1) * latticeWidth + i + 1]};
+			float weights[4] = {(1.0f - u) * (1.0f - v), u * (1.0f - v), (1.0f - u) * v, u * v};
+
+			// Only corners on the same object as the nearest one contribute
+			int nearest(0);
+			for (int c = 1; c < 4; ++c)
+			{
+				if (weights[c] > weights[nearest])
+					nearest = c;
+			}
+			glm::vec3 color;
+			float weightSum(0.0f);
+			for (int c = 0; c < 4; ++c)
+			{
+				if (corners[c]->obj != corners[nearest]->obj)
+					continue;
+				color += corners[c]->color * weights[c];
+				weightSum += weights[c];
+			}
+			job.image.SetColor(x, y, (weightSum > 0.0f) ? color / weightSum : corners[nearest]->color);
+		}
+	}
+}
+
+const char CHECKPOINT_MAGIC[8] = {'R', 'T', 'C', 'K', 'P', 'T', '0', '4'};
+const uint64_t FNV_OFFSET_BASIS(14695981039346656037ull); // Initial value of a 64-bit FNV-1a hash
+const uint64_t FNV_PRIME(1099511628211ull);								// Multiplier of a 64-bit FNV-1a hash
+
+/**
+ * @brief Adds bytes to a 64-bit FNV-1a hash
+ * @param[in] data Bytes to add
+ * @param[in] size Number of bytes
+ * @param[in] hash Hash of the bytes before them
+ * @return Hash including the bytes
+ */
+uint64_t HashBytes(const void* data, const size_t& size, uint64_t hash)
+{
+	const unsigned char* bytes(static_cast<const unsigned char*>(data));
+	for (size_t i = 0; i < size; ++i)
+		hash = (hash ^ bytes[i]) * FNV_PRIME;
+	return hash;
+}
+
+/**
+ * @brief Hashes what a render is made from, so a checkpoint of another scene or view is not resumed
+ * @param[in]  scenePath Scene file
+ * @param[in]  camera    Camera the scene was loaded with
+ * @param[out] outHash   Hash of the file's contents and the camera
+ * @return Whether the file could be read
+ */
+bool HashRenderSource(const std::string& scenePath, const Camera& camera, uint64_t& outHash)
+{
+	std::ifstream file(scenePath, std::ios::binary);
+	if (!file)
+		return false;
+
+	uint64_t hash(FNV_OFFSET_BASIS);
+	std::vector<char> buffer(1 << 16);
+	while (file.read(buffer.data(), buffer.size()) or file.gcount() > 0)
+		hash = HashBytes(buffer.data(), static_cast<size_t>(file.gcount()), hash);
+	if (file.bad())
+		return false;
+
+	// The camera is hashed field by field, so padding never takes part
+	hash = HashBytes(&camera.position, sizeof(camera.position), hash);
+	hash = HashBytes(&camera.lookTarget, sizeof(camera.lookTarget), hash);
+	hash = HashBytes(&camera.globalUp, sizeof(camera.globalUp), hash);
+	hash = HashBytes(&camera.fovY, sizeof(camera.fovY), hash);
+	hash = HashBytes(&camera.focalLength, sizeof(camera.focalLength), hash);
+	hash = HashBytes(&camera.imageWidth, sizeof(camera.imageWidth), hash);
+	hash = HashBytes(&camera.imageHeight, sizeof(camera.imageHeight), hash);
+	outHash = hash;
+	return true;
+}
+
+// Start of a checkpoint file. It is followed by the passes and errors of every tile, the image and, for progressive jobs, the sums of the samples.
+struct CheckpointHeader
+{
+	char magic[8];				// CHECKPOINT_MAGIC
+	int32_t width;				// Image width
+	int32_t height;				// Image height
+	int32_t maxDepth;			// Maximum depth of the trace
+	int32_t antiAliasing; // 0 without anti-aliasing, 1 when every sample is shaded, 2 when multisampled
+	int32_t progressive;	// Whether the job refines the image pass after pass
+	int32_t pass;					// Current refinement pass
+	int32_t shadingRate;	// Block size of variable-rate shading
+	float shadingThreshold; // Largest difference that variable-rate shading interpolates across
+	uint64_t tileCount;		// Number of tiles
+	uint64_t sourceHash;	// Hash of the scene file's contents and the camera (RenderJob::sourceHash)
+};
+
+// Rendering state of a job: which tiles are done and what they contain.
+// Samplers need no state of their own, because every pixel seeds its jitter from its position and the pass.
+struct Checkpoint
+{
+	CheckpointHeader header;						 // Image size and render options the state belongs to
+	std::vector<int32_t> tilePasses;				 // Passes committed to each tile
+	std::vector<float> tileErrors;					 // Estimated error of each tile
+	std::vector<unsigned char> image;				 // Image data
+	std::vector<glm::vec3> accumulation;		 // Sums of the samples of progressive jobs
+	std::vector<float> squareAccumulation; // Sums of the squared luminances of the samples of progressive jobs
+
+	/**
+	 * @brief Copies the state of a job. Must be called with the scheduler's mutex held.
+	 * @param[in] job Render job
+	 */
+	void Capture(const RenderJob& job)
+	{
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+		header.width = job.image.width;
+		header.height = job.image.height;
+		header.maxDepth = job.maxDepth;
+		header.antiAliasing = job.antiAliasing ? (job.multisampling ? 2 : 1) : 0;
+		header.progressive = job.progressive;
+		header.pass = job.pass;
+		header.shadingRate = job.shadingRate;
+		header.shadingThreshold = job.shadingThreshold;
+		header.tileCount = job.tiles.size();
+		header.sourceHash = job.sourceHash;
+		tilePasses = job.tilePasses;
+		tileErrors = job.tileErrors;
+		image = job.image.data;
+		accumulation = job.accumulation;
+		squareAccumulation = job.squareAccumulation;
+	}
+
+	/**
+	 * @brief Writes the state to a temporary file and renames it over the checkpoint, so a crash while writing keeps the previous checkpoint
+	 * @param[in] path Checkpoint file
+	 * @return Whether the checkpoint was written
+	 */
+	bool Write(const std::string& path) const
+	{
+		std::string temporaryPath(path + ".tmp");
+		std::ofstream file(temporaryPath, std::ios::binary | std::ios::trunc);
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(tilePasses.data()), tilePasses.size() * sizeof(int32_t));
+		file.write(reinterpret_cast<const char*>(tileErrors.data()), tileErrors.size() * sizeof(float));
+		file.write(reinterpret_cast<const char*>(image.data()), image.size());
+		file.write(reinterpret_cast<const char*>(accumulation.data()), accumulation.size() * sizeof(glm::vec3));
+		file.write(reinterpret_cast<const char*>(squareAccumulation.data()), squareAccumulation.size() * sizeof(float));
+		file.close();
+		if (!file)
+			return false;
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		return !error;
+	}
+
+	/**
+	 * @brief Reads a checkpoint file
+	 * @param[in] path Checkpoint file
+	 * @return Whether the file exists and is a valid checkpoint
+	 */
+	bool Read(const std::string& path)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) or std::memcmp(header.magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+			return false;
+		if (header.width < 0 or header.height < 0 or header.tileCount > static_cast<uint64_t>(header.width) * header.height + 1)
+			return false;
+
+		size_t numOfPixels(static_cast<size_t>(header.width) * header.height);
+		tilePasses.resize(header.tileCount);
+		tileErrors.resize(header.tileCount);
+		image.resize(numOfPixels * 3);
+		accumulation.resize(header.progressive ? numOfPixels : 0);
+		squareAccumulation.resize(header.progressive ? numOfPixels : 0);
+		file.read(reinterpret_cast<char*>(tilePasses.data()), tilePasses.size() * sizeof(int32_t));
+		file.read(reinterpret_cast<char*>(tileErrors.data()), tileErrors.size() * sizeof(float));
+		file.read(reinterpret_cast<char*>(image.data()), image.size());
+		file.read(reinterpret_cast<char*>(accumulation.data()), accumulation.size() * sizeof(glm::vec3));
+		file.read(reinterpret_cast<char*>(squareAccumulation.data()), squareAccumulation.size() * sizeof(float));
+		return static_cast<bool>(file);
+	}
+
+	/**
+	 * @brief Puts a job that has not been submitted yet into the saved state
+	 * @param[in,out] job Render job with its tiles created
+	 * @return Whether the checkpoint belongs to a render of the same scene and camera with the same image size and options (the job is unchanged otherwise)
+	 */
+	bool Restore(RenderJob& job) const
+	{
+		if (header.sourceHash != job.sourceHash or header.width != job.image.width or header.height != job.image.height or header.maxDepth != job.maxDepth
+			or header.antiAliasing != (job.antiAliasing ? (job.multisampling ? 2 : 1) : 0)
+			or header.shadingRate != job.shadingRate or header.shadingThreshold != job.shadingThreshold or (header.progressive != 0) != job.progressive or header.tileCount != job.tiles.size())
+			return false;
+
+		job.pass = header.pass;
+		job.tilePasses = tilePasses;
+		job.tileErrors = tileErrors;
+		job.image.data = image;
+		job.accumulation = accumulation;
+		job.squareAccumulation = squareAccumulation;
+		job.nextTile = 0;
+		job.completedTiles = 0;
+		for (size_t i = 0; i < job.tiles.size(); ++i)
+		{
+			if (job.IsTileDone(i))
+				++job.completedTiles;
+		}
+		return true;
+	}
+};
+
+// Progress of one render as seen by a ProgressReporter
+struct ProgressSample
+{
+	std::string name;				 // Name of the render
+	int pass;								 // Current pass of a progressive render (-1 for other renders)
+	double fraction;				 // Finished fraction of the work (of the current pass for progressive renders)
+	uint64_t raysCast;			 // Rays cast so far
+	double remainingSeconds; // Time left if it is known in advance (a deadline), negative to estimate it from the progress rate, NaN if it cannot be estimated
+};
+
+// Thread pool shared by all render jobs.
+// Workers pick a new tile after every tile they finish, always from the highest-priority unfinished job,
+// so a newly submitted urgent job takes over the workers at the next tile boundary.
+struct RenderScheduler
+{
+	std::vector<std::thread> workers;			 // Worker threads
+	std::mutex mutex;											 // Guards everything below
+	std::condition_variable tileAvailable; // Signalled when tiles are submitted or the scheduler stops
+	std::condition_variable jobFinished;	 // Signalled when a job's last tile is rendered
+	std::vector<RenderJob*> jobs;					 // Jobs that still have tiles to hand out or tiles in flight
+	std::vector<RenderJob*> finishedJobs;	 // Finished jobs that were not collected yet
+	size_t numOfSubmitted;								 // Number of jobs ever submitted
+	bool stopping;												 // Whether the workers should exit
+
+	/**
+	 * @brief Constructor
+	 */
+	RenderScheduler()
+		: numOfSubmitted(0), stopping(false)
+	{
+	}
+
+	/**
+	 * @brief Destructor. Stops the workers.
+	 */
+	~RenderScheduler()
+	{
+		Stop();
+	}
+
+	/**
+	 * @brief Starts the worker threads
+	 * @param[in] numOfThreads Number of workers
+	 */
+	void Start(const unsigned& numOfThreads)
+	{
+		for (unsigned i = 0; i < numOfThreads; ++i)
+			workers.push_back(std::thread(&RenderScheduler::WorkerLoop, this));
+	}
+
+	/**
+	 * @brief Stops the worker threads after their current tile
+	 */
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		tileAvailable.notify_all();
+		for (size_t i = 0; i < workers.size(); ++i)
+			workers[i].join();
+		workers.clear();
+	}
+
+	/**
+	 * @brief Queues a job. The job must stay alive until it is returned by WaitForFinishedJob().
+	 * @param[in] job Job with its tiles created
+	 */
+	void Submit(RenderJob* job)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job->sequence = numOfSubmitted++;
+			if (job->tiles.empty())
+				finishedJobs.push_back(job);
+			else
+			{
+				jobs.push_back(job);
+				CompletePass(job); // A job resumed from a checkpoint may have nothing left in its pass
+			}
+		}
+		tileAvailable.notify_all();
+		jobFinished.notify_all();
+	}
+
+	/**
+	 * @brief Waits until a job finishes
+	 * @param[in] timeout Longest time to wait
+	 * @return A finished job, or nullptr if none finished within the timeout
+	 */
+	RenderJob* WaitForFinishedJob(const std::chrono::milliseconds& timeout)
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!jobFinished.wait_for(lock, timeout, [this] { return !finishedJobs.empty(); }))
+			return nullptr;
+		RenderJob* job(finishedJobs.front());
+		finishedJobs.erase(finishedJobs.begin());
+		return job;
+	}
+
+	/**
+	 * @return Progress of the jobs that are not finished yet
+	 */
+	std::vector<ProgressSample> SampleProgress()
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<ProgressSample> samples(jobs.size());
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			samples[i].name = jobs[i]->name;
+			samples[i].pass = jobs[i]->progressive ? jobs[i]->pass : -1;
+			samples[i].fraction = jobs[i]->tiles.empty() ? 1.0 : static_cast<double>(jobs[i]->completedTiles.load()) / jobs[i]->tiles.size();
+			samples[i].raysCast = jobs[i]->raysCast.load();
+			samples[i].remainingSeconds = -1.0;
+			if (jobs[i]->hasDeadline)
+				samples[i].remainingSeconds = std::max(0.0, std::chrono::duration<double>(jobs[i]->deadline - std::chrono::steady_clock::now()).count());
+			else if (jobs[i]->progressive)
+				samples[i].remainingSeconds = std::nan("");
+		}
+		return samples;
+	}
+
+	/**
+	 * @brief Copies the state of a job while no worker commits a tile
+	 * @param[in]  job           Render job
+	 * @param[out] outCheckpoint Copy of the job's state
+	 */
+	void CaptureCheckpoint(const RenderJob& job, Checkpoint& outCheckpoint)
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		outCheckpoint.Capture(job);
+	}
+
+	/**
+	 * @brief Hands out the next tile of the highest-priority job (submission order breaks ties). Must be called with the mutex held.
+	 * @param[out] outJob       Job the tile belongs to
+	 * @param[out] outTileIndex Index of the tile to render in outJob->tiles
+	 * @return Whether there was a tile to hand out
+	 */
+	bool ClaimTile(RenderJob*& outJob, size_t& outTileIndex)
+	{
+		// Jobs whose time is up or that were cancelled hand out no more tiles; their remaining tiles count as done
+		for (size_t i = jobs.size(); i-- > 0;)
+		{
+			if ((jobs[i]->IsOutOfTime() or jobs[i]->IsCancelled()) and jobs[i]->nextTile < jobs[i]->tiles.size())
+			{
+				jobs[i]->SkipRemainingTiles();
+				CompletePass(jobs[i]);
+			}
+		}
+
+		outJob = nullptr;
+		for (size_t i = 0; i < jobs.size(); ++i)
+		{
+			if (!jobs[i]->HasTilesLeft())
+				continue;
+			if (outJob == nullptr or jobs[i]->priority > outJob->priority or (jobs[i]->priority == outJob->priority and jobs[i]->sequence < outJob->sequence))
+				outJob = jobs[i];
+		}
+		if (outJob == nullptr)
+			return false;
+		outTileIndex = outJob->tileOrder[outJob->nextTile++];
+		return true;
+	}
+
+	/**
+	 * @brief Starts the next pass of a job whose current pass is fully rendered, or retires the job if it has no next pass.
+	 * Does nothing while tiles of the current pass are still outstanding. Must be called with the mutex held.
+	 * @param[in] job Job to check
+	 */
+	void CompletePass(RenderJob* job)
+	{
+		if (job->completedTiles != job->tiles.size())
+			return;
+		if (job->StartNextPass())
+		{
+			tileAvailable.notify_all();
+			return;
+		}
+		jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+		finishedJobs.push_back(job);
+		jobFinished.notify_all();
+	}
+
+	/**
+	 * @brief Body of every worker thread
+	 */
+	void WorkerLoop()
+	{
+		RenderJob* job;
+		size_t tileIndex;
+		TileResult result;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true)
+		{
+			tileAvailable.wait(lock, [&] { return stopping or ClaimTile(job, tileIndex); });
+			if (stopping)
+				return;
+
+			lock.unlock();
+			uint64_t raysBefore(numOfRaysCast);
+			bool finished(RenderTile(*job, job->tiles[tileIndex], result));
+			job->raysCast += numOfRaysCast - raysBefore;
+			lock.lock();
+
+			if (finished)
+				CommitTile(*job, tileIndex, result);
+			++job->completedTiles;
+			CompletePass(job);
+		}
+	}
+};
+
+// How progress is reported
+enum ProgressFormat
+{
+	PROGRESS_TEXT, // One line that is overwritten in place
+	PROGRESS_JSON, // One JSON object per line, for schedulers and scripts
+	PROGRESS_NONE, // Nothing
+};
+
+// Thread that samples the progress of running renders at a fixed interval and prints percent done, rays per second and ETA.
+// Render threads only bump atomic counters, so reporting costs them nothing and never makes them wait on output.
+struct ProgressReporter
+{
+	std::thread thread;															 // Reporter thread
+	std::mutex mutex;																 // Guards stopping
+	std::condition_variable stopRequested;					 // Signalled by Stop()
+	bool stopping;																	 // Whether the reporter thread should exit
+	ProgressFormat format;													 // Output format
+	std::function<std::vector<ProgressSample>()> sampler; // Returns the progress of the running renders
+
+	// Earlier samples of one render, for rates and estimates
+	struct History
+	{
+		double startTime;		 // Seconds since the reporter started at the sample before the render was first seen
+		double lastTime;		 // Time of the previous sample
+		uint64_t lastRaysCast; // Rays cast at the previous sample
+	};
+
+	/**
+	 * @brief Constructor
+	 */
+	ProgressReporter()
+		: stopping(false), format(PROGRESS_TEXT)
+	{
+	}
+
+	/**
+	 * @brief Destructor. Stops the reporter thread.
+	 */
+	~ProgressReporter()
+	{
+		Stop();
+	}
+
+	/**
+	 * @brief Starts the reporter thread (nothing is started for PROGRESS_NONE)
+	 * @param[in] progressFormat Output format
+	 * @param[in] progressSampler Returns the progress of the running renders; called from the reporter thread
+	 */
+	void Start(const ProgressFormat& progressFormat, const std::function<std::vector<ProgressSample>()>& progressSampler)
+	{
+		format = progressFormat;
+		sampler = progressSampler;
+		stopping = false;
+		if (format != PROGRESS_NONE)
+			thread = std::thread(&ProgressReporter::Run, this);
+	}
+
+	/**
+	 * @brief Stops the reporter thread
+	 */
+	void Stop()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		stopRequested.notify_all();
+		if (thread.joinable())
+			thread.join();
+	}
+
+	/**
+	 * @brief Writes a string as a JSON string literal
+	 */
+	static void PrintJsonString(const std::string& text)
+	{
+		std::cout << '"';
+		for (size_t i = 0; i < text.size(); ++i)
+		{
+			if (text[i] == '"' or text[i] == '\\')
+				std::cout << '\\';
+			std::cout << text[i];
+		}
+		std::cout << '"';
+	}
+
+	/**
+	 * @brief Body of the reporter thread
+	 */
+	void Run()
+	{
+		std::map<std::string, History> histories;
+		std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+		double previousTime(0.0);
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopRequested.wait_for(lock, std::chrono::milliseconds(PROGRESS_INTERVAL_MS), [this] { return stopping; }))
+		{
+			std::vector<ProgressSample> samples(sampler());
+			double now(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+
+			std::cout << ((format == PROGRESS_TEXT) ? "\r" : "{\"time\":") << std::fixed << std::setprecision(format == PROGRESS_TEXT ? 0 : 3);
+			if (format == PROGRESS_JSON)
+				std::cout << now << ",\"renders\":[";
+			for (size_t i = 0; i < samples.size(); ++i)
+			{
+				const ProgressSample& sample(samples[i]);
+				std::map<std::string, History>::iterator history(histories.find(sample.name));
+				if (history == histories.end())
+				{
+					History first = {previousTime, previousTime, 0};
+					history = histories.insert(std::make_pair(sample.name, first)).first;
+				}
+
+				double interval(now - history->second.lastTime);
+				double raysPerSecond((interval > 0.0) ? (sample.raysCast - history->second.lastRaysCast) / interval : 0.0);
+				double elapsed(now - history->second.startTime);
+				double eta(sample.remainingSeconds);
+				if (eta < 0.0)
+					eta = (sample.fraction > 0.0) ? elapsed * (1.0 - sample.fraction) / sample.fraction : std::nan("");
+				history->second.lastTime = now;
+				history->second.lastRaysCast = sample.raysCast;
+
+				if (format == PROGRESS_TEXT)
+				{
+					std::cout << (i > 0 ? " | " : "") << sample.name;
+					if (sample.pass >= 0)
+						std::cout << " pass " << sample.pass;
+					std::cout << ": " << std::setw(3) << (100.0 * sample.fraction) << "% "
+										<< std::setprecision(2) << (raysPerSecond / 1.0e6) << " Mrays/s ETA ";
+					if (std::isnan(eta))
+						std::cout << "?";
+					else
+						std::cout << std::setprecision(0) << eta << "s";
+					std::cout << std::setprecision(0);
+				}
+				else
+				{
+					std::cout << (i > 0 ? "," : "") << "{\"name\":";
+					PrintJsonString(sample.name);
+					if (sample.pass >= 0)
+						std::cout << ",\"pass\":" << sample.pass;
+					std::cout << ",\"percent\":" << (100.0 * sample.fraction) << ",\"rays\":" << sample.raysCast << ",\"rays_per_second\":" << raysPerSecond << ",\"eta_seconds\":";
+					if (std::isnan(eta))
+						std::cout << "null";
+					else
+						std::cout << eta;
+					std::cout << "}";
+				}
+			}
+			std::cout << ((format == PROGRESS_TEXT) ? "   " : "]}\n") << std::defaultfloat << std::setprecision(6) << std::flush;
+			previousTime = now;
+		}
+	}
+};
+
+// Hardware counter of the last-level cache misses of this process and of the threads it starts afterwards (Linux perf events only)
+struct CacheMissCounter
+{
+	int descriptor; // perf event file descriptor (-1 if counting is not available)
+
+	/**
+	 * @brief Constructor. Starts counting if the platform and its permissions allow it.
+	 */
+	CacheMissCounter()
+		: descriptor(-1)
+	{
+#ifdef __linux__
+		perf_event_attr attributes;
+		std::memset(&attributes, 0, sizeof(attributes));
+		attributes.type = PERF_TYPE_HARDWARE;
+		attributes.size = sizeof(attributes);
+		attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+		attributes.inherit = 1; // Also count the render threads, which are started later
+		attributes.exclude_kernel = 1;
+		attributes.exclude_hv = 1;
+		descriptor = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+#endif
+	}
+
+	CacheMissCounter(const CacheMissCounter&) = delete;
+	CacheMissCounter& operator=(const CacheMissCounter&) = delete;
+
+	/**
+	 * @brief Destructor
+	 */
+	~CacheMissCounter()
+	{
+#ifndef _WIN32
+		if (descriptor >= 0)
+			close(descriptor);
+#endif
+	}
+
+	/**
+	 * @brief Reads the count. Threads only add their misses when they exit, so read after joining them.
+	 * @param[out] outCount Cache misses since the constructor
+	 * @return Whether counting is available
+	 */
+	bool Read(uint64_t& outCount) const
+	{
+#ifndef _WIN32
+		return descriptor >= 0 and read(descriptor, &outCount, sizeof(outCount)) == static_cast<ssize_t>(sizeof(outCount));
+#else
+		return false;
+#endif
+	}
+};
+
+/**
+ * @brief Prints how long rendering took and how many cache misses it caused, to compare traversal orders and memory layouts
+ * @param[in] job         Finished job
+ * @param[in] seconds     Render time
+ * @param[in] cacheMisses Counter started before the render threads
+ */
+void PrintRenderStatistics(const RenderJob& job, const double& seconds, const CacheMissCounter& cacheMisses)
+{
+	static const char* const TRAVERSAL_NAMES[] = {"scanline", "morton", "hilbert"};
+	uint64_t numOfMisses;
+	size_t numOfPixels(static_cast<size_t>(job.image.width) * job.image.height);
+
+	std::cout << "Render statistics\n"
+						<< "  Traversal:  " << TRAVERSAL_NAMES[job.traversal] << "\n"
+						<< "  Time:       " << seconds << " s\n";
+	if (job.shadingRate > 1)
+		std::cout << "  Shading:    " << job.shadingRate << "x" << job.shadingRate << " blocks, " << (numOfPixels > 0 ? (100.0 * job.numOfInterpolated) / numOfPixels : 0.0) << "% of the pixels interpolated\n";
+	if (job.scene.textures != nullptr)
+		std::cout << "  Textures:   " << job.scene.textures->numOfLoads << " tiles read, " << job.scene.textures->numOfEvictions << " evicted ("
+							<< job.scene.textures->numOfSlots << " of " << job.scene.textures->numOfTiles << " tiles fit in the cache)\n";
+	if (cacheMisses.Read(numOfMisses))
+		std::cout << "  Cache:      " << numOfMisses << " misses (" << (numOfPixels > 0 ? static_cast<double>(numOfMisses) / numOfPixels : 0.0) << " per pixel)\n";
+	else
+		std::cout << "  Cache:      misses not available (needs Linux perf events, see /proc/sys/kernel/perf_event_paranoid)\n";
+	std::cout << std::flush;
+}
+
+/**
+ * @brief Prints how far a progressive job got: samples per pixel, converged tiles and the estimated error of the image
+ * @param[in] job Finished progressive job
+ */
+void PrintRefinementStatistics(const RenderJob& job)
+{
+	int minSamples(MAX_REFINEMENT_SAMPLES), maxSamples(0);
+	size_t numOfConverged(0), numOfEstimated(0);
+	float maxError(0.0f), squaredErrorSum(0.0f);
+	for (size_t i = 0; i < job.tiles.size(); ++i)
+	{
+		minSamples = std::min(minSamples, job.tilePasses[i] - 1);
+		maxSamples = std::max(maxSamples, job.tilePasses[i] - 1);
+		if (job.IsTileConverged(i))
+			++numOfConverged;
+		if (job.tileErrors[i] != FLT_MAX)
+		{
+			++numOfEstimated;
+			maxError = std::max(maxError, job.tileErrors[i]);
+			squaredErrorSum += job.tileErrors[i] * job.tileErrors[i];
+		}
+	}
+
+	std::cout << "Refinement statistics\n"
+						<< "  Passes:     " << job.pass << " (pass 0 is the preview, pass N >= 1 has N samples per pixel)\n"
+						<< "  Samples:    " << std::max(minSamples, 0) << " - " << maxSamples << " per pixel\n";
+	if (job.targetError > 0.0f)
+		std::cout << "  Converged:  " << numOfConverged << " of " << job.tiles.size() << " tiles (target error " << job.targetError << ")\n";
+	if (numOfEstimated == job.tiles.size() and numOfEstimated > 0)
+		std::cout << "  Error:      " << std::sqrt(squaredErrorSum / static_cast<float>(numOfEstimated)) << " RMS, " << maxError << " worst tile\n";
+	else
+		std::cout << "  Error:      not estimated (fewer than 2 samples in some tiles)\n";
+	std::cout << std::flush;
+}
+
+/**
+ * @brief Writes the ray costs counted by --profile, objects and then material groups ranked by their intersection tests,
+ * with hints about objects that could be simplified or hidden from shadow rays
+ * @param[in] scene    Profiled scene (scene.profile must not be nullptr)
+ * @param[in] fileName File to write the report to
+ * @return Whether the report was written
+ */
+bool WriteRayCostReport(const Scene& scene, const std::string& fileName)
+{
+	std::vector<ObjectCost> costs(scene.profile->Total());
+	std::vector<std::string> types(costs.size());
+	std::vector<Material> materials(costs.size());
+	std::vector<Bounds> bounds(costs.size());
+	for (size_t i = 0; i < scene.objects.size(); ++i)
+	{
+		size_t numOfPrimitives(scene.objects[i]->GetNumOfPrimitives());
+		types[i] = (dynamic_cast<const Sphere*>(scene.objects[i]) != nullptr) ? "sphere" : (numOfPrimitives == 1) ? "triangle" : "mesh of " + std::to_string(numOfPrimitives) + " quantized triangles";
+		materials[i] = scene.objects[i]->material;
+		bounds[i] = scene.objects[i]->GetBounds();
+	}
+	for (size_t m = 0; m < scene.meshes.size(); ++m)
+	{
+		const LodLevel& original(scene.meshes[m]->levels[0]);
+		types[scene.objects.size() + m] = "mesh of " + std::to_string(original.triangles.size()) + " triangles";
+		materials[scene.objects.size() + m] = original.triangles[0]->material;
+		bounds[scene.objects.size() + m] = scene.meshes[m]->bounds;
+	}
+
+	// Objects with the same material form a group, numbered in order of first appearance
+	std::vector<std::array<float, 11>> groupKeys;
+	std::vector<size_t> groupOf(costs.size());
+	for (size_t i = 0; i < costs.size(); ++i)
+	{
+		const Material& material(materials[i]);
+		std::array<float, 11> key{{material.ambient.r, material.ambient.g, material.ambient.b, material.diffuse.r, material.diffuse.g, material.diffuse.b, material.specular.r, material.specular.g, material.specular.b, material.shininess, static_cast<float>(material.texture)}};
+		groupOf[i] = std::find(groupKeys.begin(), groupKeys.end(), key) - groupKeys.begin();
+		if (groupOf[i] == groupKeys.size())
+			groupKeys.push_back(key);
+	}
+	std::vector<ObjectCost> groupCosts(groupKeys.size());
+	std::vector<size_t> groupSizes(groupKeys.size(), 0);
+	ObjectCost total;
+	for (size_t i = 0; i < costs.size(); ++i)
+	{
+		groupCosts[groupOf[i]].Add(costs[i]);
+		++groupSizes[groupOf[i]];
+		total.Add(costs[i]);
+	}
+
+	auto rankByTests = [](const std::vector<ObjectCost>& entries)
+	{
+		std::vector<size_t> order(entries.size());
+		for (size_t i = 0; i < order.size(); ++i)
+			order[i] = i;
+		std::stable_sort(order.begin(), order.end(), [&entries](const size_t& a, const size_t& b) { return entries[a].tests > entries[b].tests; });
+		return order;
+	};
+	auto share = [&total](const uint64_t& tests) { return (total.tests > 0) ? (100.0 * tests) / total.tests : 0.0; };
+
+	std::ofstream file(fileName);
+	if (!file)
+		return false;
+
+	file << std::fixed << std::setprecision(2)
+			 << "Ray cost report: " << costs.size() << " objects, " << total.tests << " intersection tests (" << total.shadowTests << " by shadow rays), "
+			 << total.hits << " hits, " << total.occlusions << " shadow occlusions, " << total.steps << " traversal steps\n"
+			 << "Objects are numbered in scene order after loading (see --reorder), meshes (--lod) after them.\n\n"
+			 << "Objects by intersection tests\n"
+			 << "rank\tobject\ttype\tcenter\ttests\tshare %\tshadow tests\thits\tocclusions\tsteps\tmaterial group\thint\n";
+	std::vector<size_t> order(rankByTests(costs));
+	for (size_t r = 0; r < order.size(); ++r)
+	{
+		const size_t& i(order[r]);
+		const ObjectCost& cost(costs[i]);
+		glm::vec3 center((bounds[i].min + bounds[i].max) * 0.5f);
+		file << (r + 1) << "\t" << i << "\t" << types[i] << "\t" << center.x << " " << center.y << " " << center.z << "\t" << cost.tests << "\t" << share(cost.tests)
+				 << "\t" << cost.shadowTests << "\t" << cost.hits << "\t" << cost.occlusions << "\t" << cost.steps << "\t" << groupOf[i] << "\t";
+		if (cost.shadowTests > 0 and cost.occlusions == 0)
+			file << "never occludes a light: try \"visibility 1 0 1\"";
+		else if (cost.tests > 0 and cost.hits == 0 and cost.occlusions == 0)
+			file << "tested but never hit";
+		else if (i >= scene.objects.size() and share(cost.tests) > 100.0 / costs.size())
+			file << "dense mesh: simplify it";
+		file << "\n";
+	}
+
+	file << "\nMaterial groups by intersection tests\n"
+			 << "rank\tgroup\tobjects\tdiffuse\ttests\tshare %\tshadow tests\thits\tocclusions\tsteps\n";
+	order = rankByTests(groupCosts);
+	for (size_t r = 0; r < order.size(); ++r)
+	{
+		const size_t& g(order[r]);
+		const ObjectCost& cost(groupCosts[g]);
+		file << (r + 1) << "\t" << g << "\t" << groupSizes[g] << "\t" << groupKeys[g][3] << " " << groupKeys[g][4] << " " << groupKeys[g][5] << "\t" << cost.tests << "\t" << share(cost.tests)
+				 << "\t" << cost.shadowTests << "\t" << cost.hits << "\t" << cost.occlusions << "\t" << cost.steps << "\n";
+	}
+	return static_cast<bool>(file);
+}
+
+// Options given on the command line
+struct RenderSettings
+{
+	std::string sceneFileName;	// .test file inside ./test directory (asked for interactively if empty)
+	bool antiAliasing;					// Whether to average SAMPLES_PER_PIXEL jittered rays per pixel
+	bool multisampling;					// Whether anti-aliasing shades every object hit by a pixel's samples once instead of every sample
+	int shadingRate;						// Block size of variable-rate shading (1 to shade every pixel)
+	float shadingThreshold;			// Largest difference that variable-rate shading interpolates across
+	PreviewMode preview;				// Pixels shaded by a quick preview (PREVIEW_NONE for a full render)
+	double targetFrameTime;			// Milliseconds per frame of an interactive session (0 to render once)
+	bool mirrorPackets;					// Whether reflections off planar mirrors are traced in packets
+	bool outOfCore;							// Whether to stream geometry from a memory-mapped packed file instead of loading it
+	std::string packedFileName; // Packed geometry file used in out-of-core mode (next to the scene file if empty)
+	int quantizationBits;				// Bits per axis of quantized triangle vertices (0 to store them at full precision)
+	size_t textureCacheBytes;		// Memory budget of the texture cache
+	bool levelsOfDetail;				// Whether dense meshes get simplified levels of detail for distant and secondary rays
+	bool printStatistics;				// Whether to print statistics
+	std::string profileFileName;	// File that the per-object ray cost report is written to (no profiling if empty)
+	SpaceFillingCurve reorderCurve; // Curve that objects are sorted along after loading (NO_CURVE keeps file order)
+	SpaceFillingCurve traversal;		// Curve that tiles and the pixels within a tile are rendered along (NO_CURVE for scanline order)
+	std::string jobsFileName;				// Job file to render instead of a single scene ("-" for stdin)
+	double timeBudget;							// Seconds to refine the image for, including loading (0 to render it once)
+	float targetError;							// Estimated error at which refining a tile stops (0 to render it once)
+	std::string checkpointFileName; // File the render state is saved to periodically (no checkpoints if empty)
+	int checkpointInterval;					// Seconds between checkpoints
+	bool resume;										// Whether to continue from the checkpoint file
+	std::string framebufferName;		// Shared-memory framebuffer to render into instead of writing scene.png (none if empty)
+	FramebufferFormat framebufferFormat; // Pixel format of the shared-memory framebuffer
+	ProgressFormat progressFormat;	// How progress is reported while rendering
+	std::string compareOptions;			// Options of a candidate configuration to compare against these settings on every scene (no comparison if empty)
+	float maxComparisonError;				// RMSE above which a compared scene fails
+	unsigned numOfThreads;					// Worker threads (0 until resolved from --threads or the detected CPU budget)
+
+	/**
+	 * @brief Constructor
+	 */
+	RenderSettings()
+		: antiAliasing(false), multisampling(false), shadingRate(1), shadingThreshold(DEFAULT_SHADING_THRESHOLD), preview(PREVIEW_NONE), targetFrameTime(0.0), mirrorPackets(false), outOfCore(false), quantizationBits(0), textureCacheBytes(DEFAULT_TEXTURE_CACHE_MB << 20), levelsOfDetail(false), printStatistics(false), reorderCurve(NO_CURVE), traversal(NO_CURVE), timeBudget(0.0), targetError(0.0f), checkpointInterval(CHECKPOINT_INTERVAL_S), resume(false), framebufferFormat(FRAMEBUFFER_U8), progressFormat(PROGRESS_TEXT), maxComparisonError(DEFAULT_MAX_COMPARISON_ERROR), numOfThreads(0)
+	{
+	}
+};
+
+/**
+ * @brief Prints the command line usage
+ * @param[in] program Name of the executable
+ */
+void PrintUsage(const char* program)
+{
+	std::cerr << "Usage: " << program << " [scene.test] [options]\n"
+						<< "Without a scene file, the scene and anti-aliasing are asked for interactively.\n"
+						<< "  --jobs <file>               Render the jobs in a file, one \"<priority> <scene.test> [aa|msaa]\" per line (- for stdin)\n"
+						<< "  --aa                        Enable anti-aliasing\n"
+						<< "  --msaa                      Enable anti-aliasing that shades each object in a pixel once instead of every sample\n"
+						<< "  --shading-rate <2|4>        Shade smooth 2x2 or 4x4 pixel blocks once and interpolate (edges and mirrors stay per pixel)\n"
+						<< "  --shading-threshold <t>     Largest normal, depth, color or reflectivity difference to interpolate across (default: " << DEFAULT_SHADING_THRESHOLD << ")\n"
+						<< "  --mirror-packets            Trace reflections off flat mirrors in packets from a mirrored virtual camera\n"
+						<< "  --preview <quarter|sixteenth|checkerboard>\n"
+						<< "                              Quick preview: shade 1/4, 1/16 or half of the pixels with at most " << PREVIEW_MAX_DEPTH << " bounces, upsample the rest\n"
+						<< "  --out-of-core               Stream geometry from a memory-mapped packed file instead of loading it\n"
+						<< "  --packed <file>             Packed geometry file for --out-of-core (default: ./test/<scene>.packed)\n"
+						<< "  --quantize <16|21>          Store triangle vertices quantized to 16 or 21 bits per axis\n"
+						<< "  --lod                       Simplify runs of at least " << LOD_MIN_TRIANGLES << " triangles with one material into levels of detail for distant and secondary rays\n"
+						<< "  --texture-cache <MiB>       Memory budget of the texture tile cache (default: " << DEFAULT_TEXTURE_CACHE_MB << ")\n"
+						<< "  --reorder <morton|hilbert>  Sort objects along a space-filling curve for memory locality\n"
+						<< "  --time-budget <seconds>     Refine the image (reflections, then more samples) until the time is up\n"
+						<< "  --converge <error>          Refine every tile until the estimated error of its pixels is below <error> (e.g. 0.005)\n"
+						<< "  --checkpoint <file>         Save the render state to a file periodically (removed when the render finishes)\n"
+						<< "  --checkpoint-interval <s>   Seconds between checkpoints (default: " << CHECKPOINT_INTERVAL_S << ")\n"
+						<< "  --resume                    Continue from the --checkpoint file instead of starting over\n"
+						<< "  --shm <name>                Render into a named shared-memory framebuffer instead of writing scene.png\n"
+						<< "  --shm-format <u8|f32>       Pixel format of the shared-memory framebuffer (default: u8)\n"
+						<< "  --interactive <ms>          Re-render into the --shm framebuffer until interrupted, adapting resolution and samples to <ms> per frame\n"
+						<< "  --traversal <scanline|morton|hilbert>\n"
+						<< "                              Order that tiles and the pixels within a tile are rendered in (default: scanline)\n"
+						<< "  --progress <text|json|none> Progress output: one updating line, one JSON object per line, or none (default: text)\n"
+						<< "  --compare \"<options>\"       Render every scene (or the given one) with these options and with <options>, and compare time and quality\n"
+						<< "  --max-error <rmse>          RMSE above which --compare fails (default: " << DEFAULT_MAX_COMPARISON_ERROR << ")\n"
+						<< "  --threads <n>               Worker threads (default: detected from the cgroup CPU quota and the affinity mask)\n"
+						<< "  --stats                     Print scene statistics (counts, bounds, materials, memory)\n"
+						<< "  --profile <file>            Count the intersection tests, hits, shadow occlusions and traversal steps of every object and write them ranked to <file>\n"
+						<< "SIGINT or SIGTERM stops the render, writes the partial image (and checkpoint) and exits with status " << CANCELLED_EXIT_STATUS << ".\n";
+}
+
+/**
+ * @brief Parses the command line
+ * @param[in]  argc        Argument count
+ * @param[in]  argv        Arguments
+ * @param[out] outSettings Parsed settings
+ * @return Whether the command line was valid
+ */
+bool ParseArguments(int argc, char* argv[], RenderSettings& outSettings)
+{
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string argument(argv[i]);
+		if (argument == "--aa")
+			outSettings.antiAliasing = true;
+		else if (argument == "--msaa")
+			outSettings.antiAliasing = outSettings.multisampling = true;
+		else if (argument == "--shading-rate" and i + 1 < argc and (std::string(argv[i + 1]) == "2" or std::string(argv[i + 1]) == "4"))
+			outSettings.shadingRate = std::stoi(argv[++i]);
+		else if (argument == "--mirror-packets")
+			outSettings.mirrorPackets = true;
+		else if (argument == "--preview" and i + 1 < argc)
+		{
+			std::string mode(argv[++i]);
+			if (mode != "quarter" and mode != "sixteenth" and mode != "checkerboard")
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+			outSettings.preview = (mode == "quarter") ? PREVIEW_QUARTER : (mode == "sixteenth") ? PREVIEW_SIXTEENTH : PREVIEW_CHECKERBOARD;
+		}
+		else if (argument == "--shading-threshold" and i + 1 < argc)
+		{
+			char* end;
+			outSettings.shadingThreshold = std::strtof(argv[++i], &end);
+			if (*end != '\0' or !(outSettings.shadingThreshold >= 0.0f))
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+		}
+		else if (argument == "--reorder" and i + 1 < argc)
+		{
+			std::string curve(argv[++i]);
+			if (curve != "morton" and curve != "hilbert")
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+			outSettings.reorderCurve = (curve == "morton") ? MORTON_CURVE : HILBERT_CURVE;
+		}
+		else if (argument == "--time-budget" and i + 1 < argc)
+		{
+			char* end;
+			outSettings.timeBudget = std::strtod(argv[++i], &end);
+			if (*end != '\0' or !(outSettings.timeBudget > 0.0))
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+		}
+		else if (argument == "--converge" and i + 1 < argc)
+		{
+			char* end;
+			outSettings.targetError = std::strtof(argv[++i], &end);
+			if (*end != '\0' or !(outSettings.targetError > 0.0f))
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+		}
+		else if (argument == "--checkpoint" and i + 1 < argc)
+			outSettings.checkpointFileName = argv[++i];
+		else if (argument == "--checkpoint-interval" and i + 1 < argc and std::atoi(argv[i + 1]) > 0)
+			outSettings.checkpointInterval = std::atoi(argv[++i]);
+		else if (argument == "--shm" and i + 1 < argc)
+			outSettings.framebufferName = argv[++i];
+		else if (argument == "--shm-format" and i + 1 < argc)
+		{
+			std::string format(argv[++i]);
+			if (format != "u8" and format != "f32")
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+			outSettings.framebufferFormat = (format == "u8") ? FRAMEBUFFER_U8 : FRAMEBUFFER_F32;
+		}
+		else if (argument == "--interactive" and i + 1 < argc)
+		{
+			char* end;
+			outSettings.targetFrameTime = std::strtod(argv[++i], &end);
+			if (*end != '\0' or !(outSettings.targetFrameTime > 0.0))
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+		}
+		else if (argument == "--resume")
+			outSettings.resume = true;
+		else if (argument == "--traversal" and i + 1 < argc)
+		{
+			std::string curve(argv[++i]);
+			if (curve != "scanline" and curve != "morton" and curve != "hilbert")
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+			outSettings.traversal = (curve == "scanline") ? NO_CURVE : (curve == "morton") ? MORTON_CURVE : HILBERT_CURVE;
+		}
+		else if (argument == "--progress" and i + 1 < argc)
+		{
+			std::string format(argv[++i]);
+			if (format != "text" and format != "json" and format != "none")
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+			outSettings.progressFormat = (format == "text") ? PROGRESS_TEXT : (format == "json") ? PROGRESS_JSON : PROGRESS_NONE;
+		}
+		else if (argument == "--compare" and i + 1 < argc)
+			outSettings.compareOptions = argv[++i];
+		else if (argument == "--max-error" and i + 1 < argc)
+		{
+			char* end;
+			outSettings.maxComparisonError = std::strtof(argv[++i], &end);
+			if (*end != '\0' or !(outSettings.maxComparisonError >= 0.0f))
+			{
+				PrintUsage(argv[0]);
+				return false;
+			}
+		}
+		else if (argument == "--threads" and i + 1 < argc and std::atoi(argv[i + 1]) > 0)
+			outSettings.numOfThreads = std::atoi(argv[++i]);
+		else if (argument == "--jobs" and i + 1 < argc)
+			outSettings.jobsFileName = argv[++i];
+		else if (argument == "--stats")
+			outSettings.printStatistics = true;
+		else if (argument == "--profile" and i + 1 < argc)
+			outSettings.profileFileName = argv[++i];
+		else if (argument == "--out-of-core")
+			outSettings.outOfCore = true;
+		else if (argument == "--packed" and i + 1 < argc)
+			outSettings.packedFileName = argv[++i];
+		else if (argument == "--quantize" and i + 1 < argc and (std::string(argv[i + 1]) == "16" or std::string(argv[i + 1]) == "21"))
+			outSettings.quantizationBits = std::stoi(argv[++i]);
+		else if (argument == "--lod")
+			outSettings.levelsOfDetail = true;
+		else if (argument == "--texture-cache" and i + 1 < argc and std::atoi(argv[i + 1]) > 0)
+			outSettings.textureCacheBytes = static_cast<size_t>(std::atoi(argv[++i])) << 20;
+		else if (argument[0] != '-' and outSettings.sceneFileName.empty())
+			outSettings.sceneFileName = argument;
+		else
+		{
+			PrintUsage(argv[0]);
+			return false;
+		}
+	}
+
+	if (outSettings.outOfCore and !outSettings.jobsFileName.empty())
+	{
+		std::cerr << "--out-of-core renders a single scene and cannot be combined with --jobs.\n";
+		return false;
+	}
+	if (!outSettings.checkpointFileName.empty() and (outSettings.outOfCore or !outSettings.jobsFileName.empty()))
+	{
+		std::cerr << "--checkpoint renders a single scene through the tile scheduler and cannot be combined with --out-of-core or --jobs.\n";
+		return false;
+	}
+	if (!outSettings.framebufferName.empty() and (outSettings.outOfCore or !outSettings.jobsFileName.empty()))
+	{
+		std::cerr << "--shm renders a single scene through the tile scheduler and cannot be combined with --out-of-core or --jobs.\n";
+		return false;
+	}
+	if (!outSettings.compareOptions.empty() and !outSettings.jobsFileName.empty())
+	{
+		std::cerr << "--compare renders the scenes in ./test itself and cannot be combined with --jobs.\n";
+		return false;
+	}
+	if (outSettings.resume and outSettings.checkpointFileName.empty())
+	{
+		std::cerr << "--resume needs the --checkpoint file to resume from.\n";
+		return false;
+	}
+	if (outSettings.outOfCore and (outSettings.multisampling or outSettings.shadingRate > 1 or outSettings.mirrorPackets or outSettings.quantizationBits > 0))
+	{
+		std::cerr << "--msaa, --shading-rate and --mirror-packets render through the tile scheduler and --quantize packs the in-memory triangles, so they cannot be combined with --out-of-core.\n";
+		return false;
+	}
+	if (outSettings.mirrorPackets and (outSettings.antiAliasing or outSettings.shadingRate > 1 or outSettings.timeBudget > 0.0 or outSettings.targetError > 0.0f
+			or outSettings.preview != PREVIEW_NONE or outSettings.targetFrameTime > 0.0))
+	{
+		std::cerr << "--mirror-packets traces one primary ray per pixel in a single pass and cannot be combined with --aa, --msaa, --shading-rate, --time-budget, --converge, --preview or --interactive.\n";
+		return false;
+	}
+	if (outSettings.levelsOfDetail and (outSettings.outOfCore or outSettings.mirrorPackets))
+	{
+		std::cerr << "--lod keeps meshes apart from the scene's objects and cannot be combined with --out-of-core or --mirror-packets.\n";
+		return false;
+	}
+	if (!outSettings.profileFileName.empty() and (outSettings.outOfCore or !outSettings.jobsFileName.empty() or !outSettings.compareOptions.empty() or outSettings.targetFrameTime > 0.0))
+	{
+		std::cerr << "--profile reports on a single render and cannot be combined with --out-of-core, --jobs, --compare or --interactive.\n";
+		return false;
+	}
+	if (outSettings.preview != PREVIEW_NONE and (!outSettings.jobsFileName.empty() or outSettings.outOfCore or !outSettings.checkpointFileName.empty() or !outSettings.framebufferName.empty()
+			or outSettings.timeBudget > 0.0 or outSettings.targetError > 0.0f))
+	{
+		std::cerr << "--preview renders a single scene on its own and cannot be combined with --jobs, --out-of-core, --checkpoint, --shm, --time-budget or --converge.\n";
+		return false;
+	}
+	if (outSettings.targetFrameTime > 0.0 and outSettings.framebufferName.empty())
+	{
+		std::cerr << "--interactive renders into a shared-memory framebuffer and needs --shm.\n";
+		return false;
+	}
+	if (outSettings.targetFrameTime > 0.0 and (!outSettings.checkpointFileName.empty() or outSettings.timeBudget > 0.0 or outSettings.targetError > 0.0f
+			or outSettings.preview != PREVIEW_NONE or !outSettings.compareOptions.empty()))
+	{
+		std::cerr << "--interactive cannot be combined with --checkpoint, --time-budget, --converge, --preview or --compare.\n";
+		return false;
+	}
+	if (outSettings.shadingRate > 1 and (outSettings.timeBudget > 0.0 or outSettings.targetError > 0.0f))
+	{
+		std::cerr << "--shading-rate renders every pixel once and cannot be combined with --time-budget or --converge.\n";
+		return false;
+	}
+	if (outSettings.outOfCore and (outSettings.timeBudget > 0.0 or outSettings.targetError > 0.0f))
+	{
+		std::cerr << "--time-budget and --converge render through the tile scheduler and cannot be combined with --out-of-core.\n";
+		return false;
+	}
+	return true;
+}
+
+// Summary of the scene gathered while loading it
+struct SceneStatistics
+{
+	size_t numOfRecords;				// Object records in the .test file
+	size_t numOfDegenerate;			// Records dropped because no ray can hit them
+	size_t numOfDuplicates;			// Records dropped because an earlier record has the same geometry
+	size_t numOfSpheres;				// Spheres kept
+	size_t numOfTriangles;			// Triangles kept
+	size_t numOfMaterials;			// Distinct materials among the kept objects
+	size_t numOfHugePrimitives; // Kept objects whose bounds span a large part of the scene
+	Bounds bounds;							// Bounds of the kept objects
+	size_t memoryBytes;					// Memory used by the scene objects and lights
+	size_t numOfQuantized;			// Triangles stored quantized (--quantize)
+	size_t numOfQuantizedMeshes; // Mesh objects the quantized triangles are grouped into
+	size_t numOfCollapsed;			// Triangles dropped because they collapse once quantized
+	size_t numOfUnquantized;		// Triangles kept at full precision although quantizing (textured ones and meshes with levels of detail)
+	size_t quantizedBytes;			// Memory used by the quantized triangles, including their mesh objects
+
+	/**
+	 * @brief Constructor
+	 */
+	SceneStatistics()
+		: numOfRecords(0), numOfDegenerate(0), numOfDuplicates(0), numOfSpheres(0), numOfTriangles(0), numOfMaterials(0), numOfHugePrimitives(0), memoryBytes(0),
+			numOfQuantized(0), numOfQuantizedMeshes(0), numOfCollapsed(0), numOfUnquantized(0), quantizedBytes(0)
+	{
+	}
+};
+
+/**
+ * @brief Orders records by geometry and visibility, treating rotations of a triangle's vertices (same winding) as equal
+ */
+struct GeometryLess
+{
+	const std::vector<PackedPrimitive>* primitives; // Records being compared
+
+	/**
+	 * @brief Writes the geometry of a record with the lexicographically smallest vertex of a triangle first
+	 * @param[in]  primitive Record
+	 * @param[out] outKey    Type, the 9 data values and the visibility mask
+	 */
+	static void CanonicalKey(const PackedPrimitive& primitive, float outKey[11])
+	{
+		int first(0);
+		outKey[0] = static_cast<float>(primitive.type);
+		if (primitive.type == TRIANGLE_PRIMITIVE)
+		{
+			for (int v = 1; v < 3; ++v)
+			{
+				if (std::lexicographical_compare(primitive.data + (v * 3), primitive.data + (v * 3) + 3, primitive.data + (first * 3), primitive.data + (first * 3) + 3))
+					first = v;
+			}
+		}
+		for (int i = 0; i < 9; ++i)
+			outKey[i + 1] = (primitive.type == TRIANGLE_PRIMITIVE) ? primitive.data[((first * 3) + i) % 9] : primitive.data[i];
+		outKey[10] = static_cast<float>(primitive.visibility);
+	}
+
+	/**
+	 * @brief Checks whether two records have the same geometry and visibility
+	 */
+	static bool SameGeometry(const PackedPrimitive& a, const PackedPrimitive& b)
+	{
+		float keyA[11], keyB[11];
+		CanonicalKey(a, keyA);
+		CanonicalKey(b, keyB);
+		return std::equal(keyA, keyA + 11, keyB);
+	}
+
+	bool operator()(const size_t& a, const size_t& b) const
+	{
+		float keyA[11], keyB[11];
+		CanonicalKey((*primitives)[a], keyA);
+		CanonicalKey((*primitives)[b], keyB);
+		if (std::equal(keyA, keyA + 11, keyB))
+			return a < b;
+		return std::lexicographical_compare(keyA, keyA + 11, keyB, keyB + 11);
+	}
+};
+
+/**
+ * @brief Drops records that only cost intersection tests: degenerate objects and exact geometric duplicates.
+ * Of a set of duplicates the first record in file order is kept, because it is also the one Raycast() reports on ties.
+ * @param[in,out] primitives Records in file order (the order of the kept records is preserved)
+ * @param[in,out] statistics Receives the number of dropped records
+ */
+void RemoveUselessPrimitives(std::vector<PackedPrimitive>& primitives, SceneStatistics& statistics)
+{
+	std::vector<char> keep(primitives.size(), 1);
+	std::vector<size_t> order;
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		if (IsDegenerate(primitives[i]))
+		{
+			keep[i] = 0;
+			++statistics.numOfDegenerate;
+		}
+		else
+			order.push_back(i);
+	}
+
+	GeometryLess less;
+	less.primitives = &primitives;
+	std::sort(order.begin(), order.end(), less);
+	for (size_t i = 1; i < order.size(); ++i)
+	{
+		if (GeometryLess::SameGeometry(primitives[order[i - 1]], primitives[order[i]]))
+		{
+			keep[order[i]] = 0;
+			++statistics.numOfDuplicates;
+		}
+	}
+
+	size_t kept(0);
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		if (keep[i])
+			primitives[kept++] = primitives[i];
+	}
+	primitives.resize(kept);
+}
+
+/**
+ * @brief Fills in the counts, bounds and material statistics of the kept records
+ * @param[in]     primitives Kept records
+ * @param[in,out] statistics Statistics to fill in
+ */
+void GatherSceneStatistics(const std::vector<PackedPrimitive>& primitives, SceneStatistics& statistics)
+{
+	std::vector<std::array<float, 11>> materials;
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		const Material& material(primitives[i].material);
+		++(primitives[i].type == SPHERE_PRIMITIVE ? statistics.numOfSpheres : statistics.numOfTriangles);
+		statistics.bounds.Grow(primitives[i].GetBounds());
+		materials.push_back({{material.ambient.r, material.ambient.g, material.ambient.b, material.diffuse.r, material.diffuse.g, material.diffuse.b, material.specular.r, material.specular.g, material.specular.b, material.shininess, static_cast<float>(material.texture)}});
+	}
+	std::sort(materials.begin(), materials.end());
+	statistics.numOfMaterials = std::unique(materials.begin(), materials.end()) - materials.begin();
+
+	float sceneSize(glm::length(statistics.bounds.max - statistics.bounds.min));
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		Bounds bounds(primitives[i].GetBounds());
+		if (glm::length(bounds.max - bounds.min) > HUGE_PRIMITIVE_FRACTION * sceneSize)
+			++statistics.numOfHugePrimitives;
+	}
+}
+
+/**
+ * @brief Prints warnings about scene shapes that make rendering slow or wrong
+ * @param[in] statistics Scene statistics
+ * @param[in] scene      Scene data
+ * @param[in] verbose    Whether to also warn about shapes that are only a performance concern
+ */
+void WarnAboutScene(const SceneStatistics& statistics, const Scene& scene, const bool& verbose)
+{
+	if (statistics.numOfDegenerate + statistics.numOfDuplicates > 0)
+		std::cerr << "Warning: removed " << statistics.numOfDegenerate << " degenerate and " << statistics.numOfDuplicates << " duplicate objects.\n";
+	if (statistics.numOfSpheres + statistics.numOfTriangles == 0)
+		std::cerr << "Warning: the scene has no objects.\n";
+	if (scene.lights.empty())
+		std::cerr << "Warning: the scene has no lights, the image will be black.\n";
+	if (verbose and statistics.numOfHugePrimitives > 0 and statistics.numOfSpheres + statistics.numOfTriangles > 1)
+		std::cerr << "Warning: " << statistics.numOfHugePrimitives << " objects span more than " << (HUGE_PRIMITIVE_FRACTION * 100.0f) << "% of the scene; they overlap most of any spatial subdivision and will hurt acceleration quality.\n";
+}
+
+/**
+ * @brief Prints the scene statistics
+ * @param[in] statistics Scene statistics
+ */
+void PrintSceneStatistics(const SceneStatistics& statistics)
+{
+	std::cout << "Scene statistics\n"
+						<< "  Records:    " << statistics.numOfRecords << " (" << statistics.numOfDegenerate << " degenerate, " << statistics.numOfDuplicates << " duplicate removed)\n"
+						<< "  Objects:    " << statistics.numOfSpheres << " spheres, " << statistics.numOfTriangles << " triangles\n"
+						<< "  Materials:  " << statistics.numOfMaterials << " distinct\n"
+						<< "  Bounds:     (" << statistics.bounds.min.x << ", " << statistics.bounds.min.y << ", " << statistics.bounds.min.z << ") - ("
+						<< statistics.bounds.max.x << ", " << statistics.bounds.max.y << ", " << statistics.bounds.max.z << ")\n"
+						<< "  Memory:     " << statistics.memoryBytes << " bytes\n"
+						<< "  Huge:       " << statistics.numOfHugePrimitives << " objects span more than " << (HUGE_PRIMITIVE_FRACTION * 100.0f) << "% of the scene\n";
+	if (statistics.numOfQuantized > 0)
+		std::cout << "  Quantized:  " << statistics.numOfQuantized << " triangles in " << statistics.numOfQuantizedMeshes << " meshes, "
+							<< (static_cast<double>(statistics.quantizedBytes) / statistics.numOfQuantized) << " bytes per triangle (" << (sizeof(Triangle) + sizeof(SceneObject*)) << " at full precision), "
+							<< statistics.numOfCollapsed << " collapsed and dropped, " << statistics.numOfUnquantized << " kept at full precision\n";
+}
+
+/**
+ * @brief Sorts records along a space-filling curve through the centers of their bounds.
+ * Objects are created in this order, so spatially close objects also end up close in Scene::objects and on the heap.
+ * @param[in,out] primitives Records to sort
+ * @param[in]     curve      Curve to sort along
+ */
+void ReorderPrimitives(std::vector<PackedPrimitive>& primitives, const SpaceFillingCurve& curve)
+{
+	Bounds centroidBounds;
+	for (size_t i = 0; i < primitives.size(); ++i)
+		centroidBounds.Grow(primitives[i].GetBounds().Center());
+
+	std::vector<std::pair<uint32_t, size_t>> order(primitives.size());
+	for (size_t i = 0; i < primitives.size(); ++i)
+		order[i] = std::make_pair(CurveCode(curve, primitives[i].GetBounds().Center(), centroidBounds), i);
+	std::sort(order.begin(), order.end());
+
+	std::vector<PackedPrimitive> reordered(primitives.size());
+	for (size_t i = 0; i < order.size(); ++i)
+		reordered[i] = primitives[order[i].second];
+	primitives.swap(reordered);
+}
+
+/**
+ * @brief Checks whether two records can belong to the same mesh: untextured triangles with the same material and visibility
+ */
+bool IsSameMesh(const PackedPrimitive& a, const PackedPrimitive& b)
+{
+	return a.type == TRIANGLE_PRIMITIVE and b.type == TRIANGLE_PRIMITIVE and a.material.texture == NO_TEXTURE and b.material.texture == NO_TEXTURE
+		and a.visibility == b.visibility and a.material.ambient == b.material.ambient and a.material.diffuse == b.material.diffuse
+		and a.material.specular == b.material.specular and a.material.shininess == b.material.shininess;
+}
+
+/**
+ * @brief Builds the levels of detail of a mesh by vertex clustering: the vertices are snapped to the average of the vertices in the same
+ * cell of a grid, and triangles that collapse are dropped. Every level clusters the original triangles, starting with cells the size of
+ * the average edge and doubling the cell size until the level drops enough triangles. A level's error is the farthest a vertex moved.
+ * @param[in] records Triangle records of the mesh
+ * @return Newly allocated mesh (owned by the caller)
+ */
+LodMesh* BuildLodMesh(const std::vector<PackedPrimitive>& records)
+{
+	LodMesh* mesh = new LodMesh();
+	float edgeLengthSum(0.0f);
+	mesh->visibility = records[0].visibility;
+	mesh->levels.resize(1);
+	mesh->levels[0].error = 0.0f;
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+		mesh->bounds.Grow(records[i].GetBounds());
+		mesh->levels[0].triangles.push_back(static_cast<Triangle*>(CreateSceneObject(records[i])));
+		for (int v = 0; v < 3; ++v)
+		{
+			const float* a(records[i].data + (v * 3));
+			const float* b(records[i].data + (((v + 1) % 3) * 3));
+			edgeLengthSum += glm::length(glm::vec3(a[0], a[1], a[2]) - glm::vec3(b[0], b[1], b[2]));
+		}
+	}
+
+	// Cells are keyed by LOD_CELL_BITS per axis, so they never get so small that a long, thin mesh runs out of keys
+	glm::vec3 extent(mesh->bounds.max - mesh->bounds.min);
+	float maxCell(static_cast<float>((1 << LOD_CELL_BITS) - 1));
+	float cellSize(std::max(edgeLengthSum / static_cast<float>(records.size() * 3), std::max(extent.x, std::max(extent.y, extent.z)) / maxCell));
+	while (mesh->levels.size() < static_cast<size_t>(MAX_LOD_LEVELS) and cellSize < glm::length(extent) and cellSize > 0.0f)
+	{
+		// Cell of every vertex, and the average of the vertices in every cell
+		std::map<uint64_t, std::pair<glm::vec3, int>> clusters;
+		std::vector<uint64_t> cells(records.size() * 3);
+		for (size_t i = 0; i < cells.size(); ++i)
+		{
+			const float* p(records[i / 3].data + ((i % 3) * 3));
+			glm::vec3 position(p[0], p[1], p[2]);
+			glm::vec3 cell(glm::clamp(glm::floor((position - mesh->bounds.min) / cellSize), 0.0f, maxCell));
+			cells[i] = (static_cast<uint64_t>(cell.x) << (2 * LOD_CELL_BITS)) | (static_cast<uint64_t>(cell.y) << LOD_CELL_BITS) | static_cast<uint64_t>(cell.z);
+			std::pair<glm::vec3, int>& cluster(clusters[cells[i]]);
+			cluster.first = cluster.first + position;
+			++cluster.second;
+		}
+
+		// Triangles whose corners stay in three different cells, once each (with the same winding)
+		std::vector<std::array<uint64_t, 3>> kept;
+		for (size_t i = 0; i < records.size(); ++i)
+		{
+			std::array<uint64_t, 3> corners = {{cells[i * 3], cells[(i * 3) + 1], cells[(i * 3) + 2]}};
+			if (corners[0] == corners[1] or corners[1] == corners[2] or corners[2] == corners[0])
+				continue;
+			std::rotate(corners.begin(), std::min_element(corners.begin(), corners.end()), corners.end());
+			kept.push_back(corners);
+		}
+		std::sort(kept.begin(), kept.end());
+		kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+
+		if (kept.empty())
+			break;
+		if (kept.size() > LOD_MIN_REDUCTION * mesh->levels.back().triangles.size())
+		{
+			cellSize *= 2.0f;
+			continue;
+		}
+
+		// The error of the level is how far the farthest vertex moved
+		LodLevel level;
+		level.error = 0.0f;
+		for (size_t i = 0; i < cells.size(); ++i)
+		{
+			const float* p(records[i / 3].data + ((i % 3) * 3));
+			const std::pair<glm::vec3, int>& cluster(clusters[cells[i]]);
+			level.error = std::max(level.error, glm::length(glm::vec3(p[0], p[1], p[2]) - (cluster.first / static_cast<float>(cluster.second))));
+		}
+		for (size_t i = 0; i < kept.size(); ++i)
+		{
+			PackedPrimitive triangle(records[0]);
+			for (int v = 0; v < 3; ++v)
+			{
+				const std::pair<glm::vec3, int>& cluster(clusters[kept[i][v]]);
+				glm::vec3 position(cluster.first / static_cast<float>(cluster.second));
+				triangle.data[v * 3] = position.x;
+				triangle.data[(v * 3) + 1] = position.y;
+				triangle.data[(v * 3) + 2] = position.z;
+			}
+			if (!IsDegenerate(triangle))
+				level.triangles.push_back(static_cast<Triangle*>(CreateSceneObject(triangle)));
+		}
+		mesh->levels.push_back(level);
+		cellSize *= 2.0f;
+	}
+	return mesh;
+}
+
+/**
+ * @brief Moves every run of at least LOD_MIN_TRIANGLES consecutive records that form a mesh out of the records and into meshes with levels of detail
+ * @param[in,out] primitives Records in file order (the records of the meshes are removed)
+ * @param[out]    scene      Scene that receives the meshes
+ */
+void BuildLevelsOfDetail(std::vector<PackedPrimitive>& primitives, Scene& scene)
+{
+	size_t kept(0);
+	for (size_t first = 0, last = 0; first < primitives.size(); first = last)
+	{
+		last = first + 1;
+		while (last < primitives.size() and IsSameMesh(primitives[first], primitives[last]))
+			++last;
+
+		// IsSameMesh() of a record with itself tells whether it can belong to a mesh at all
+		if (last - first >= LOD_MIN_TRIANGLES and IsSameMesh(primitives[first], primitives[first]))
+			scene.meshes.push_back(BuildLodMesh(std::vector<PackedPrimitive>(primitives.begin() + first, primitives.begin() + last)));
+		else
+		{
+			for (size_t i = first; i < last; ++i)
+				primitives[kept++] = primitives[i];
+		}
+	}
+	primitives.resize(kept);
+}
+
+/**
+ * @brief Checks whether a file generated from another one (packed geometry, tiled texture) can be reused: it is at least as recent
+ * as its source, starts with the magic of the current format, and was built with the same options (the 64-bit word after the magic)
+ * @param[in] path            Generated file
+ * @param[in] sourcePath      File it was generated from
+ * @param[in] expectedMagic   8-byte magic of the current format
+ * @param[in] expectedOptions Build options that the file must have been generated with
+ * @return Whether the generated file is up to date
+ */
+bool IsGeneratedFileUpToDate(const std::string& path, const std::string& sourcePath, const char expectedMagic[8], const uint64_t& expectedOptions)
+{
+	std::error_code error;
+	std::filesystem::file_time_type time(std::filesystem::last_write_time(path, error));
+	if (error)
+		return false;
+	std::filesystem::file_time_type sourceTime(std::filesystem::last_write_time(sourcePath, error));
+	if (error or time < sourceTime)
+		return false;
+
+	char magic[8];
+	uint64_t options;
+	std::ifstream generatedFile(path, std::ios::binary);
+	generatedFile.read(magic, sizeof(magic));
+	generatedFile.read(reinterpret_cast<char*>(&options), sizeof(options));
+	return generatedFile and std::memcmp(magic, expectedMagic, sizeof(magic)) == 0 and options == expectedOptions;
+}
+
+/**
+ * @brief Reads a binary PPM (P6) image
+ * @param[in]  path      Path of the image
+ * @param[out] outWidth  Width in pixels
+ * @param[out] outHeight Height in pixels
+ * @param[out] outTexels Pixels in scanline order from the top, as RGBA with 8 bits per channel (alpha 255)
+ * @return Whether the image could be read
+ */
+bool ReadPortablePixmap(const std::string& path, uint32_t& outWidth, uint32_t& outHeight, std::vector<uint32_t>& outTexels)
+{
+	std::ifstream imageFile(path, std::ios::binary);
+	std::string magic;
+	uint32_t values[3];
+	imageFile >> magic;
+	if (magic != "P6")
+		return false;
+
+	// Width, height and maximum value, each possibly preceded by comments
+	for (int i = 0; i < 3; ++i)
+	{
+		imageFile >> std::ws;
+		while (imageFile.peek() == '#')
+		{
+			imageFile.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			imageFile >> std::ws;
+		}
+		imageFile >> values[i];
+	}
+	imageFile.get();
+	outWidth = values[0];
+	outHeight = values[1];
+	if (!imageFile or outWidth == 0 or outHeight == 0 or values[2] == 0 or values[2] > 65535)
+		return false;
+
+	size_t bytesPerChannel((values[2] > 255) ? 2 : 1);
+	std::vector<unsigned char> row(static_cast<size_t>(outWidth) * 3 * bytesPerChannel);
+	outTexels.resize(static_cast<size_t>(outWidth) * outHeight);
+	for (uint32_t y = 0; y < outHeight; ++y)
+	{
+		if (!imageFile.read(reinterpret_cast<char*>(row.data()), row.size()))
+			return false;
+		for (uint32_t x = 0; x < outWidth; ++x)
+		{
+			uint32_t rgba(0xFF000000u);
+			for (size_t c = 0; c < 3; ++c)
+			{
+				const unsigned char* value(&row[((x * 3) + c) * bytesPerChannel]);
+				uint32_t channel((bytesPerChannel == 2) ? ((value[0] << 8) | value[1]) : value[0]);
+				rgba |= ((channel * 255 + (values[2] / 2)) / values[2]) << (c * 8);
+			}
+			outTexels[(static_cast<size_t>(y) * outWidth) + x] = rgba;
+		}
+	}
+	return true;
+}
+
+/**
+ * @brief Converts a PPM image into a tiled texture file with a full mip chain, so that rendering only reads the tiles it samples.
+ * Each level is a 2x2 box-filtered copy of the previous one. Edge tiles are padded by repeating the last row and column.
+ * @param[in] sourcePath Path of the PPM image
+ * @param[in] path       Path of the tiled texture file to write
+ * @return Whether the image could be read and the file written
+ */
+bool BuildTiledTexture(const std::string& sourcePath, const std::string& path)
+{
+	TiledTextureHeader header;
+	std::vector<std::vector<uint32_t>> levelTexels(1);
+	std::vector<TextureLevel> levels(1);
+	if (!ReadPortablePixmap(sourcePath, levels[0].width, levels[0].height, levelTexels[0]))
+		return false;
+
+	while (levels.back().width > 1 or levels.back().height > 1)
+	{
+		const TextureLevel& previous(levels.back());
+		const std::vector<uint32_t>& previousTexels(levelTexels.back());
+		TextureLevel level;
+		level.width = std::max<uint32_t>(previous.width / 2, 1);
+		level.height = std::max<uint32_t>(previous.height / 2, 1);
+		std::vector<uint32_t> texels(static_cast<size_t>(level.width) * level.height);
+		for (uint32_t y = 0; y < level.height; ++y)
+		{
+			for (uint32_t x = 0; x < level.width; ++x)
+			{
+				uint32_t x0(std::min(x * 2, previous.width - 1)), x1(std::min((x * 2) + 1, previous.width - 1));
+				uint32_t y0(std::min(y * 2, previous.height - 1)), y1(std::min((y * 2) + 1, previous.height - 1));
+				uint32_t quad[4] = {previousTexels[(static_cast<size_t>(y0) * previous.width) + x0], previousTexels[(static_cast<size_t>(y0) * previous.width) + x1],
+					previousTexels[(static_cast<size_t>(y1) * previous.width) + x0], previousTexels[(static_cast<size_t>(y1) * previous.width) + x1]};
+				uint32_t rgba(0);
+				for (int c = 0; c < 4; ++c)
+				{
+					uint32_t sum(2);
+					for (int i = 0; i < 4; ++i)
+						sum += (quad[i] >> (c * 8)) & 0xFF;
+					rgba |= (sum / 4) << (c * 8);
+				}
+				texels[(static_cast<size_t>(y) * level.width) + x] = rgba;
+			}
+		}
+		levels.push_back(level);
+		levelTexels.push_back(texels);
+	}
+
+	uint64_t numOfTiles(0);
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		levels[l].tilesX = (levels[l].width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		levels[l].tilesY = (levels[l].height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		levels[l].firstTile = numOfTiles;
+		numOfTiles += static_cast<uint64_t>(levels[l].tilesX) * levels[l].tilesY;
+	}
+
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, TILED_TEXTURE_MAGIC, sizeof(TILED_TEXTURE_MAGIC));
+	header.buildOptions = TEXTURE_TILE_SIZE;
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.numOfLevels = static_cast<uint32_t>(levels.size());
+
+	std::string temporaryPath(path + ".tmp");
+	std::ofstream tiledFile(temporaryPath, std::ios::binary | std::ios::trunc);
+	tiledFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	tiledFile.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(TextureLevel));
+	std::vector<uint32_t> tile(TEXTURE_TILE_TEXELS);
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		for (uint32_t ty = 0; ty < levels[l].tilesY; ++ty)
+		{
+			for (uint32_t tx = 0; tx < levels[l].tilesX; ++tx)
+			{
+				for (uint32_t y = 0; y < static_cast<uint32_t>(TEXTURE_TILE_SIZE); ++y)
+				{
+					for (uint32_t x = 0; x < static_cast<uint32_t>(TEXTURE_TILE_SIZE); ++x)
+					{
+						uint32_t sourceX(std::min((tx * TEXTURE_TILE_SIZE) + x, levels[l].width - 1));
+						uint32_t sourceY(std::min((ty * TEXTURE_TILE_SIZE) + y, levels[l].height - 1));
+						tile[(y * TEXTURE_TILE_SIZE) + x] = levelTexels[l][(static_cast<size_t>(sourceY) * levels[l].width) + sourceX];
+					}
+				}
+				tiledFile.write(reinterpret_cast<const char*>(tile.data()), tile.size() * sizeof(uint32_t));
+			}
+		}
+	}
+	tiledFile.close();
+	if (!tiledFile)
+		return false;
+
+	std::error_code error;
+	std::filesystem::rename(temporaryPath, path, error);
+	return !error;
+}
+
+/**
+ * @brief Opens the textures named by a scene's records, converting each PPM image into a tiled texture file (next to it, with
+ * a .tiled extension) unless that file is up to date, and sizes the texture cache
+ * @param[in]  textureNames Texture files named by the records, in the order of their indices
+ * @param[in]  scenePath    Path of the .test file (texture files are relative to its directory)
+ * @param[in]  budgetBytes  Memory budget of the texture cache
+ * @param[out] scene        Scene that receives the texture cache
+ * @return Whether every texture could be opened
+ */
+bool LoadTextures(const std::vector<std::string>& textureNames, const std::string& scenePath, const size_t& budgetBytes, Scene& scene)
+{
+	scene.textures.reset(new TextureCache());
+	for (size_t i = 0; i < textureNames.size(); ++i)
+	{
+		std::string sourcePath((std::filesystem::path(scenePath).parent_path() / textureNames[i]).string());
+		std::string path(sourcePath + ".tiled");
+		if (!IsGeneratedFileUpToDate(path, sourcePath, TILED_TEXTURE_MAGIC, TEXTURE_TILE_SIZE))
+		{
+			std::cout << "Tiling texture " << sourcePath << "..." << std::endl;
+			if (!BuildTiledTexture(sourcePath, path))
+			{
+				std::cerr << "Could not read texture " << sourcePath << " (expected a binary PPM image).\n";
+				return false;
+			}
+		}
+		if (!scene.textures->AddTexture(path))
+		{
+			std::cerr << "Could not read tiled texture " << path << ".\n";
+			return false;
+		}
+	}
+	scene.textures->Allocate(budgetBytes);
+	return true;
+}
+
+// Read-only stream buffer over characters in memory, so that records can be parsed in place with the usual stream operators
+struct MemoryStreamBuffer : public std::streambuf
+{
+	/**
+	 * @brief Constructor
+	 * @param[in] begin First character
+	 * @param[in] end   One past the last character
+	 */
+	MemoryStreamBuffer(char* begin, char* end)
+	{
+		setg(begin, begin, end);
+	}
+
+	/**
+	 * @return Number of characters read so far
+	 */
+	size_t Offset() const
+	{
+		return static_cast<size_t>(gptr() - eback());
+	}
+};
+
+/**
+ * @brief Finds a record boundary in the object section of a .test file: the end of the first object that starts after an offset.
+ * Prefix lines (visibility, texture, uv) belong to the object after them, so the end of an object is always followed by a new record.
+ * Records are recognized with GetRecordGeometrySize(), as ReadPrimitive() reads them.
+ * @param[in] text   Object section
+ * @param[in] offset Where to start looking (the token it falls into, or else the one before it, is skipped)
+ * @return Offset just past the end of the object (text.size() if no object starts after the offset)
+ */
+size_t FindRecordBoundary(const std::string& text, size_t offset)
+{
+	auto isSpace = [&text](const size_t& i) { return std::isspace(static_cast<unsigned char>(text[i])) != 0; };
+
+	// Start at the skipped token, since a texture file name after it is not a record
+	while (offset > 0 and offset < text.size() and !isSpace(offset - 1))
+		--offset;
+
+	std::string token, previous;
+	size_t numOfTokensLeft(0); // Tokens of the object found so far that are still to be skipped (0 while looking for an object)
+	bool skipped(false);			 // Whether the token the offset falls into has been skipped
+	while (true)
+	{
+		while (offset < text.size() and isSpace(offset))
+			++offset;
+		if (offset == text.size())
+			return offset;
+
+		size_t end(offset);
+		while (end < text.size() and !isSpace(end))
+			++end;
+		token.assign(text, offset, end - offset);
+		if (numOfTokensLeft > 0)
+		{
+			if (--numOfTokensLeft == 0)
+				return end;
+		}
+		else if (skipped and previous != "texture" and GetRecordGeometrySize(token) > 0)
+			numOfTokensLeft = GetRecordGeometrySize(token) + 10; // Geometry, material
+		previous.swap(token);
+		skipped = true;
+		offset = end;
+	}
+}
+
+/**
+ * @brief Reads the object records of a .test file on several threads. The rest of the file is read into memory and split into chunks
+ * at record boundaries; every chunk is parsed with ReadPrimitive() into its own records and texture names, which are then merged in
+ * file order, so the result is the same as reading the records one by one.
+ * @param[in,out] sceneFile       Seekable stream at the first record; on success it is left after the last one
+ * @param[in]     numOfObjects    Number of records
+ * @param[in]     numOfThreads    Number of threads to use (0 for DefaultThreadCount())
+ * @param[out]    outPrimitives   Records in file order
+ * @param[out]    outTextureNames Texture files in order of first use
+ * @param[in]     minChunkBytes   Smallest chunk to parse on a thread of its own
+ * @return Whether the records were read. If not (too little to parse to be worth it, a stream that cannot seek, or records that
+ * do not add up to numOfObjects), nothing is output and the stream is back at the first record, to be read serially.
+ */
+bool ReadPrimitivesInParallel(std::istream& sceneFile, const size_t& numOfObjects, unsigned numOfThreads, std::vector<PackedPrimitive>& outPrimitives, std::vector<std::string>& outTextureNames, const size_t& minChunkBytes = PARSE_MIN_CHUNK_BYTES)
+{
+	if (numOfThreads == 0)
+		numOfThreads = DefaultThreadCount();
+	std::streampos start(sceneFile.tellg());
+	if (numOfThreads < 2 or start == std::streampos(-1) or !sceneFile.seekg(0, std::ios::end))
+	{
+		sceneFile.clear();
+		sceneFile.seekg(start);
+		return false;
+	}
+
+	// Text mode can translate line ends, so the size is only an upper bound of what read() returns
+	std::streamoff size(sceneFile.tellg() - start);
+	sceneFile.seekg(start);
+	if (size < static_cast<std::streamoff>(2 * minChunkBytes))
+		return false;
+	std::string text(static_cast<size_t>(size), '\0');
+	sceneFile.read(&text[0], size);
+	text.resize(static_cast<size_t>(sceneFile.gcount()));
+	sceneFile.clear();
+	sceneFile.seekg(start);
+
+	size_t numOfChunks(std::min<size_t>(numOfThreads * PARSE_CHUNKS_PER_THREAD, text.size() / minChunkBytes));
+	std::vector<size_t> boundaries(1, 0);
+	for (size_t k = 1; k < numOfChunks; ++k)
+	{
+		size_t boundary(FindRecordBoundary(text, std::max(boundaries.back(), (text.size() * k) / numOfChunks)));
+		if (boundary > boundaries.back() and boundary < text.size())
+			boundaries.push_back(boundary);
+	}
+	boundaries.push_back(text.size());
+
+	// A chunk ends at its boundary, or before the light count after the last record
+	struct Chunk
+	{
+		std::vector<PackedPrimitive> primitives; // Records of the chunk
+		std::vector<std::string> textureNames;	 // Texture files named by the chunk's records (their indices)
+		size_t end;															 // Offset in the text where parsing stopped
+		bool valid;															 // Whether every record could be read
+	};
+	std::vector<Chunk> chunks(boundaries.size() - 1);
+	ParallelFor(chunks.size(), 1, numOfThreads, [&](const size_t& begin, const size_t& end) {
+		for (size_t c = begin; c < end; ++c)
+		{
+			Chunk& chunk(chunks[c]);
+			MemoryStreamBuffer buffer(&text[0] + boundaries[c], &text[0] + boundaries[c + 1]);
+			std::istream stream(&buffer);
+			PackedPrimitive primitive;
+			chunk.valid = true;
+			while ((stream >> std::ws) and std::isalpha(stream.peek()))
+			{
+				if (!ReadPrimitive(stream, primitive, chunk.textureNames))
+				{
+					chunk.valid = false;
+					break;
+				}
+				chunk.primitives.push_back(primitive);
+			}
+			chunk.end = boundaries[c] + buffer.Offset();
+		}
+	});
+
+	size_t numOfRead(0);
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		if (!chunks[c].valid)
+			return false;
+		numOfRead += chunks[c].primitives.size();
+	}
+	if (numOfRead != numOfObjects)
+		return false;
+
+	// Texture indices are per chunk until here
+	outPrimitives.clear();
+	outPrimitives.reserve(numOfRead);
+	outTextureNames.clear();
+	for (size_t c = 0; c < chunks.size(); ++c)
+	{
+		std::vector<int32_t> textureIndices;
+		for (size_t i = 0; i < chunks[c].textureNames.size(); ++i)
+		{
+			textureIndices.push_back(static_cast<int32_t>(std::find(outTextureNames.begin(), outTextureNames.end(), chunks[c].textureNames[i]) - outTextureNames.begin()));
+			if (textureIndices.back() == static_cast<int32_t>(outTextureNames.size()))
+				outTextureNames.push_back(chunks[c].textureNames[i]);
+		}
+		for (size_t i = 0; i < chunks[c].primitives.size(); ++i)
+		{
+			outPrimitives.push_back(chunks[c].primitives[i]);
+			if (outPrimitives.back().material.texture != NO_TEXTURE)
+				outPrimitives.back().material.texture = textureIndices[outPrimitives.back().material.texture];
+		}
+	}
+
+	// Skip what was parsed by characters rather than bytes, which is the same unless line ends were translated
+	sceneFile.ignore(static_cast<std::streamsize>(chunks.back().end));
+	return static_cast<bool>(sceneFile);
+}
+
+/**
+ * @brief Loads the camera, objects and lights of a .test file.
+ * In out-of-core mode the objects are converted into the packed geometry file (unless it is up to date) instead of being loaded.
+ * @param[in]  sceneFile   Opened .test file
+ * @param[in]  scenePath   Path of the .test file
+ * @param[in]  settings    Render settings
+ * @param[out] scene       Scene data
+ * @param[out] camera      Camera data
+ * @param[out] maxDepth    Maximum depth of the trace
+ * @param[out] statistics  Scene statistics (only gathered for scenes loaded into memory)
+ * @return Whether the scene could be loaded
+ */
+bool LoadScene(std::istream& sceneFile, const std::string& scenePath, const RenderSettings& settings, Scene& scene, Camera& camera, int& maxDepth, SceneStatistics& statistics)
+{
+	size_t numOfObjects, numOfLights;
+
+	// camera data
+	sceneFile >> camera.imageWidth >> camera.imageHeight;
+	sceneFile >> camera.position.x >> camera.position.y >> camera.position.z;
+	sceneFile >> camera.lookTarget.x >> camera.lookTarget.y >> camera.lookTarget.z;
+	sceneFile >> camera.globalUp.x >> camera.globalUp.y >> camera.globalUp.z;
+	sceneFile >> camera.fovY >> camera.focalLength;
+
+	sceneFile >> maxDepth >> numOfObjects;
+	statistics.numOfRecords = numOfObjects;
+
+	PackedPrimitive primitive;
+	std::vector<PackedPrimitive> primitives;
+	std::vector<std::string> textureNames;
+	if (settings.outOfCore and !IsGeneratedFileUpToDate(settings.packedFileName, scenePath, PACKED_GEOMETRY_MAGIC, PackedGeometryOptions(settings.reorderCurve)))
+	{
+		std::cout << "Packing geometry into " << settings.packedFileName << "..." << std::endl;
+		if (!BuildPackedGeometry(sceneFile, numOfObjects, settings.packedFileName, settings.reorderCurve, textureNames))
+			return false;
+	}
+	else if (settings.outOfCore or !ReadPrimitivesInParallel(sceneFile, numOfObjects, settings.numOfThreads, primitives, textureNames))
+	{
+		// Out-of-core mode with an up-to-date packed file only needs to skip past the records
+		for (size_t i = 0; i < numOfObjects; ++i)
+		{
+			if (!ReadPrimitive(sceneFile, primitive, textureNames))
+				return false;
+			if (!settings.outOfCore)
+				primitives.push_back(primitive);
+		}
+	}
+
+	if (settings.outOfCore and !textureNames.empty())
+		std::cerr << "Warning: textures are not applied in out-of-core mode.\n";
+	else if (!textureNames.empty() and !LoadTextures(textureNames, scenePath, settings.textureCacheBytes, scene))
+		return false;
+
+	RemoveUselessPrimitives(primitives, statistics);
+	GatherSceneStatistics(primitives, statistics);
+	scene.pixelSpread = 2.0f * glm::tan(glm::radians(camera.fovY) / 2) / static_cast<float>(camera.imageHeight);
+	if (settings.levelsOfDetail)
+		BuildLevelsOfDetail(primitives, scene);
+	if (settings.reorderCurve != NO_CURVE)
+		ReorderPrimitives(primitives, settings.reorderCurve);
+
+	if (settings.quantizationBits > 0)
 	{
-		infoTemp.t = scene.objects[i]->Intersect(infoTemp.incomingRay, infoTemp.intersectionPoint, infoTemp.intersectionNormal);
+		Bounds triangleBounds;
+		for (size_t i = 0; i < primitives.size(); ++i)
+		{
+			if (primitives[i].type == TRIANGLE_PRIMITIVE)
+				triangleBounds.Grow(primitives[i].GetBounds());
+		}
+		scene.quantizedGeometry.grid.Fit(triangleBounds, settings.quantizationBits);
+	}
 
-		// Set ret.t on first iteration
-		// Only set obj, point, and normal if infoTemp.t is an intersection
-		if (i == 0)
+	// Untextured triangles are quantized in runs with one material and visibility, each run becoming one mesh object
+	size_t numOfTextured(0);
+	for (size_t i = 0; i < primitives.size(); ++i)
+	{
+		if (primitives[i].type == TRIANGLE_PRIMITIVE and primitives[i].material.texture != NO_TEXTURE)
+			++numOfTextured;
+		if (settings.quantizationBits == 0 or !IsSameMesh(primitives[i], primitives[i]))
 		{
-			ret.t = infoTemp.t;
-			if (infoTemp.t != NO_INTERSECTION)
-			{
-				ret.obj = scene.objects[i];
-				ret.intersectionPoint = infoTemp.intersectionPoint;
-				ret.intersectionNormal = infoTemp.intersectionNormal;
-			}
-			else
-			{
-				ret.obj = nullptr;
-			}
+			scene.objects.push_back(CreateSceneObject(primitives[i]));
+			continue;
 		}
-		// On succeeding iterations, only overwrite ret if:
-		// both infoTemp and ret's t values are positive, and infoTemp.t is less than ret.t, OR
-		// ret.t has no intersection while infoTemp.t has
-		else
+
+		size_t last(i + 1), numOfCollapsed;
+		while (last < primitives.size() and IsSameMesh(primitives[i], primitives[last]))
+			++last;
+		SceneObject* mesh((settings.quantizationBits == 16)
+			? CreateQuantizedMesh<Vertex16>(primitives, i, last - i, scene.quantizedGeometry, numOfCollapsed)
+			: CreateQuantizedMesh<Vertex21>(primitives, i, last - i, scene.quantizedGeometry, numOfCollapsed));
+		if (mesh != nullptr)
 		{
-			if ((infoTemp.t > 0 and ret.t > 0 and infoTemp.t < ret.t) or (ret.t == NO_INTERSECTION and infoTemp.t > 0))
+			scene.objects.push_back(mesh);
+			++statistics.numOfQuantizedMeshes;
+		}
+		statistics.numOfQuantized += last - i - numOfCollapsed;
+		statistics.numOfCollapsed += numOfCollapsed;
+		i = last - 1;
+	}
+
+	if (settings.quantizationBits > 0)
+	{
+		QuantizedGeometry& geometry(scene.quantizedGeometry);
+		geometry.vertices16.shrink_to_fit();
+		geometry.vertices21.shrink_to_fit();
+		geometry.normals.shrink_to_fit();
+		statistics.numOfUnquantized = statistics.numOfTriangles - statistics.numOfQuantized - statistics.numOfCollapsed;
+		statistics.quantizedBytes = (geometry.vertices16.size() * sizeof(Vertex16)) + (geometry.vertices21.size() * sizeof(Vertex21)) + (geometry.normals.size() * sizeof(uint32_t))
+			+ (statistics.numOfQuantizedMeshes * (((settings.quantizationBits == 16) ? sizeof(QuantizedMesh<Vertex16>) : sizeof(QuantizedMesh<Vertex21>)) + sizeof(SceneObject*)));
+	}
+
+	statistics.memoryBytes = (statistics.numOfSpheres * sizeof(Sphere))
+		+ ((statistics.numOfTriangles - statistics.numOfQuantized - statistics.numOfCollapsed) * sizeof(Triangle)) + (numOfTextured * (sizeof(TexturedTriangle) - sizeof(Triangle)))
+		+ statistics.quantizedBytes
+		+ ((scene.objects.capacity() - statistics.numOfQuantizedMeshes) * sizeof(SceneObject*))
+		+ ((scene.textures != nullptr) ? scene.textures->MemoryBytes() : 0);
+
+	if (settings.levelsOfDetail)
+	{
+		std::vector<size_t> trianglesPerLevel;
+		for (size_t m = 0; m < scene.meshes.size(); ++m)
+		{
+			// The original triangles are already counted with the scene's triangles
+			statistics.memoryBytes += sizeof(LodMesh) + sizeof(LodMesh*);
+			for (size_t l = 0; l < scene.meshes[m]->levels.size(); ++l)
 			{
-				ret.t = infoTemp.t;
-				ret.obj = scene.objects[i];
-				ret.intersectionPoint = infoTemp.intersectionPoint;
-				ret.intersectionNormal = infoTemp.intersectionNormal;
+				if (l >= trianglesPerLevel.size())
+					trianglesPerLevel.push_back(0);
+				trianglesPerLevel[l] += scene.meshes[m]->levels[l].triangles.size();
+				statistics.memoryBytes += scene.meshes[m]->levels[l].triangles.size() * (((l > 0) ? sizeof(Triangle) : 0) + sizeof(Triangle*));
 			}
 		}
+		std::cout << "Built levels of detail for " << scene.meshes.size() << " meshes";
+		for (size_t l = 0; l < trianglesPerLevel.size(); ++l)
+			std::cout << ((l == 0) ? ": " : " -> ") << trianglesPerLevel[l];
+		std::cout << ((trianglesPerLevel.empty()) ? "" : " triangles per level") << std::endl;
 	}
-	return ret;
+
+	if (settings.quantizationBits > 0)
+	{
+		std::cout << "Quantized " << statistics.numOfQuantized << " triangles into " << statistics.numOfQuantizedMeshes << " meshes at " << settings.quantizationBits
+							<< " bits per axis (max position error " << scene.quantizedGeometry.grid.MaxError() << ", hit tests widened by it)";
+		if (statistics.numOfCollapsed > 0)
+			std::cout << ", dropped " << statistics.numOfCollapsed << " that collapse on the grid";
+		if (statistics.numOfUnquantized > 0)
+			std::cout << ", kept " << statistics.numOfUnquantized << " textured or level-of-detail triangles at full precision";
+		std::cout << std::endl;
+	}
+
+	sceneFile >> numOfLights;
+
+	Light light;
+	for (size_t i = 0; i < numOfLights; ++i)
+	{
+		sceneFile >> light.position.x >> light.position.y >> light.position.z >> light.position.w;
+		sceneFile >> light.ambient.r >> light.ambient.g >> light.ambient.b;
+		sceneFile >> light.diffuse.r >> light.diffuse.g >> light.diffuse.b;
+		sceneFile >> light.specular.r >> light.specular.g >> light.specular.b;
+		sceneFile >> light.constant >> light.linear >> light.quadratic;
+		scene.lights.push_back(light);
+	}
+	statistics.memoryBytes += scene.lights.capacity() * sizeof(Light);
+
+	if (!settings.outOfCore)
+		WarnAboutScene(statistics, scene, settings.printStatistics);
+	return static_cast<bool>(sceneFile);
 }
 
 /**
- * @brief Perform a ray-trace to the scene
- * @param[in] ray       Ray to trace
- * @param[in] scene     Scene data
- * @param[in] camera    Camera data
- * @param[in] maxDepth  Maximum depth of the trace
- * @return Resulting color after the ray bounced around the scene
+ * @brief Loads the scene of a render job and splits its image into tiles
+ * @param[in]  sceneFileName .test file inside ./test directory
+ * @param[in]  settings      Render settings
+ * @param[out] job           Job to fill in
+ * @return Whether the scene could be loaded (an error has been printed otherwise)
  */
-glm::vec3 RayTrace(const Ray& ray, const Scene& scene, const Camera& camera, int maxDepth = 1)
+bool LoadJob(const std::string& sceneFileName, const RenderSettings& settings, RenderJob& job)
 {
-	glm::vec3 color(BACKGROUND_COLOR);
-
-	glm::vec3 ambient, diffuse, specular;
-	glm::vec3 directionToLight;
-	float distanceToLight;
-	float diffuseStrength;
-	glm::vec3 reflectedLight;
-	float specularStrength;
-	float attenuation;
+	SceneStatistics sceneStatistics;
+	std::string scenePath("./test/" + sceneFileName);
 
-	Ray shadowRay;
-	IntersectionInfo shadowingInfo;
+	// The budget includes loading, so the image is ready the given time after the job was started
+	if (settings.timeBudget > 0.0)
+		job.SetTimeBudget(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(settings.timeBudget)));
+	if (settings.targetError > 0.0f)
+		job.SetTargetError(settings.targetError);
 
-	Ray reflectionRay;
+	// open .test file
+	std::ifstream sceneFile(scenePath);
+	if (!sceneFile)
+	{
+		std::cerr << "File not found: " << scenePath << "\n";
+		return false;
+	}
 
-	IntersectionInfo intersectionInfo = Raycast(ray, scene);
-	if (intersectionInfo.obj != nullptr)
+	if (!LoadScene(sceneFile, scenePath, settings, job.scene, job.camera, job.maxDepth, sceneStatistics))
 	{
-		// color = glm::vec3();
-		for (size_t i = 0; i < scene.lights.size(); ++i)
-		{
-			// AMBIENT
-			ambient = intersectionInfo.obj->material.ambient * (scene.lights[i].ambient / static_cast<float>(scene.lights.size()));
+		std::cerr << "Could not read " << scenePath << ".\n";
+		return false;
+	}
+	if (settings.printStatistics and !settings.outOfCore)
+		PrintSceneStatistics(sceneStatistics);
+	if (!settings.checkpointFileName.empty() and !HashRenderSource(scenePath, job.camera, job.sourceHash))
+	{
+		std::cerr << "Could not read " << scenePath << ".\n";
+		return false;
+	}
+
+	job.name = sceneFileName;
+	job.antiAliasing = settings.antiAliasing;
+	job.multisampling = settings.multisampling;
+	job.shadingRate = settings.shadingRate;
+	job.shadingThreshold = settings.shadingThreshold;
+	if (settings.mirrorPackets and job.maxDepth > 1)
+		job.mirrors = FindPlanarMirrors(job.scene);
+	if (!settings.profileFileName.empty())
+		job.scene.profile.reset(new RayCostProfile(job.scene.objects, job.scene.meshes));
+	job.traversal = settings.traversal;
+	job.CreateTiles();
+	return true;
+}
+
+// Cancelled by SIGINT and SIGTERM; every render started from the command line polls it
+CancellationToken interruptToken;
+
+/**
+ * @brief Signal handler for SIGINT and SIGTERM. The first signal asks the renders to stop and write what they have;
+ * a second one exits right away.
+ * @param[in] signalNumber Signal that was raised
+ */
+void HandleInterrupt(int signalNumber)
+{
+	if (interruptToken.IsCancelled())
+		std::_Exit(CANCELLED_EXIT_STATUS);
+	interruptToken.Cancel();
+	std::signal(signalNumber, HandleInterrupt);
+}
+
+/**
+ * @brief Renders the jobs listed in a job file concurrently on one shared thread pool.
+ * Every line is "<priority> <scene.test> [aa|msaa]"; other lines are ignored. A line is submitted as soon as it is read,
+ * so with "-" as the file name jobs can be fed through stdin while earlier ones are rendering.
+ * Every job is written to <scene>.png as soon as it finishes. Once interruptToken is cancelled no more jobs are read,
+ * and the jobs that are rendering are written with what they have.
+ * @param[in] settings Render settings (apply to every job)
+ * @return Exit status (CANCELLED_EXIT_STATUS if the renders were cancelled)
+ */
+int RunJobFile(const RenderSettings& settings)
+{
+	RenderScheduler scheduler;
+	std::atomic<bool> readAll(false);
+	std::atomic<size_t> numOfSubmitted(0);
+	size_t numOfCollected(0);
+
+	scheduler.Start(settings.numOfThreads);
 
-			// DIFFUSE
-			directionToLight = (scene.lights[i].position.w == POINT_LIGHT)
-				? glm::normalize(glm::vec3(scene.lights[i].position) - intersectionInfo.intersectionPoint)
-				: glm::normalize(glm::vec3(-scene.lights[i].position));
-			diffuseStrength = glm::max(glm::dot(directionToLight, intersectionInfo.intersectionNormal), 0.0f);
-			diffuse = diffuseStrength * intersectionInfo.obj->material.diffuse * scene.lights[i].diffuse;
+	std::thread reader([&] {
+		std::ifstream jobFile;
+		std::istream* input(&std::cin);
+		if (settings.jobsFileName != "-")
+		{
+			jobFile.open(settings.jobsFileName);
+			input = &jobFile;
+			if (!jobFile)
+				std::cerr << "File not found: " << settings.jobsFileName << "\n";
+		}
 
-			// SPECULAR
-			reflectedLight = glm::reflect(-directionToLight, intersectionInfo.intersectionNormal);
-			specularStrength = glm::pow(glm::max(glm::dot(reflectedLight, glm::normalize(camera.position - intersectionInfo.intersectionPoint)), 0.0f), intersectionInfo.obj->material.shininess);
-			specular = specularStrength * intersectionInfo.obj->material.specular * scene.lights[i].specular;
+		std::string line;
+		while (!interruptToken.IsCancelled() and std::getline(*input, line))
+		{
+			std::istringstream fields(line);
+			std::string sceneFileName, option;
+			int priority;
+			if (!(fields >> priority >> sceneFileName))
+				continue;
 
-			// ATTENUATION
-			attenuation = 1.0f;
+			RenderSettings jobSettings(settings);
+			while (fields >> option)
+			{
+				if (option == "aa")
+					jobSettings.antiAliasing = true;
+				else if (option == "msaa")
+					jobSettings.antiAliasing = jobSettings.multisampling = true;
+			}
+			if (jobSettings.mirrorPackets and jobSettings.antiAliasing)
+			{
+				std::cerr << "Skipping " << sceneFileName << ": --mirror-packets cannot be combined with anti-aliasing.\n";
+				continue;
+			}
 
-			if (scene.lights[i].position.w != DIRECTIONAL_LIGHT)
+			RenderJob* job = new RenderJob();
+			if (!LoadJob(sceneFileName, jobSettings, *job))
 			{
-				distanceToLight = glm::distance(intersectionInfo.intersectionPoint, glm::vec3(scene.lights[i].position));
-				attenuation = 1.0f / (scene.lights[i].constant + (scene.lights[i].linear * distanceToLight) + (scene.lights[i].quadratic * distanceToLight * distanceToLight));
+				delete job;
+				continue;
 			}
+			job->priority = priority;
+			job->cancellation = &interruptToken;
+			job->outputFileName = std::filesystem::path(sceneFileName).stem().string() + ".png";
+			++numOfSubmitted;
+			scheduler.Submit(job);
+		}
+		readAll = true;
+	});
 
-			// SHADOWING
-			shadowRay.origin = intersectionInfo.intersectionPoint + (intersectionInfo.intersectionNormal * SHADOW_BIAS);
-			shadowRay.direction = directionToLight;
-			shadowingInfo = Raycast(shadowRay, scene);
+	ProgressReporter reporter;
+	reporter.Start(settings.progressFormat, [&scheduler] { return scheduler.SampleProgress(); });
+	while (!readAll or numOfCollected < numOfSubmitted)
+	{
+		// A reader blocked on stdin can't be interrupted, so once every job it submitted is written the process leaves without it
+		if (interruptToken.IsCancelled() and !readAll and numOfCollected == numOfSubmitted)
+		{
+			reporter.Stop();
+			std::cout << "\nCancelled" << std::endl;
+			std::_Exit(CANCELLED_EXIT_STATUS);
+		}
 
-			color += ambient;
+		RenderJob* job(scheduler.WaitForFinishedJob(std::chrono::milliseconds(PROGRESS_INTERVAL_MS)));
+		if (job == nullptr)
+			continue;
 
-			distanceToLight = (scene.lights[i].position.w == POINT_LIGHT)
-				? glm::distance(shadowRay.origin, glm::vec3(scene.lights[i].position))
-				: glm::distance(shadowRay.origin, shadowRay.direction * 999.0f);
-			
-			// Lit when (.obj is null) or (.obj is not null but distance to intersectionPoint is greater than distance to light)
-			if ((shadowingInfo.obj == nullptr) or ((shadowingInfo.obj != nullptr) and (glm::distance(shadowRay.origin, shadowingInfo.intersectionPoint) > distanceToLight)))
-			{
-				color += (diffuse + specular) * attenuation;
+		stbi_write_png(job->outputFileName.c_str(), job->image.width, job->image.height, 3, job->image.data.data(), 0);
+		std::cout << (settings.progressFormat == PROGRESS_TEXT ? "\r" : "") << job->name << (job->IsCancelled() ? ": cancelled, partial image" : ": done,") << " written to " << job->outputFileName << std::endl;
+		delete job;
+		++numOfCollected;
+	}
+	reader.join();
+	return interruptToken.IsCancelled() ? CANCELLED_EXIT_STATUS : 0;
+}
 
-				// REFLECTION
-				if (maxDepth > 1)
-				{
-					reflectionRay.origin = intersectionInfo.intersectionPoint + (intersectionInfo.intersectionNormal * REFLECTION_BIAS);
-					reflectionRay.direction = glm::reflect(intersectionInfo.incomingRay.direction, intersectionInfo.intersectionNormal);
+// Differences between a reference and a candidate image
+struct ImageError
+{
+	double rmse; // Root mean square error of the color channels, in [0, 1] units
+	double psnr; // Peak signal-to-noise ratio in dB (infinite for identical images)
+	double ssim; // Mean structural similarity of the luminance (1 for identical images), as a perceptual measure
+};
+
+/**
+ * @brief Compares two images of the same size
+ * @param[in] reference Reference image
+ * @param[in] candidate Candidate image
+ * @return RMSE, PSNR and SSIM of the candidate
+ */
+ImageError CompareImages(const Image& reference, const Image& candidate)
+{
+	ImageError error;
+	double squaredErrorSum(0.0);
+	for (size_t i = 0; i < reference.data.size(); ++i)
+	{
+		double difference((reference.data[i] - candidate.data[i]) / 255.0);
+		squaredErrorSum += difference * difference;
+	}
+	error.rmse = std::sqrt(squaredErrorSum / std::max<size_t>(reference.data.size(), 1));
+	error.psnr = (error.rmse > 0.0) ? 20.0 * std::log10(1.0 / error.rmse) : INFINITY;
 
-					color += RayTrace(reflectionRay, scene, camera, maxDepth - 1) * intersectionInfo.obj->material.shininess / REFLECTIVITY_CONSTANT;
+	// SSIM over 8x8 windows with a stride of 4, on luminance
+	const int window(8), stride(4);
+	const double c1(0.01 * 0.01), c2(0.03 * 0.03);
+	double ssimSum(0.0);
+	size_t numOfWindows(0);
+	for (int y0 = 0; y0 + window <= reference.height; y0 += stride)
+	{
+		for (int x0 = 0; x0 + window <= reference.width; x0 += stride)
+		{
+			double meanA(0.0), meanB(0.0), varianceA(0.0), varianceB(0.0), covariance(0.0);
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				for (int y = y0; y < y0 + window; ++y)
+				{
+					for (int x = x0; x < x0 + window; ++x)
+					{
+						const unsigned char* a(&reference.data[(static_cast<size_t>(y) * reference.width + x) * 3]);
+						const unsigned char* b(&candidate.data[(static_cast<size_t>(y) * candidate.width + x) * 3]);
+						double lumaA(Luminance(glm::vec3(a[0], a[1], a[2]) / 255.0f)), lumaB(Luminance(glm::vec3(b[0], b[1], b[2]) / 255.0f));
+						if (pass == 0)
+						{
+							meanA += lumaA;
+							meanB += lumaB;
+							continue;
+						}
+						varianceA += (lumaA - meanA) * (lumaA - meanA);
+						varianceB += (lumaB - meanB) * (lumaB - meanB);
+						covariance += (lumaA - meanA) * (lumaB - meanB);
+					}
+				}
+				if (pass == 0)
+				{
+					meanA /= window * window;
+					meanB /= window * window;
 				}
 			}
+			varianceA /= (window * window) - 1;
+			varianceB /= (window * window) - 1;
+			covariance /= (window * window) - 1;
+			ssimSum += ((2.0 * meanA * meanB + c1) * (2.0 * covariance + c2)) / (((meanA * meanA) + (meanB * meanB) + c1) * (varianceA + varianceB + c2));
+			++numOfWindows;
 		}
 	}
+	error.ssim = (numOfWindows > 0) ? ssimSum / numOfWindows : 1.0;
+	return error;
+}
 
-	return color;
+/**
+ * @brief Loads one scene without rendering it, so the timed renders of a comparison find warm file caches and the scene's generated files built
+ * @param[in] sceneFileName .test file inside ./test directory
+ * @param[in] settings      Render settings
+ */
+void WarmUpForComparison(const std::string& sceneFileName, RenderSettings settings)
+{
+	RenderJob job;
+	PackedGeometry packedGeometry;
+	settings.packedFileName = "./test/" + sceneFileName + ".packed";
+	if (LoadJob(sceneFileName, settings, job) and settings.outOfCore)
+		packedGeometry.Open(settings.packedFileName);
 }
 
 /**
- * Main function
+ * @brief Loads and renders one scene without any output, for comparisons
+ * @param[in]  sceneFileName .test file inside ./test directory
+ * @param[in]  settings      Render settings
+ * @param[out] outImage      Rendered image
+ * @return Wall time of loading and rendering in seconds, or a negative value if the scene could not be loaded
  */
-int main()
+double RenderForComparison(const std::string& sceneFileName, RenderSettings settings, Image& outImage)
 {
-	char antiAliasingChoice;
-	bool antiAliasing(false);
+	std::chrono::steady_clock::time_point start(std::chrono::steady_clock::now());
+	RenderJob job;
+	PackedGeometry packedGeometry;
+	settings.packedFileName = "./test/" + sceneFileName + ".packed";
+	if (!LoadJob(sceneFileName, settings, job) or (settings.outOfCore and !packedGeometry.Open(settings.packedFileName)))
+		return -1.0;
+
+	job.cancellation = &interruptToken;
+	if (settings.outOfCore)
+	{
+		ProgressCounters progress(job.image.height);
+		RenderOutOfCore(packedGeometry, job.scene, job.camera, job.maxDepth, job.antiAliasing, settings.numOfThreads, job.image, progress, interruptToken);
+	}
+	else if (settings.preview != PREVIEW_NONE)
+		RenderPreview(job, settings.preview, settings.numOfThreads);
+	else
+	{
+		RenderScheduler scheduler;
+		scheduler.Start(settings.numOfThreads);
+		scheduler.Submit(&job);
+		while (scheduler.WaitForFinishedJob(std::chrono::milliseconds(PROGRESS_INTERVAL_MS)) == nullptr)
+			;
+	}
+	outImage = job.image;
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
 
-	Scene scene;
-	int numOfObjects, numOfLights;
-	Camera camera;
-	int maxDepth;
+/**
+ * @brief Renders every scene in ./test (or only settings.sceneFileName) with the reference settings and with the candidate options,
+ * and prints wall time, speedup, RMSE, PSNR and SSIM side by side. Both configurations load each scene once untimed and then render it
+ * COMPARISON_RUNS times in alternating order; the fastest render of each is reported.
+ * @param[in] program   Name of the executable, for error messages
+ * @param[in] reference Reference settings (settings.compareOptions holds the candidate's options)
+ * @return Exit status: 0 if every scene is within settings.maxComparisonError, 1 otherwise, CANCELLED_EXIT_STATUS if interrupted
+ */
+int RunComparison(const char* program, const RenderSettings& reference)
+{
+	// The candidate is configured from its own options only, so options of the reference do not leak into it
+	std::istringstream optionStream(reference.compareOptions);
+	std::vector<std::string> options(1, program);
+	std::string option;
+	while (optionStream >> option)
+		options.push_back(option);
+	std::vector<char*> arguments;
+	for (size_t i = 0; i < options.size(); ++i)
+		arguments.push_back(&options[i][0]);
 
-	// open .test file
-	std::ifstream sceneFile;
-	std::string filename;
-	std::cout << "Enter filename inside ./test directory: ";
-	std::cin >> filename;
-	sceneFile.open("./test/" + filename);
+	RenderSettings candidate;
+	if (!ParseArguments(static_cast<int>(arguments.size()), arguments.data(), candidate) or !candidate.sceneFileName.empty() or !candidate.compareOptions.empty())
+	{
+		std::cerr << "Invalid --compare options: " << reference.compareOptions << "\n";
+		return 1;
+	}
+	if (candidate.numOfThreads == 0)
+		candidate.numOfThreads = reference.numOfThreads;
 
-	if (!sceneFile)
+	std::vector<std::string> sceneFileNames;
+	if (!reference.sceneFileName.empty())
+		sceneFileNames.push_back(reference.sceneFileName);
+	else
 	{
-		std::cerr << "File not found.\n";
-		exit(1);
+		std::error_code error;
+		for (std::filesystem::directory_iterator entry("./test", error), end; !error and entry != end; entry.increment(error))
+		{
+			if (entry->path().extension() == ".test")
+				sceneFileNames.push_back(entry->path().filename().string());
+		}
+		std::sort(sceneFileNames.begin(), sceneFileNames.end());
 	}
 
-	// camera data
-	sceneFile >> camera.imageWidth >> camera.imageHeight;
-	sceneFile >> camera.position.x >> camera.position.y >> camera.position.z;
-	sceneFile >> camera.lookTarget.x >> camera.lookTarget.y >> camera.lookTarget.z;
-	sceneFile >> camera.globalUp.x >> camera.globalUp.y >> camera.globalUp.z;
-	sceneFile >> camera.fovY >> camera.focalLength;
+	size_t numOfFailed(0);
+	std::cout << std::left << std::setw(20) << "Scene" << std::right << std::setw(11) << "Reference" << std::setw(11) << "Candidate" << std::setw(9) << "Speedup"
+						<< std::setw(10) << "RMSE" << std::setw(10) << "PSNR" << std::setw(8) << "SSIM" << "\n";
+	for (size_t i = 0; i < sceneFileNames.size(); ++i)
+	{
+		Image referenceImage, candidateImage;
+		WarmUpForComparison(sceneFileNames[i], reference);
+		WarmUpForComparison(sceneFileNames[i], candidate);
 
-	sceneFile >> maxDepth >> numOfObjects;
+		// Renders go reference, candidate, candidate, reference, ... so neither configuration always runs first. A failed render (negative time) stays the minimum.
+		double referenceTime(DBL_MAX), candidateTime(DBL_MAX);
+		for (int run = 0; run < 2 * COMPARISON_RUNS and !interruptToken.IsCancelled(); ++run)
+		{
+			bool isReference((run % 4 == 0) or (run % 4 == 3));
+			double seconds(RenderForComparison(sceneFileNames[i], isReference ? reference : candidate, isReference ? referenceImage : candidateImage));
+			double& time(isReference ? referenceTime : candidateTime);
+			time = std::min(time, seconds);
+		}
+		if (interruptToken.IsCancelled())
+		{
+			std::cout << "Cancelled" << std::endl;
+			return CANCELLED_EXIT_STATUS;
+		}
+		std::cout << std::left << std::setw(20) << sceneFileNames[i] << std::right;
+		if (referenceTime < 0.0 or candidateTime < 0.0 or referenceImage.width != candidateImage.width or referenceImage.height != candidateImage.height)
+		{
+			std::cout << "  FAIL (could not render both configurations at the same size)\n";
+			++numOfFailed;
+			continue;
+		}
 
-	std::string objectType;
-	Sphere* sphere;
-	Triangle* triangle;
-	Material material;
-	sphere = new Sphere();
-	triangle = new Triangle();
-	for (size_t i = 0; i < numOfObjects; ++i)
-	{
-		sceneFile >> objectType;
-		if (objectType == "sphere") // SPHERE
+		ImageError error(CompareImages(referenceImage, candidateImage));
+		bool failed(error.rmse > reference.maxComparisonError);
+		numOfFailed += failed ? 1 : 0;
+		std::cout << std::fixed << std::setprecision(3) << std::setw(9) << referenceTime << " s" << std::setw(9) << candidateTime << " s"
+							<< std::setprecision(2) << std::setw(8) << (candidateTime > 0.0 ? referenceTime / candidateTime : 0.0) << "x"
+							<< std::setprecision(5) << std::setw(10) << error.rmse << std::setprecision(1) << std::setw(7) << error.psnr << " dB"
+							<< std::setprecision(4) << std::setw(8) << error.ssim << (failed ? "  FAIL" : "  ok") << std::defaultfloat << "\n";
+	}
+
+	std::cout << (sceneFileNames.size() - numOfFailed) << " of " << sceneFileNames.size() << " scenes within RMSE " << reference.maxComparisonError << std::endl;
+	return (numOfFailed > 0) ? 1 : 0;
+}
+
+// Internal resolution and sampling of an interactive frame
+struct FrameSettings
+{
+	float scale; // Internal resolution relative to the output, in both directions
+	int samples; // Jittered samples per internal pixel (1 traces through the pixel centers)
+};
+
+/**
+ * @brief Renders one interactive frame at a reduced internal resolution and upsamples it bilinearly to the job's image size
+ * @param[in]  job          Render job (its image size is the output size)
+ * @param[in]  frame        Internal resolution and samples per pixel
+ * @param[in]  numOfThreads Number of threads to use (0 for DefaultThreadCount())
+ * @param[out] outColors    Output pixels, top row first
+ */
+void RenderInteractiveFrame(const RenderJob& job, const FrameSettings& frame, const unsigned& numOfThreads, std::vector<glm::vec3>& outColors)
+{
+	// Scaling the camera's image size keeps its field of view
+	Camera camera(job.camera);
+	camera.imageWidth = std::max(1, static_cast<int>(std::lround(job.image.width * frame.scale)));
+	camera.imageHeight = std::max(1, static_cast<int>(std::lround(job.image.height * frame.scale)));
+	int width(camera.imageWidth), height(camera.imageHeight);
+
+	std::vector<glm::vec3> colors(static_cast<size_t>(width) * height);
+	ParallelFor(colors.size(), PREVIEW_GRAIN, numOfThreads, [&](const size_t& begin, const size_t& end) {
+		for (size_t k = begin; k < end; ++k)
 		{
-			sphere = new Sphere();
-			sceneFile >> sphere->center.x >> sphere->center.y >> sphere->center.z >> sphere->radius;
+			int x(static_cast<int>(k % width)), y(static_cast<int>(k / width));
+			Random random(PixelSeed(x, y));
+			glm::vec3 colorSum;
+			for (int i = 0; i < frame.samples; ++i)
+				colorSum += RayTrace(GetRayThruPixel(camera, x, height - y - 1, (frame.samples > 1) ? &random : nullptr), job.scene, camera, job.maxDepth);
+			colors[k] = colorSum / static_cast<float>(frame.samples);
 		}
-		else // TRIANGLE
+	});
+
+	// Pixel centers of both resolutions are aligned
+	outColors.resize(static_cast<size_t>(job.image.width) * job.image.height);
+	float scaleX(static_cast<float>(width) / job.image.width), scaleY(static_cast<float>(height) / job.image.height);
+	for (int y = 0; y < job.image.height; ++y)
+	{
+		float fy(glm::clamp((y + 0.5f) * scaleY - 0.5f, 0.0f, static_cast<float>(height - 1)));
+		int y0(static_cast<int>(fy)), y1(std::min(y0 + 1, height - 1));
+		for (int x = 0; x < job.image.width; ++x)
 		{
-			triangle = new Triangle();
-			sceneFile >> triangle->A.x >> triangle->A.y >> triangle->A.z;
-			sceneFile >> triangle->B.x >> triangle->B.y >> triangle->B.z;
-			sceneFile >> triangle->C.x >> triangle->C.y >> triangle->C.z;
+			float fx(glm::clamp((x + 0.5f) * scaleX - 0.5f, 0.0f, static_cast<float>(width - 1)));
+			int x0(static_cast<int>(fx)), x1(std::min(x0 + 1, width - 1));
+			glm::vec3 top(glm::mix(colors[static_cast<size_t>(y0) * width + x0], colors[static_cast<size_t>(y0) * width + x1], fx - x0));
+			glm::vec3 bottom(glm::mix(colors[static_cast<size_t>(y1) * width + x0], colors[static_cast<size_t>(y1) * width + x1], fx - x0));
+			outColors[static_cast<size_t>(y) * job.image.width + x] = glm::mix(top, bottom, fy - y0);
 		}
+	}
+}
+
+/**
+ * @brief Picks the resolution and sampling of the next interactive frame from the measured cost of a sample:
+ * the resolution goes up to the output size first, then the samples per pixel go up to SAMPLES_PER_PIXEL
+ * @param[in] secondsPerSample Estimated time per traced sample, including the per-frame overhead spread over the samples
+ * @param[in] targetSeconds    Frame time to hit
+ * @param[in] numOfPixels      Pixels of the output
+ * @return Settings of the next frame
+ */
+FrameSettings ChooseFrameSettings(const double& secondsPerSample, const double& targetSeconds, const size_t& numOfPixels)
+{
+	FrameSettings frame = {1.0f, 1};
+	double budget(targetSeconds / secondsPerSample);
+	if (budget >= static_cast<double>(numOfPixels))
+		frame.samples = std::min(SAMPLES_PER_PIXEL, std::max(1, static_cast<int>(budget / numOfPixels)));
+	else
+		frame.scale = std::max(MIN_INTERACTIVE_SCALE, static_cast<float>(std::sqrt(budget / numOfPixels)));
+	return frame;
+}
+
+/**
+ * @brief Renders the scene over and over into the shared framebuffer until SIGINT or SIGTERM, adapting the internal resolution and
+ * the samples per pixel of every frame to hit settings.targetFrameTime. When the scene file changes (e.g. the camera was moved),
+ * it is reloaded for the next frame. Every tile flag of the framebuffer is set to the frame number once the frame is complete.
+ * @param[in,out] loadedJob   Loaded render job
+ * @param[in,out] framebuffer Created shared-memory framebuffer of the job's image size
+ * @param[in]     settings    Render settings
+ */
+void RunInteractive(RenderJob& loadedJob, SharedFramebuffer& framebuffer, const RenderSettings& settings)
+{
+	RenderJob* job(&loadedJob);
+	std::unique_ptr<RenderJob> reloadedJob;
+	std::string scenePath("./test/" + settings.sceneFileName);
+	std::error_code error;
+	std::filesystem::file_time_type sceneTime(std::filesystem::last_write_time(scenePath, error));
+	double targetSeconds(settings.targetFrameTime / 1000.0);
+	size_t numOfPixels(static_cast<size_t>(job->image.width) * job->image.height);
+	FrameSettings frame = {0.25f, 1};
+	double secondsPerSample(0.0);
+	std::vector<glm::vec3> colors, tileColors;
 
-		sceneFile >> material.ambient.r >> material.ambient.g >> material.ambient.b;
-		sceneFile >> material.diffuse.r >> material.diffuse.g >> material.diffuse.b;
-		sceneFile >> material.specular.r >> material.specular.g >> material.specular.b;
-		sceneFile >> material.shininess;
-		if (objectType == "sphere")
+	for (uint32_t frameNumber = 1; !interruptToken.IsCancelled(); ++frameNumber)
+	{
+		std::chrono::steady_clock::time_point frameStart(std::chrono::steady_clock::now());
+		std::filesystem::file_time_type time(std::filesystem::last_write_time(scenePath, error));
+		if (!error and time != sceneTime)
 		{
-			sphere->material = material;
-			scene.objects.push_back(sphere);
+			sceneTime = time;
+			std::unique_ptr<RenderJob> reloaded(new RenderJob());
+			if (LoadJob(settings.sceneFileName, settings, *reloaded))
+			{
+				if (reloaded->image.width != job->image.width or reloaded->image.height != job->image.height)
+					std::cerr << "\n" << settings.sceneFileName << " changed its image size, which the framebuffer can't follow; keeping the old scene.\n";
+				else
+				{
+					reloadedJob.swap(reloaded);
+					job = reloadedJob.get();
+				}
+			}
 		}
-		else
+
+		RenderInteractiveFrame(*job, frame, settings.numOfThreads, colors);
+		for (size_t t = 0; t < job->tiles.size(); ++t)
 		{
-			triangle->material = material;
-			scene.objects.push_back(triangle);
+			const Tile& tile(job->tiles[t]);
+			tileColors.clear();
+			for (int y = tile.y0; y < tile.y1; ++y)
+			{
+				for (int x = tile.x0; x < tile.x1; ++x)
+				{
+					tileColors.push_back(colors[static_cast<size_t>(y) * job->image.width + x]);
+					job->image.SetColor(x, y, tileColors.back());
+				}
+			}
+			framebuffer.WriteTile(t, tile, job->image, tileColors.data(), frameNumber);
 		}
+
+		// The samples of this frame update the cost estimate, which sizes the next frame
+		double seconds(std::chrono::duration<double>(std::chrono::steady_clock::now() - frameStart).count());
+		double numOfSamples(std::max(1.0, std::round(numOfPixels * static_cast<double>(frame.scale) * frame.scale)) * frame.samples);
+		secondsPerSample = (secondsPerSample > 0.0) ? (1.0 - FRAME_COST_SMOOTHING) * secondsPerSample + FRAME_COST_SMOOTHING * (seconds / numOfSamples) : seconds / numOfSamples;
+		if (settings.progressFormat == PROGRESS_TEXT)
+			std::cout << "\rFrame " << frameNumber << ": " << std::fixed << std::setprecision(1) << (frame.scale * 100.0f) << "% resolution, " << frame.samples << " samples/pixel, "
+								<< (seconds * 1000.0) << " ms (target " << settings.targetFrameTime << " ms)" << std::defaultfloat << "   " << std::flush;
+		else if (settings.progressFormat == PROGRESS_JSON)
+			std::cout << "{\"frame\":" << frameNumber << ",\"scale\":" << frame.scale << ",\"samples\":" << frame.samples << ",\"frame_ms\":" << (seconds * 1000.0) << "}" << std::endl;
+		frame = ChooseFrameSettings(secondsPerSample, targetSeconds, numOfPixels);
+
+		// Frames that come in under the target (at full quality) are held back, so the frame rate stays stable
+		if (seconds < targetSeconds)
+			std::this_thread::sleep_for(std::chrono::duration<double>(targetSeconds - seconds));
 	}
+	std::cout << std::endl;
+}
 
-	sceneFile >> numOfLights;
+#ifndef RAYTRACER_NO_MAIN
+/**
+ * Main function
+ */
+int main(int argc, char* argv[])
+{
+	char antiAliasingChoice;
+	RenderSettings settings;
+	if (!ParseArguments(argc, argv, settings))
+		return 1;
 
-	Light* light;
-	for (size_t i = 0; i < numOfLights; ++i)
+	CpuBudget cpuBudget(CpuBudget::Detect());
+	std::cout << "Threads: ";
+	if (settings.numOfThreads > 0)
+		std::cout << settings.numOfThreads << " (set by --threads)";
+	else
+	{
+		settings.numOfThreads = cpuBudget.Threads();
+		std::cout << settings.numOfThreads << " (hardware " << cpuBudget.hardwareThreads << ", affinity " << cpuBudget.affinityThreads;
+		if (cpuBudget.quotaCpus > 0.0)
+			std::cout << ", cgroup quota " << cpuBudget.quotaCpus << " CPUs";
+		std::cout << ")";
+	}
+	std::cout << std::endl;
+
+	std::signal(SIGINT, HandleInterrupt);
+	std::signal(SIGTERM, HandleInterrupt);
+
+	if (!settings.jobsFileName.empty())
+		return RunJobFile(settings);
+	if (!settings.compareOptions.empty())
+		return RunComparison(argv[0], settings);
+
+	RenderJob job;
+	PackedGeometry packedGeometry;
+	SharedFramebuffer framebuffer;
+
+	// Without a scene on the command line, ask for everything interactively
+	bool interactive(settings.sceneFileName.empty());
+	if (interactive)
+	{
+		std::cout << "Enter filename inside ./test directory: ";
+		std::cin >> settings.sceneFileName;
+	}
+
+	if (settings.packedFileName.empty())
+		settings.packedFileName = "./test/" + settings.sceneFileName + ".packed";
+	if (!LoadJob(settings.sceneFileName, settings, job))
+		exit(1);
+	if (settings.outOfCore and !packedGeometry.Open(settings.packedFileName))
 	{
-		light = new Light();
-		sceneFile >> light->position.x >> light->position.y >> light->position.z >> light->position.w;
-		sceneFile >> light->ambient.r >> light->ambient.g >> light->ambient.b;
-		sceneFile >> light->diffuse.r >> light->diffuse.g >> light->diffuse.b;
-		sceneFile >> light->specular.r >> light->specular.g >> light->specular.b;
-		sceneFile >> light->constant >> light->linear >> light->quadratic;
-		scene.lights.push_back(*light);
+		std::cerr << "Could not open packed geometry " << settings.packedFileName << ".\n";
+		exit(1);
+	}
+
+	if (interactive)
+	{
+		std::cout << "Enable anti-aliasing? (Y/N) ";
+		std::cin >> antiAliasingChoice;
+		if (tolower(antiAliasingChoice) == 'y' and settings.mirrorPackets)
+		{
+			std::cerr << "--mirror-packets cannot be combined with anti-aliasing.\n";
+			exit(1);
+		}
+		if (tolower(antiAliasingChoice) == 'y')
+			job.antiAliasing = true;
 	}
 
-	std::cout << "Enable anti-aliasing? (Y/N) ";
-	std::cin >> antiAliasingChoice;
-	if (tolower(antiAliasingChoice) == 'y')
-		antiAliasing = true;
+	if (settings.targetFrameTime > 0.0)
+	{
+		if (!framebuffer.Create(settings.framebufferName, job.image.width, job.image.height, settings.framebufferFormat))
+		{
+			std::cerr << "Could not create shared-memory framebuffer " << settings.framebufferName << ".\n";
+			exit(1);
+		}
+		RunInteractive(job, framebuffer, settings);
+		framebuffer.header->finished.store(1, std::memory_order_release);
+		return 0;
+	}
 
 	// for each pixel in viewport, cast a ray and set the calculated color to the corresponding pixel
-	Image image(camera.imageWidth, camera.imageHeight);
-	for (int y = 0; y < image.height; ++y)
+	std::unique_ptr<CacheMissCounter> cacheMisses;
+	double renderSeconds(0.0), fractionRendered(1.0);
+	job.cancellation = &interruptToken;
+	if (settings.outOfCore)
+	{
+		ProgressCounters progress(job.image.height);
+		ProgressReporter reporter;
+		reporter.Start(settings.progressFormat, [&] {
+			ProgressSample sample = {job.name, -1, static_cast<double>(progress.completedWork.load()) / std::max<uint64_t>(progress.totalWork, 1), progress.raysCast.load(), -1.0};
+			return std::vector<ProgressSample>(1, sample);
+		});
+		RenderOutOfCore(packedGeometry, job.scene, job.camera, job.maxDepth, job.antiAliasing, settings.numOfThreads, job.image, progress, interruptToken);
+		fractionRendered = static_cast<double>(progress.completedWork.load()) / std::max<uint64_t>(progress.totalWork, 1);
+	}
+	else if (settings.preview != PREVIEW_NONE)
 	{
-		for (int x = 0; x < image.width; ++x)
+		if (settings.printStatistics)
+			cacheMisses.reset(new CacheMissCounter());
+		std::chrono::steady_clock::time_point renderStart(std::chrono::steady_clock::now());
+		RenderPreview(job, settings.preview, settings.numOfThreads);
+		renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+		fractionRendered = job.IsCancelled() ? 0.0 : 1.0;
+		std::cout << "Preview rendered in " << renderSeconds << " s";
+	}
+	else
+	{
+		Checkpoint checkpoint;
+		if (settings.resume)
 		{
-			// ANTI-ALIASING
-			if (antiAliasing)
+			if (!checkpoint.Read(settings.checkpointFileName))
+				std::cout << "No checkpoint in " << settings.checkpointFileName << ", starting from scratch." << std::endl;
+			else if (!checkpoint.Restore(job))
 			{
-				glm::vec3 colorSum;
-				for (int i = 0; i < SAMPLES_PER_PIXEL; ++i)
-				{
-					Ray ray = GetRayThruPixel(camera, x, image.height - y - 1, antiAliasing);
-					colorSum += RayTrace(ray, scene, camera, maxDepth);
-				}
-				colorSum /= SAMPLES_PER_PIXEL;
-				image.SetColor(x, y, colorSum);
+				std::cerr << "Checkpoint " << settings.checkpointFileName << " belongs to a render with a different scene, camera, image size or options.\n";
+				exit(1);
 			}
 			else
+				std::cout << "Resuming from " << settings.checkpointFileName << ": " << job.completedTiles << " of " << job.tiles.size() << " tiles done" << std::endl;
+		}
+
+		if (!settings.framebufferName.empty())
+		{
+			if (!framebuffer.Create(settings.framebufferName, job.image.width, job.image.height, settings.framebufferFormat))
+			{
+				std::cerr << "Could not create shared-memory framebuffer " << settings.framebufferName << ".\n";
+				exit(1);
+			}
+			job.framebuffer = &framebuffer;
+
+			// Tiles restored from a checkpoint are published right away
+			for (size_t i = 0; i < job.tiles.size(); ++i)
 			{
-				Ray ray(GetRayThruPixel(camera, x, image.height - y - 1));
-				glm::vec3 color(RayTrace(ray, scene, camera, maxDepth));
-				image.SetColor(x, y, color);
+				if (job.tilePasses[i] > 0)
+					framebuffer.WriteTile(i, job.tiles[i], job.image, nullptr, job.tilePasses[i]);
 			}
 		}
 
-		std::cout << "Row: " << std::setfill(' ') << std::setw(4) << (y + 1) << " / " << std::setfill(' ') << std::setw(4) << image.height << "\r" << std::flush;
+		// Checkpoints are copied under the scheduler's lock and written from this thread, so the workers keep rendering while they are saved
+		if (settings.printStatistics)
+			cacheMisses.reset(new CacheMissCounter());
+		std::chrono::steady_clock::time_point renderStart(std::chrono::steady_clock::now());
+		RenderScheduler scheduler;
+		ProgressReporter reporter;
+		std::chrono::steady_clock::time_point lastCheckpoint(std::chrono::steady_clock::now());
+		scheduler.Start(settings.numOfThreads);
+		scheduler.Submit(&job);
+		reporter.Start(settings.progressFormat, [&scheduler] { return scheduler.SampleProgress(); });
+		while (scheduler.WaitForFinishedJob(std::chrono::milliseconds(PROGRESS_INTERVAL_MS)) == nullptr)
+		{
+			if (!settings.checkpointFileName.empty() and std::chrono::steady_clock::now() - lastCheckpoint >= std::chrono::seconds(settings.checkpointInterval))
+			{
+				scheduler.CaptureCheckpoint(job, checkpoint);
+				if (!checkpoint.Write(settings.checkpointFileName))
+					std::cerr << "\nCould not write checkpoint " << settings.checkpointFileName << ".\n";
+				lastCheckpoint = std::chrono::steady_clock::now();
+			}
+		}
+		reporter.Stop();
+		scheduler.Stop();
+		renderSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+
+		size_t numOfRendered(0);
+		for (size_t i = 0; i < job.tiles.size(); ++i)
+			numOfRendered += (job.tilePasses[i] > 0) ? 1 : 0;
+		fractionRendered = job.tiles.empty() ? 1.0 : static_cast<double>(numOfRendered) / job.tiles.size();
+
+		// A cancelled render leaves a final checkpoint behind, so it can be resumed where it stopped
+		if (job.IsCancelled() and !settings.checkpointFileName.empty())
+		{
+			checkpoint.Capture(job);
+			if (!checkpoint.Write(settings.checkpointFileName))
+				std::cerr << "\nCould not write checkpoint " << settings.checkpointFileName << ".\n";
+		}
 	}
 	std::cout << std::endl;
+	if (job.IsCancelled())
+		std::cout << "Cancelled: " << std::fixed << std::setprecision(1) << (fractionRendered * 100.0) << std::defaultfloat << std::setprecision(6) << "% of the image rendered" << std::endl;
+	if (job.progressive)
+		PrintRefinementStatistics(job);
+	if (cacheMisses)
+		PrintRenderStatistics(job, renderSeconds, *cacheMisses);
+	if (job.scene.profile != nullptr)
+	{
+		if (WriteRayCostReport(job.scene, settings.profileFileName))
+			std::cout << "Ray cost report written to " << settings.profileFileName << std::endl;
+		else
+			std::cerr << "Could not write " << settings.profileFileName << ".\n";
+	}
 
-	std::string imageFileName = "scene.png"; // You might need to make this a full path if you are on Mac
-	stbi_write_png(imageFileName.c_str(), image.width, image.height, 3, image.data.data(), 0);
-
-	for (size_t i = 0; i < scene.objects.size(); ++i)
+	if (job.framebuffer != nullptr)
+	{
+		framebuffer.header->finished.store(job.IsCancelled() ? 2 : 1, std::memory_order_release);
+		std::cout << "Rendered into shared-memory framebuffer " << settings.framebufferName << std::endl;
+	}
+	else
 	{
-		delete scene.objects[i];
+		std::string imageFileName = "scene.png"; // You might need to make this a full path if you are on Mac
+		stbi_write_png(imageFileName.c_str(), job.image.width, job.image.height, 3, job.image.data.data(), 0);
 	}
+	if (!settings.checkpointFileName.empty() and !job.IsCancelled())
+		std::remove(settings.checkpointFileName.c_str());
 
 	// DEBUG only
 	// system("pause");
 
-	return 0;
-}
\ No newline at end of file
+	return job.IsCancelled() ? CANCELLED_EXIT_STATUS : 0;
+}
+#endif